@@ -4,7 +4,12 @@
 # Phases:
 #   1. standalone (single process) server on TCP  -> C suite (msgpack + json) + PHP suite
 #   2. standalone server on a unix domain socket  -> C suite
-#   3. daemonised pre-fork server (4 workers)     -> C concurrent suite (msgpack + json)
+#   3. daemonised pre-fork server (4 workers pinned to CPUs, recycled every ~20 requests)
+#                                                 -> C concurrent suite (msgpack + json)
+#   4. daemonised dynamic pre-fork server, spread over NUMA nodes
+#                                                 -> scoreboard test + C concurrent suite
+#   5. daemonised dynamic pre-fork server with slow starting workers
+#                                                 -> drain and scoreboard tests
 #
 # Usage: sh tests/run_all.sh [--php <path-to-php>]
 #
@@ -87,6 +92,24 @@ step() {
 	printf '\n===== %s =====\n' "$1"
 }
 
+# SIGTERM the daemon in $daemon_pid_file and wait for it to go away
+stop_daemon() {
+	if [ -f "$daemon_pid_file" ]; then
+		daemon_pid=$(cat "$daemon_pid_file")
+		kill "$daemon_pid" 2>/dev/null
+		i=0
+		while [ $i -lt 10 ] && kill -0 "$daemon_pid" 2>/dev/null; do
+			sleep 1
+			i=$((i + 1))
+		done
+		if kill -0 "$daemon_pid" 2>/dev/null; then
+			echo "warning: daemon server (pid $daemon_pid) did not shut down gracefully" >&2
+			kill -9 "$daemon_pid" 2>/dev/null
+			overall=1
+		fi
+	fi
+}
+
 # --- 1. standalone TCP server ------------------------------------------------
 step "starting standalone TCP server on 127.0.0.1:$PORT"
 ./yar_test_server -S "127.0.0.1:$PORT" -X -l "$LOGDIR/tcp.log" &
@@ -161,9 +184,9 @@ else
 fi
 
 # --- 4. daemonised pre-fork server ---------------------------------------------
-step "starting daemonised pre-fork server on 127.0.0.1:$DPORT (4 workers)"
+step "starting daemonised pre-fork server on 127.0.0.1:$DPORT (4 workers, recycled every ~20 requests)"
 rm -f "$daemon_pid_file"
-./yar_test_server -S "127.0.0.1:$DPORT" -n 4 -p "$daemon_pid_file" -l "$LOGDIR/daemon.log"
+./yar_test_server -S "127.0.0.1:$DPORT" -n 4 -r 20 -a cpu -p "$daemon_pid_file" -l "$LOGDIR/daemon.log"
 
 if ! ./yar_test_client --uri "tcp://127.0.0.1:$DPORT" --probe; then
 	echo "FATAL: daemon server did not come up (see $LOGDIR/daemon.log)" >&2
@@ -179,20 +202,42 @@ if [ "$HAVE_JSON" = 1 ]; then
 	./yar_test_client --uri "tcp://127.0.0.1:$DPORT" --concurrent --packager json || overall=1
 fi
 
-if [ -f "$daemon_pid_file" ]; then
-	daemon_pid=$(cat "$daemon_pid_file")
-	kill "$daemon_pid" 2>/dev/null
-	i=0
-	while [ $i -lt 10 ] && kill -0 "$daemon_pid" 2>/dev/null; do
-		sleep 1
-		i=$((i + 1))
-	done
-	if kill -0 "$daemon_pid" 2>/dev/null; then
-		echo "warning: daemon server (pid $daemon_pid) did not shut down gracefully" >&2
-		kill -9 "$daemon_pid" 2>/dev/null
-		overall=1
-	fi
+stop_daemon
+
+# --- 5. daemonised dynamic pre-fork server -------------------------------------
+step "starting daemonised dynamic pre-fork server on 127.0.0.1:$DPORT (2 workers, 1~3 spare, 6 at most)"
+rm -f "$daemon_pid_file"
+./yar_test_server -S "127.0.0.1:$DPORT" -n 6 -D 2:1:3 -a node -s "$LOGDIR/scoreboard" -p "$daemon_pid_file" -l "$LOGDIR/dynamic.log"
+
+if ! ./yar_test_client --uri "tcp://127.0.0.1:$DPORT" --probe; then
+	echo "FATAL: dynamic daemon server did not come up (see $LOGDIR/dynamic.log)" >&2
+	[ -f "$LOGDIR/dynamic.log" ] && cat "$LOGDIR/dynamic.log" >&2
+	exit 1
 fi
 
+step "scoreboard (dynamic pre-fork daemon)"
+./yar_test_client --uri "tcp://127.0.0.1:$DPORT" --scoreboard "$LOGDIR/scoreboard" || overall=1
+
+step "C concurrent suite (dynamic pre-fork daemon)"
+./yar_test_client --uri "tcp://127.0.0.1:$DPORT" --concurrent || overall=1
+
+stop_daemon
+
+# --- 6. dynamic pre-fork server, workers take 4 seconds to start ---------------
+step "starting daemonised dynamic pre-fork server on 127.0.0.1:$DPORT (1 worker, 1~1 spare, 4 at most, 4s worker init)"
+rm -f "$daemon_pid_file"
+./yar_test_server -S "127.0.0.1:$DPORT" -n 4 -D 1:1:1 -i 4 -s "$LOGDIR/scoreboard" -p "$daemon_pid_file" -l "$LOGDIR/drain.log"
+
+if ! ./yar_test_client --uri "tcp://127.0.0.1:$DPORT" --probe; then
+	echo "FATAL: dynamic daemon server did not come up (see $LOGDIR/drain.log)" >&2
+	[ -f "$LOGDIR/drain.log" ] && cat "$LOGDIR/drain.log" >&2
+	exit 1
+fi
+
+step "slow worker startup (dynamic pre-fork daemon)"
+./yar_test_client --uri "tcp://127.0.0.1:$DPORT" --scoreboard "$LOGDIR/scoreboard" --slow-init || overall=1
+
+stop_daemon
+
 step "result: $([ "$overall" = 0 ] && echo OK || echo FAILED)"
 exit "$overall"
@@ -6,6 +6,11 @@
  *   yar_test_client --uri <...> --probe                       wait until the server accepts connections
  *   yar_test_client --uri <...> --concurrent                  run only the concurrency test
  *   yar_test_client --uri <...> --packager <msgpack|json>     wire protocol packager (default msgpack)
+ *   yar_test_client --uri <...> --scoreboard <file>           run only the scoreboard test against a
+ *                                                             pre-fork server started with -s <file>
+ *   yar_test_client --uri <...> --scoreboard <file> --slow-init
+ *                                                             run only the tests for a dynamic pre-fork
+ *                                                             server started with -D 1:1:1 -i 4 -s <file>
  *
  * Copyright (C) 2026 Xinchen Hui <laruence at gmail dot com>
  *
@@ -27,14 +32,23 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <signal.h>
 #include <netdb.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <pthread.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
+#include "event.h"
 #include "yar.h"
+#include "yar_msgpack.h"
 #include "yar_test.h"
 
 #define TEST_ERR_EXCEPTION 0x40 /* keep in sync with YAR_ERR_EXCEPTION in php-yar */
@@ -42,6 +56,7 @@
 static char *test_uri = NULL;
 static int test_is_tcp = 0;
 static int test_packager = YAR_PACKAGER_MSGPACK;
+static char *test_scoreboard_file = NULL;
 
 /* helpers {{{ */
 static yar_client * new_client_timeout(int timeout) {
@@ -153,44 +168,17 @@ static int raw_connect(void) {
 
 	if (test_is_tcp) {
 		char host[256];
-		char *delim, *copy = strdup(test_uri + sizeof("tcp://") - 1);
-		struct hostent *hptr;
-		struct sockaddr_in sa;
+		yar_address addr;
 		int port;
 
-		if (!(delim = strchr(copy, ':'))) {
-			free(copy);
+		if (!yar_resolve_split(test_uri + sizeof("tcp://") - 1, host, sizeof(host), &port)
+				|| !yar_resolve(host, port, 0, &addr, 1)) {
 			return -1;
 		}
-		if ((size_t)(delim - copy) >= sizeof(host)) {
-			free(copy);
+		if ((fd = socket(addr.sa.ss_family, SOCK_STREAM, 0)) == -1) {
 			return -1;
 		}
-		memcpy(host, copy, delim - copy);
-		host[delim - copy] = '\0';
-		port = atoi(delim + 1);
-		free(copy);
-
-		if (!(hptr = gethostbyname(host))) {
-			return -1;
-		}
-
-		if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-			return -1;
-		}
-		memset(&sa, 0, sizeof(sa));
-		sa.sin_family = AF_INET;
-		sa.sin_port = htons(port);
-		{
-			/* see yar_copy_unaligned(): the hostent members are misaligned on
-			 * some platforms, copy them out byte-wise instead of loading them */
-			char **addr_list;
-			char *addr;
-			yar_copy_unaligned(&addr_list, &hptr->h_addr_list, sizeof(addr_list));
-			yar_copy_unaligned(&addr, addr_list, sizeof(addr));
-			yar_copy_unaligned(&sa.sin_addr, addr, sizeof(struct in_addr));
-		}
-		if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+		if (connect(fd, (struct sockaddr *)&addr.sa, addr.len) == -1) {
 			close(fd);
 			return -1;
 		}
@@ -216,6 +204,32 @@ static int raw_connect(void) {
 }
 /* }}} */
 
+typedef struct {
+	long expect;
+	int done;
+	long result;
+	int status;
+} async_result;
+
+static void async_on_complete(yar_response *response, void *data) {
+	async_result *result = (async_result *)data;
+
+	result->done++;
+	result->status = -1;
+	if (response) {
+		result->status = yar_response_get_status(response);
+		data_as_long(yar_response_get_response(response), &result->result);
+		free_response(response);
+	}
+}
+
+static long elapsed_ms(struct timeval *start) {
+	struct timeval end;
+
+	gettimeofday(&end, NULL);
+	return (end.tv_sec - start->tv_sec) * 1000 + (end.tv_usec - start->tv_usec) / 1000;
+}
+
 /* connectivity {{{ */
 static void test_connect(void) {
 	yar_client *client = new_client();
@@ -234,6 +248,223 @@ static void test_connect_refused(void) {
 	client = yar_client_init("tcp://127.0.0.1:1");
 	YAR_ASSERT(client == NULL, "connect to a closed port should fail");
 }
+
+/* a listener with a full accept queue drops SYNs, so connecting to it hangs
+ * like connecting to an unreachable host */
+static void test_connect_timeout(void) {
+	struct sockaddr_in sa;
+	socklen_t len = sizeof(sa);
+	int i, listener, fillers[4], timeout = 200;
+	struct timeval start, end;
+	yar_client *client;
+	char uri[64];
+	long elapsed;
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	YAR_ASSERT(bind(listener, (struct sockaddr *)&sa, sizeof(sa)) == 0 && listen(listener, 0) == 0, "listen failed");
+	getsockname(listener, (struct sockaddr *)&sa, &len);
+	for (i = 0; i < 4; i++) {
+		fillers[i] = socket(AF_INET, SOCK_STREAM, 0);
+		yar_set_non_blocking(fillers[i]);
+		connect(fillers[i], (struct sockaddr *)&sa, sizeof(sa));
+	}
+	usleep(100 * 1000);
+
+	snprintf(uri, sizeof(uri), "tcp://127.0.0.1:%d", ntohs(sa.sin_port));
+	client = yar_client_new(uri);
+	YAR_ASSERT(client != NULL && client->fd <= 0, "a new client is connected already");
+	yar_client_set_opt(client, YAR_CONNECT_TIMEOUT_MS, &timeout);
+
+	gettimeofday(&start, NULL);
+	YAR_ASSERT(yar_client_connect(client) == 0, "connected to a listener with a full queue");
+	gettimeofday(&end, NULL);
+	elapsed = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000;
+	YAR_ASSERT(elapsed >= 150 && elapsed < 1000, "the connect gave up after %ldms, not 200ms", elapsed);
+
+	yar_client_destroy(client);
+	for (i = 0; i < 4; i++) {
+		close(fillers[i]);
+	}
+	close(listener);
+}
+
+static void test_resolve(void) {
+	yar_resolve_info before, after;
+	yar_address addrs[YAR_RESOLVE_MAX_ADDRS];
+	char host[64];
+	int port = 0, i, count;
+
+	YAR_ASSERT(yar_resolve_split("[::1]:8888", host, sizeof(host), &port) == 1 && strcmp(host, "::1") == 0 && port == 8888,
+			"bracketed IPv6 split as '%s' %d", host, port);
+	YAR_ASSERT(yar_resolve_split("localhost:80", host, sizeof(host), &port) == 1 && strcmp(host, "localhost") == 0 && port == 80,
+			"host split as '%s' %d", host, port);
+	YAR_ASSERT(yar_resolve_split("localhost", host, sizeof(host), &port) == 0, "a host without a port split");
+
+	/* the second lookup is served by the cache, each with its own port */
+	yar_resolve_flush();
+	yar_resolve_get_info(&before);
+	YAR_ASSERT(yar_resolve("localhost", 80, 0, addrs, YAR_RESOLVE_MAX_ADDRS) > 0, "localhost did not resolve");
+	count = yar_resolve("localhost", 81, 0, addrs, YAR_RESOLVE_MAX_ADDRS);
+	yar_resolve_get_info(&after);
+	YAR_ASSERT(after.misses == before.misses + 1 && after.hits == before.hits + 1 && after.entries == 1,
+			"%lu misses, %lu hits, %u entries", after.misses - before.misses, after.hits - before.hits, after.entries);
+	for (i = 0; i < count; i++) {
+		int got = addrs[i].sa.ss_family == AF_INET6? ntohs(((struct sockaddr_in6 *)&addrs[i].sa)->sin6_port)
+			: ntohs(((struct sockaddr_in *)&addrs[i].sa)->sin_port);
+		YAR_ASSERT(got == 81, "address #%d has port %d", i, got);
+	}
+
+	/* no ttl, no cache */
+	yar_resolve_set_ttl(0);
+	YAR_ASSERT(yar_resolve("localhost", 80, 0, addrs, 1) == 1, "localhost did not resolve without the cache");
+	yar_resolve_get_info(&before);
+	YAR_ASSERT(before.hits == after.hits && before.misses == after.misses, "the cache was used without a ttl");
+	yar_resolve_set_ttl(YAR_RESOLVE_TTL);
+
+	YAR_ASSERT(yar_resolve("no-such-host.invalid", 80, 0, addrs, 1) == 0, "an invalid host resolved");
+}
+
+static void test_connect_ipv6(void) {
+	struct sockaddr_in6 sa;
+	socklen_t len = sizeof(sa);
+	int listener = socket(AF_INET6, SOCK_STREAM, 0), peer;
+	struct sockaddr_storage from;
+	yar_client *client;
+	char uri[64];
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin6_family = AF_INET6;
+	sa.sin6_addr = in6addr_loopback;
+	if (listener == -1 || bind(listener, (struct sockaddr *)&sa, sizeof(sa)) != 0 || listen(listener, 4) != 0) {
+		if (listener != -1) {
+			close(listener);
+		}
+		printf("(skipped, no IPv6 loopback) ");
+		return;
+	}
+	getsockname(listener, (struct sockaddr *)&sa, &len);
+
+	snprintf(uri, sizeof(uri), "tcp://[::1]:%d", ntohs(sa.sin6_port));
+	client = yar_client_new(uri);
+	YAR_ASSERT(client != NULL && yar_client_connect(client) == 1, "connect to %s failed", uri);
+
+	len = sizeof(from);
+	peer = accept(listener, (struct sockaddr *)&from, &len);
+	YAR_ASSERT(peer >= 0 && from.ss_family == AF_INET6, "no IPv6 peer accepted");
+	close(peer);
+	yar_client_destroy(client);
+	close(listener);
+}
+
+static void test_reconnect(void) {
+	yar_client *client = new_client();
+	yar_response *response;
+	int persistent = 1, backoff = 200, never = -1;
+
+	YAR_ASSERT(client != NULL, "connect failed");
+	yar_client_set_opt(client, YAR_PERSISTENT_LINK, &persistent);
+	response = client->call(client, "echo", 0, NULL);
+	YAR_ASSERT(response != NULL, "first call failed");
+	free_response(response);
+
+	/* closed under it while idle, as the server does after its read timeout */
+	shutdown(client->fd, SHUT_RDWR);
+	response = client->call(client, "echo", 0, NULL);
+	YAR_ASSERT(response != NULL, "the call after the close failed");
+	free_response(response);
+	YAR_ASSERT(client->connects == 2, "%u connects, expected 2", client->connects);
+
+	/* and after an error hung it up */
+	close(client->fd);
+	client->fd = 0;
+	response = client->call(client, "echo", 0, NULL);
+	YAR_ASSERT(response != NULL && client->connects == 3, "the call after a hangup failed");
+	free_response(response);
+
+	yar_client_set_opt(client, YAR_RECONNECT_BACKOFF_MS, &never);
+	close(client->fd);
+	client->fd = 0;
+	YAR_ASSERT(client->call(client, "echo", 0, NULL) == NULL && client->connects == 3, "reconnected while told not to");
+	yar_client_destroy(client);
+
+	/* a dead host is not tried again before the backoff is over */
+	client = yar_client_new("tcp://127.0.0.1:1");
+	yar_client_set_opt(client, YAR_PERSISTENT_LINK, &persistent);
+	yar_client_set_opt(client, YAR_RECONNECT_BACKOFF_MS, &backoff);
+	YAR_ASSERT(client->call(client, "echo", 0, NULL) == NULL && client->connects == 1, "connected to a closed port");
+	YAR_ASSERT(client->call(client, "echo", 0, NULL) == NULL && client->connects == 1, "reconnected during the backoff");
+	usleep(250 * 1000);
+	YAR_ASSERT(client->call(client, "echo", 0, NULL) == NULL && client->connects == 2, "not reconnected after the backoff");
+	usleep(250 * 1000);
+	YAR_ASSERT(client->call(client, "echo", 0, NULL) == NULL && client->connects == 2, "the backoff did not double");
+	yar_client_destroy(client);
+}
+
+/* a connection numbered past FD_SETSIZE still waits and calls fine */
+static void test_high_fd(void) {
+	struct rlimit limit;
+	yar_client *client;
+	yar_response *response;
+	int high = FD_SETSIZE + 100;
+
+	getrlimit(RLIMIT_NOFILE, &limit);
+	if (limit.rlim_cur <= (rlim_t)high) {
+		limit.rlim_cur = limit.rlim_max;
+		if (limit.rlim_cur <= (rlim_t)high || setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+			printf("(skipped, no fd %d) ", high);
+			return;
+		}
+	}
+
+	client = new_client();
+	YAR_ASSERT(client != NULL, "connect failed");
+	YAR_ASSERT(dup2(client->fd, high) == high, "dup2 failed '%s'", strerror(errno));
+	close(client->fd);
+	client->fd = high;
+
+	response = client->call(client, "echo", 0, NULL);
+	YAR_ASSERT(response != NULL && yar_response_get_status(response) == 0, "call over fd %d failed", high);
+	free_response(response);
+	yar_client_destroy(client);
+}
+
+/* yar_client_new() does not connect, the first call does */
+static void test_lazy_connect(void) {
+	struct event_base *base = event_base_new();
+	yar_client *client = yar_client_new(test_uri);
+	async_result result = {0};
+	yar_response *response;
+	int persistent = 1;
+
+	YAR_ASSERT(client != NULL && client->fd <= 0, "a new client is connected already");
+	yar_client_set_opt(client, YAR_PERSISTENT_LINK, &persistent);
+	response = client->call(client, "echo", 0, NULL);
+	YAR_ASSERT(response != NULL && client->fd > 0, "the first call did not connect");
+	free_response(response);
+
+	if (test_is_tcp) {
+		int nodelay = 0;
+		socklen_t len = sizeof(nodelay);
+		getsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, &len);
+		YAR_ASSERT(nodelay, "TCP_NODELAY is not set");
+	}
+	yar_client_destroy(client);
+
+	/* in the background for an asynchronous call */
+	client = yar_client_new(test_uri);
+	YAR_ASSERT(yar_client_call_async(client, base, "echo", 0, NULL, async_on_complete, &result) != NULL,
+			"the async call did not start");
+	event_base_dispatch(base);
+	YAR_ASSERT(result.done == 1 && result.status == 0, "the async call failed (done %d, status %d)", result.done, result.status);
+	yar_client_destroy(client);
+
+	client = yar_client_new("http://127.0.0.1/");
+	YAR_ASSERT(client == NULL, "an http:// target was accepted");
+	event_base_free(base);
+}
 /* }}} */
 
 /* echo {{{ */
@@ -677,6 +908,61 @@ static void test_persistent(void) {
 	yar_client_destroy(client);
 }
 
+static void test_ping(void) {
+	yar_client *client;
+	yar_response *response;
+	int persistent = 1;
+	int i;
+
+	client = new_client();
+	YAR_ASSERT(client != NULL, "connect failed");
+	YAR_ASSERT(yar_client_ping(client) == 1, "no answer to a ping");
+	yar_client_destroy(client);
+
+	/* pings share a persistent link with regular calls */
+	client = new_client();
+	YAR_ASSERT(client != NULL, "connect failed");
+	yar_client_set_opt(client, YAR_PERSISTENT_LINK, &persistent);
+	for (i = 0; i < 3; i++) {
+		YAR_ASSERT(yar_client_ping(client) == 1, "ping #%d got no answer on a persistent link", i);
+		response = client->call(client, "echo", 0, NULL);
+		YAR_ASSERT(response != NULL && yar_response_get_status(response) == 0, "call #%d after a ping failed", i);
+		free_response(response);
+	}
+	yar_client_destroy(client);
+}
+
+static void test_list(void) {
+	static const char *methods[] = {"echo", "add", "types", "sleep", "error", "big"};
+	yar_client *client = new_client();
+	yar_response *response;
+	const yar_data *list;
+	unsigned int size = 0, i;
+
+	YAR_ASSERT(client != NULL, "connect failed");
+	response = yar_client_list(client);
+	YAR_ASSERT(response != NULL, "no answer to a list");
+	YAR_ASSERT(yar_response_get_status(response) == 0, "unexpected status %d", yar_response_get_status(response));
+
+	list = yar_response_get_response(response);
+	YAR_ASSERT(yar_unpack_data_type(list, &size) == YAR_DATA_ARRAY, "method list is not an array");
+	YAR_ASSERT(size == sizeof(methods) / sizeof(methods[0]), "expected %u methods, got %u",
+			(unsigned int)(sizeof(methods) / sizeof(methods[0])), size);
+	for (i = 0; i < size; i++) {
+		const char *name = NULL;
+		unsigned int len = 0;
+		const yar_data *item = array_at(list, i);
+
+		YAR_ASSERT(yar_unpack_data_type(item, &len) == YAR_DATA_STRING, "method #%u is not a string", i);
+		yar_unpack_data_string(item, &name);
+		YAR_ASSERT(len == strlen(methods[i]) && memcmp(name, methods[i], len) == 0,
+				"method #%u is '%.*s', expected '%s'", i, len, name, methods[i]);
+	}
+
+	free_response(response);
+	yar_client_destroy(client);
+}
+
 static void test_non_persistent_single_call(void) {
 	yar_client *client = new_client(); /* persistent = 0 by default */
 	yar_response *response;
@@ -830,7 +1116,1402 @@ static void test_malformed_huge_body_len(void) {
 }
 /* }}} */
 
+/* asynchronous calls {{{ */
+static void test_async(void) {
+	struct event_base *base = event_base_new();
+	yar_client *clients[8];
+	async_result results[8];
+	int i, num_clients = 8;
+
+	memset(results, 0, sizeof(results));
+	for (i = 0; i < num_clients; i++) {
+		yar_packager *args[2];
+
+		clients[i] = new_client();
+		YAR_ASSERT(clients[i] != NULL, "connect #%d failed", i);
+
+		args[0] = yar_pack_start_long();
+		yar_pack_push_long(args[0], i);
+		args[1] = yar_pack_start_long();
+		yar_pack_push_long(args[1], 100);
+		results[i].expect = i + 100;
+		YAR_ASSERT(yar_client_call_async(clients[i], base, "add", 2, args, async_on_complete, &results[i]) != NULL,
+				"async call #%d did not start", i);
+		yar_pack_free(args[0]);
+		yar_pack_free(args[1]);
+		YAR_ASSERT(results[i].done == 0, "callback #%d ran before the loop", i);
+	}
+
+	/* one call at a time per client */
+	YAR_ASSERT(clients[0]->call(clients[0], "echo", 0, NULL) == NULL, "sync call while an async one is in progress");
+
+	event_base_dispatch(base);
+
+	for (i = 0; i < num_clients; i++) {
+		YAR_ASSERT(results[i].done == 1, "callback #%d ran %d times", i, results[i].done);
+		YAR_ASSERT(results[i].status == 0, "call #%d failed with status %d", i, results[i].status);
+		YAR_ASSERT(results[i].result == results[i].expect, "call #%d returned %ld, expected %ld",
+				i, results[i].result, results[i].expect);
+		yar_client_destroy(clients[i]);
+	}
+	event_base_free(base);
+}
+
+static yar_call *pipelined_victim;
+
+static void pipelined_on_complete(yar_response *response, void *data) {
+	if (pipelined_victim) {
+		/* sent already, its answer has to be skipped */
+		yar_call_cancel(pipelined_victim);
+		pipelined_victim = NULL;
+	}
+	async_on_complete(response, data);
+}
+
+static void test_async_pipelining(void) {
+	struct event_base *base = event_base_new();
+	yar_client *client = new_client();
+	async_result results[50];
+	int i, persistent = 1, num_calls = 50;
+	unsigned int first_id;
+
+	YAR_ASSERT(client != NULL, "connect failed");
+	yar_client_set_opt(client, YAR_PERSISTENT_LINK, &persistent);
+
+	memset(results, 0, sizeof(results));
+	first_id = client->sequence;
+	for (i = 0; i < num_calls; i++) {
+		yar_packager *args[2];
+		yar_call *call;
+
+		args[0] = yar_pack_start_long();
+		yar_pack_push_long(args[0], i);
+		args[1] = yar_pack_start_long();
+		yar_pack_push_long(args[1], 1);
+		results[i].expect = i + 1;
+		call = yar_client_call_async(client, base, "add", 2, args, pipelined_on_complete, &results[i]);
+		YAR_ASSERT(call != NULL, "pipelined call #%d did not start", i);
+		yar_pack_free(args[0]);
+		yar_pack_free(args[1]);
+		if (i == 10) {
+			pipelined_victim = call;
+		}
+	}
+	YAR_ASSERT(client->sequence == first_id + num_calls, "request ids are not unique");
+
+	event_base_dispatch(base);
+
+	for (i = 0; i < num_calls; i++) {
+		if (i == 10) {
+			YAR_ASSERT(results[i].done == 0, "callback of the cancelled call ran");
+			continue;
+		}
+		YAR_ASSERT(results[i].done == 1, "callback #%d ran %d times", i, results[i].done);
+		YAR_ASSERT(results[i].status == 0 && results[i].result == results[i].expect,
+				"call #%d returned %ld (status %d), expected %ld",
+				i, results[i].result, results[i].status, results[i].expect);
+	}
+	YAR_ASSERT(client->pending == NULL, "calls left in progress");
+
+	/* the connection is still in step */
+	{
+		yar_response *response = client->call(client, "echo", 0, NULL);
+		YAR_ASSERT(response != NULL && yar_response_get_status(response) == 0, "call after the pipelined ones failed");
+		free_response(response);
+	}
+
+	yar_client_destroy(client);
+	event_base_free(base);
+}
+
+static yar_call * async_add(yar_client *client, struct event_base *base, long a, async_result *result) {
+	yar_packager *args[2];
+	yar_call *call;
+
+	args[0] = yar_pack_start_long();
+	yar_pack_push_long(args[0], a);
+	args[1] = yar_pack_start_long();
+	yar_pack_push_long(args[1], 1);
+	result->expect = a + 1;
+	call = yar_client_call_async(client, base, "add", 2, args, async_on_complete, result);
+	yar_pack_free(args[0]);
+	yar_pack_free(args[1]);
+	return call;
+}
+
+static void test_async_batch(void) {
+	struct event_base *base = event_base_new();
+	yar_client *client = new_client();
+	async_result results[6], missing = {0};
+	int i, persistent = 1, max = 8, window = 100, listener, peer;
+	struct sockaddr_in sa;
+	socklen_t len = sizeof(sa);
+	struct timeval start;
+	yar_call *victim = NULL;
+	yar_response *response;
+	char uri[64], buf[4096], *entry;
+	uint offset = 0, entry_len, entries = 0;
+	ssize_t got;
+	long elapsed;
+
+	YAR_ASSERT(client != NULL, "connect failed");
+	yar_client_set_opt(client, YAR_PERSISTENT_LINK, &persistent);
+	YAR_ASSERT(yar_client_set_opt(client, YAR_BATCH_MAX, &max) == 1, "batch size not accepted");
+
+	/* every entry is answered on its own, an undefined method only fails its own */
+	memset(results, 0, sizeof(results));
+	for (i = 0; i < 6; i++) {
+		yar_call *call = async_add(client, base, i, &results[i]);
+		YAR_ASSERT(call != NULL, "batched call #%d did not start", i);
+		if (i == 2) {
+			victim = call;
+		}
+	}
+	yar_call_cancel(victim);
+	YAR_ASSERT(yar_client_call_async(client, base, "no_such_method", 0, NULL, async_on_complete, &missing) != NULL, "call did not start");
+	event_base_dispatch(base);
+	for (i = 0; i < 6; i++) {
+		if (i == 2) {
+			YAR_ASSERT(results[i].done == 0, "callback of the cancelled call ran");
+			continue;
+		}
+		YAR_ASSERT(results[i].done == 1 && results[i].status == 0 && results[i].result == results[i].expect,
+				"batched call #%d returned %ld (status %d, done %d)", i, results[i].result, results[i].status, results[i].done);
+	}
+	YAR_ASSERT(missing.done == 1 && missing.status != 0, "the undefined method did not fail alone (status %d)", missing.status);
+	response = client->call(client, "echo", 0, NULL);
+	YAR_ASSERT(response != NULL && yar_response_get_status(response) == 0, "call after the batch failed");
+	free_response(response);
+
+	/* a call waits for the window to close, unless the batch fills up first */
+	max = 3;
+	yar_client_set_opt(client, YAR_BATCH_MAX, &max);
+	yar_client_set_opt(client, YAR_BATCH_WINDOW_MS, &window);
+	memset(results, 0, sizeof(results));
+	gettimeofday(&start, NULL);
+	async_add(client, base, 1, &results[0]);
+	async_add(client, base, 2, &results[1]);
+	event_base_dispatch(base);
+	elapsed = elapsed_ms(&start);
+	YAR_ASSERT(results[0].done == 1 && results[1].done == 1, "the windowed calls did not complete");
+	YAR_ASSERT(elapsed >= 80, "the calls did not wait for the window (%ldms)", elapsed);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < 3; i++) {
+		async_add(client, base, i, &results[i + 2]);
+	}
+	event_base_dispatch(base);
+	elapsed = elapsed_ms(&start);
+	YAR_ASSERT(results[2].done == 1 && results[4].result == 3, "the full batch did not complete");
+	YAR_ASSERT(elapsed < 80, "a full batch waited for the window (%ldms)", elapsed);
+	yar_client_destroy(client);
+
+	/* on the wire it is one request with the batch flag, and an entry per call */
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	YAR_ASSERT(bind(listener, (struct sockaddr *)&sa, sizeof(sa)) == 0 && listen(listener, 4) == 0, "listen failed");
+	getsockname(listener, (struct sockaddr *)&sa, &len);
+	snprintf(uri, sizeof(uri), "tcp://127.0.0.1:%d", ntohs(sa.sin_port));
+	client = yar_client_new(uri);
+	max = 4;
+	yar_client_set_opt(client, YAR_BATCH_MAX, &max);
+	memset(results, 0, sizeof(results));
+	for (i = 0; i < 3; i++) {
+		async_add(client, base, i, &results[i]);
+	}
+	event_base_loop(base, EVLOOP_ONCE);
+	peer = accept(listener, NULL, NULL);
+	YAR_ASSERT(peer >= 0, "accept failed");
+	usleep(50 * 1000);
+	got = recv(peer, buf, sizeof(buf), MSG_DONTWAIT);
+	YAR_ASSERT(got > (ssize_t)(sizeof(yar_header) + sizeof(YAR_PACKAGER)), "no request came (%d bytes)", (int)got);
+	YAR_ASSERT(yar_protocol_parse((yar_header *)buf) && (((yar_header *)buf)->reserved & YAR_PROTOCOL_BATCH), "not a batch request");
+	YAR_ASSERT(((yar_header *)buf)->body_len == got - sizeof(yar_header), "the batch came in %u bytes, its header says %u",
+			(uint)(got - sizeof(yar_header)), ((yar_header *)buf)->body_len);
+	while (yar_protocol_batch_next(buf + sizeof(yar_header) + sizeof(YAR_PACKAGER), got - sizeof(yar_header) - sizeof(YAR_PACKAGER),
+				&offset, &entry, &entry_len) == 1) {
+		entries++;
+	}
+	YAR_ASSERT(entries == 3, "%u entries in the batch", entries);
+
+	/* the connection breaks, every call of the batch fails */
+	close(peer);
+	event_base_dispatch(base);
+	for (i = 0; i < 3; i++) {
+		YAR_ASSERT(results[i].done == 1 && results[i].status == -1, "call #%d of the broken batch: done %d", i, results[i].done);
+	}
+	yar_client_destroy(client);
+	close(listener);
+	event_base_free(base);
+}
+
+static void test_async_cancel(void) {
+	struct event_base *base = event_base_new();
+	yar_client *client = new_client();
+	async_result result = {0};
+	yar_call *call;
+	yar_response *response;
+
+	YAR_ASSERT(client != NULL, "connect failed");
+	call = yar_client_call_async(client, base, "echo", 0, NULL, async_on_complete, &result);
+	YAR_ASSERT(call != NULL, "async call did not start");
+	yar_call_cancel(call);
+
+	event_base_dispatch(base);
+	YAR_ASSERT(result.done == 0, "callback of a cancelled call ran");
+
+	/* nothing was sent, the connection is still good */
+	response = client->call(client, "echo", 0, NULL);
+	YAR_ASSERT(response != NULL && yar_response_get_status(response) == 0, "call after a cancelled one failed");
+	free_response(response);
+
+	yar_client_destroy(client);
+	event_base_free(base);
+}
+
+static void test_async_timeout(void) {
+	struct event_base *base = event_base_new();
+	yar_client *client = new_client_timeout(1);
+	async_result result = {0};
+	yar_packager *arg = yar_pack_start_long();
+
+	yar_pack_push_long(arg, 2);
+
+	YAR_ASSERT(client != NULL, "connect failed");
+	/* the server handler sleeps 2 seconds, the client gives up after 1 */
+	YAR_ASSERT(yar_client_call_async(client, base, "sleep", 1, &arg, async_on_complete, &result) != NULL,
+			"async call did not start");
+	yar_pack_free(arg);
+
+	event_base_dispatch(base);
+	YAR_ASSERT(result.done == 1, "callback ran %d times", result.done);
+	YAR_ASSERT(result.status == -1, "expected a timeout, got status %d", result.status);
+
+	yar_client_destroy(client);
+	event_base_free(base);
+}
+
+/* the server handler sleeps 1 second every time, well past the limits */
+static void test_timeout_ms(void) {
+	struct event_base *base = event_base_new();
+	yar_client *client = new_client();
+	yar_packager *arg = yar_pack_start_long();
+	async_result result = {0}, late = {0};
+	yar_response *response;
+	struct timeval start;
+	int limit = 150, persistent = 1;
+	long elapsed;
+
+	yar_pack_push_long(arg, 1);
+
+	/* a sub-second read timeout */
+	YAR_ASSERT(client != NULL, "connect failed");
+	yar_client_set_opt(client, YAR_READ_TIMEOUT_MS, &limit);
+	gettimeofday(&start, NULL);
+	response = client->call(client, "sleep", 1, &arg);
+	elapsed = elapsed_ms(&start);
+	YAR_ASSERT(response == NULL, "expected a timeout, got a response");
+	YAR_ASSERT(elapsed >= 100 && elapsed < 700, "the read timed out after %ldms, not 150ms", elapsed);
+	yar_client_destroy(client);
+
+	/* a deadline, with read waits that would each have been long enough */
+	client = new_client();
+	yar_client_set_opt(client, YAR_CALL_DEADLINE_MS, &limit);
+	gettimeofday(&start, NULL);
+	response = client->call(client, "sleep", 1, &arg);
+	elapsed = elapsed_ms(&start);
+	YAR_ASSERT(response == NULL, "expected the deadline to pass, got a response");
+	YAR_ASSERT(elapsed >= 100 && elapsed < 700, "the deadline passed after %ldms, not 150ms", elapsed);
+	yar_client_destroy(client);
+
+	/* an asynchronous call past its deadline fails alone, the connection stays */
+	client = new_client();
+	yar_client_set_opt(client, YAR_PERSISTENT_LINK, &persistent);
+	yar_client_set_opt(client, YAR_CALL_DEADLINE_MS, &limit);
+	YAR_ASSERT(yar_client_call_async(client, base, "sleep", 1, &arg, async_on_complete, &late) != NULL,
+			"async call did not start");
+	limit = 0;
+	yar_client_set_opt(client, YAR_CALL_DEADLINE_MS, &limit);
+	YAR_ASSERT(yar_client_call_async(client, base, "echo", 0, NULL, async_on_complete, &result) != NULL,
+			"second async call did not start");
+	{
+		/* the server is still asleep for the calls above */
+		struct timeval tv = {0, 400 * 1000};
+		event_base_loopexit(base, &tv);
+		event_base_dispatch(base);
+	}
+	YAR_ASSERT(late.done == 1 && late.status == -1, "the late call did not fail (done %d, status %d)", late.done, late.status);
+	YAR_ASSERT(result.done == 0 && client->fd > 0, "the deadline took the connection along");
+	event_base_dispatch(base);
+	YAR_ASSERT(result.done == 1 && result.status == 0, "the call after it failed (done %d, status %d)", result.done, result.status);
+	YAR_ASSERT(late.done == 1, "the late answer was not dropped");
+
+	yar_pack_free(arg);
+	yar_client_destroy(client);
+	event_base_free(base);
+}
+
+static void test_concurrent_client(void) {
+	yar_concurrent_client *cc = yar_concurrent_client_init();
+	async_result results[20];
+	int i, round, packager = test_packager, num_calls = 20;
+
+	YAR_ASSERT(cc != NULL, "init failed");
+	yar_concurrent_client_set_opt(cc, YAR_CONCURRENT_PACKAGER, &packager);
+
+	/* the second round goes over the connections left by the first */
+	for (round = 0; round < 2; round++) {
+		memset(results, 0, sizeof(results));
+		for (i = 0; i < num_calls; i++) {
+			yar_packager *args[2];
+
+			args[0] = yar_pack_start_long();
+			yar_pack_push_long(args[0], i);
+			args[1] = yar_pack_start_long();
+			yar_pack_push_long(args[1], round * 1000);
+			results[i].expect = i + round * 1000;
+			YAR_ASSERT(yar_concurrent_client_call(cc, test_uri, "add", 2, args, async_on_complete, &results[i]) == 1,
+					"queueing call #%d failed", i);
+			yar_pack_free(args[0]);
+			yar_pack_free(args[1]);
+		}
+
+		YAR_ASSERT(yar_concurrent_client_loop(cc) == 1, "round %d timed out", round);
+		for (i = 0; i < num_calls; i++) {
+			YAR_ASSERT(results[i].done == 1, "round %d callback #%d ran %d times", round, i, results[i].done);
+			YAR_ASSERT(results[i].status == 0 && results[i].result == results[i].expect,
+					"round %d call #%d returned %ld (status %d), expected %ld",
+					round, i, results[i].result, results[i].status, results[i].expect);
+		}
+	}
+
+	/* a dead server fails its own call, at once or from the loop, not the others */
+	memset(results, 0, sizeof(results));
+	results[1].status = -1;
+	if (yar_concurrent_client_call(cc, "tcp://127.0.0.1:1", "echo", 0, NULL, async_on_complete, &results[1])) {
+		results[1].status = 0;
+	}
+	YAR_ASSERT(yar_concurrent_client_call(cc, test_uri, "echo", 0, NULL, async_on_complete, &results[0]) == 1, "queueing failed");
+	yar_concurrent_client_loop(cc);
+	YAR_ASSERT(results[0].done == 1 && results[0].status == 0, "the call to the live server failed");
+	YAR_ASSERT(results[1].status == -1, "the call to the dead server did not fail");
+
+	/* nothing queued */
+	YAR_ASSERT(yar_concurrent_client_loop(cc) == 1, "an empty loop timed out");
+	yar_concurrent_client_destroy(cc);
+}
+
+typedef struct {
+	yar_shared_client *sc;
+	long base;
+	int wrong;
+} shared_worker;
+
+static void * shared_client_worker(void *arg) {
+	shared_worker *worker = (shared_worker *)arg;
+	long i, sum;
+
+	for (i = 0; i < 50; i++) {
+		yar_packager *args[2];
+		yar_response *response;
+
+		args[0] = yar_pack_start_long();
+		yar_pack_push_long(args[0], worker->base);
+		args[1] = yar_pack_start_long();
+		yar_pack_push_long(args[1], i);
+		response = yar_shared_client_call(worker->sc, "add", 2, args);
+		yar_pack_free(args[0]);
+		yar_pack_free(args[1]);
+
+		sum = -1;
+		if (response) {
+			data_as_long(yar_response_get_response(response), &sum);
+			free_response(response);
+		}
+		if (sum != worker->base + i) {
+			worker->wrong++;
+		}
+	}
+	return NULL;
+}
+
+static void test_shared_client(void) {
+	yar_shared_client *sc = yar_shared_client_init(test_uri, 2);
+	yar_cache *cache = yar_cache_new(16);
+	shared_worker workers[8];
+	pthread_t threads[8];
+	int i, packager = test_packager, persistent = 0;
+
+	YAR_ASSERT(sc != NULL, "init failed");
+	YAR_ASSERT(yar_shared_client_init(test_uri, 0) == NULL, "a client of no links was made");
+	YAR_ASSERT(yar_shared_client_set_opt(sc, YAR_PERSISTENT_LINK, &persistent) == 0, "the links were made single call");
+	YAR_ASSERT(yar_shared_client_set_opt(sc, YAR_OPT_CACHE, cache) == 0, "a cache was set on the links");
+	yar_cache_destroy(cache);
+	YAR_ASSERT(yar_shared_client_set_opt(sc, YAR_OPT_PACKAGER, &packager) == 1, "packager not accepted");
+
+	for (i = 0; i < 8; i++) {
+		workers[i].sc = sc;
+		workers[i].base = i * 1000;
+		workers[i].wrong = 0;
+		YAR_ASSERT(pthread_create(&threads[i], NULL, shared_client_worker, &workers[i]) == 0, "thread #%d not started", i);
+	}
+	for (i = 0; i < 8; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	for (i = 0; i < 8; i++) {
+		YAR_ASSERT(workers[i].wrong == 0, "thread #%d got %d wrong answers", i, workers[i].wrong);
+	}
+
+	yar_shared_client_destroy(sc);
+}
+
+static void test_concurrent_client_timeout(void) {
+	yar_concurrent_client *cc = yar_concurrent_client_init();
+	async_result result = {0};
+	yar_packager *arg = yar_pack_start_long();
+	int timeout = 500, call_timeout = 8;
+	struct timeval start, end;
+	long elapsed;
+
+	yar_pack_push_long(arg, 2);
+
+	YAR_ASSERT(cc != NULL, "init failed");
+	yar_concurrent_client_set_opt(cc, YAR_CONCURRENT_TIMEOUT, &timeout);
+	yar_concurrent_client_set_opt(cc, YAR_CONCURRENT_CALL_TIMEOUT, &call_timeout);
+	YAR_ASSERT(yar_concurrent_client_call(cc, test_uri, "sleep", 1, &arg, async_on_complete, &result) == 1,
+			"queueing the call failed");
+	yar_pack_free(arg);
+
+	gettimeofday(&start, NULL);
+	YAR_ASSERT(yar_concurrent_client_loop(cc) == 0, "the loop did not time out");
+	gettimeofday(&end, NULL);
+	elapsed = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000;
+
+	YAR_ASSERT(result.done == 1 && result.status == -1, "the call was not failed (done %d, status %d)", result.done, result.status);
+	YAR_ASSERT(elapsed < 1500, "the loop took %ldms to time out after 500ms", elapsed);
+
+	yar_concurrent_client_destroy(cc);
+}
+/* }}} */
+
+/* pool {{{ */
+static void test_pool(void) {
+	char *hosts[] = {test_uri, "tcp://127.0.0.1:1", test_uri};
+	yar_pool_endpoint_info info[3];
+	yar_pool *pool = yar_pool_init(hosts, 3);
+	int i, backoff = 200, packager = test_packager;
+
+	YAR_ASSERT(pool != NULL, "init failed");
+	yar_pool_set_opt(pool, YAR_POOL_BACKOFF, &backoff);
+	yar_pool_set_opt(pool, YAR_POOL_PACKAGER, &packager);
+
+	/* the dead endpoint is evicted the first time round, its call goes on to the next */
+	for (i = 0; i < 20; i++) {
+		yar_packager *args[2];
+		yar_response *response;
+		long sum = 0;
+
+		args[0] = yar_pack_start_long();
+		yar_pack_push_long(args[0], i);
+		args[1] = yar_pack_start_long();
+		yar_pack_push_long(args[1], 1);
+		response = yar_pool_call(pool, "add", 2, args);
+		yar_pack_free(args[0]);
+		yar_pack_free(args[1]);
+		YAR_ASSERT(response != NULL && yar_response_get_status(response) == 0, "call #%d failed", i);
+		data_as_long(yar_response_get_response(response), &sum);
+		free_response(response);
+		YAR_ASSERT(sum == i + 1, "call #%d returned %ld", i, sum);
+	}
+
+	for (i = 0; i < 3; i++) {
+		YAR_ASSERT(yar_pool_get_endpoint(pool, i, &info[i]) == 1, "no endpoint #%d", i);
+	}
+	YAR_ASSERT(yar_pool_get_endpoint(pool, 3, &info[0]) == 0, "an endpoint past the end");
+	YAR_ASSERT(info[1].down && info[1].failures == 1 && info[1].requests == 0,
+			"dead endpoint: down %d, %lu failures, %lu requests", info[1].down, info[1].failures, info[1].requests);
+	YAR_ASSERT(info[0].requests == 10 && info[2].requests == 10,
+			"round robin sent %lu and %lu calls", info[0].requests, info[2].requests);
+	YAR_ASSERT(info[0].idle == 1 && info[2].idle == 1 && info[0].outstanding == 0,
+			"%d and %d idle connections kept", info[0].idle, info[2].idle);
+
+	/* once the backoff is over the endpoint is tried again, and evicted for longer */
+	usleep(300 * 1000);
+	for (i = 0; i < 3; i++) {
+		yar_response *response = yar_pool_call(pool, "echo", 0, NULL);
+		YAR_ASSERT(response != NULL, "call #%d after the backoff failed", i);
+		free_response(response);
+	}
+	yar_pool_get_endpoint(pool, 1, &info[1]);
+	YAR_ASSERT(info[1].down && info[1].failures == 2, "dead endpoint retried %lu times", info[1].failures);
+
+	yar_pool_destroy(pool);
+}
+
+static void test_pool_warmup(void) {
+	char *hosts[] = {test_uri, "tcp://127.0.0.1:1"};
+	yar_pool_endpoint_info info[2];
+	yar_pool *pool = yar_pool_init(hosts, 2);
+	struct event_base *base = event_base_new(), *other = event_base_new();
+	struct timeval tv = {0, 250 * 1000};
+	yar_response *response;
+	int min_idle = 3, keepalive = 50, backoff = 10000, packager = test_packager;
+
+	YAR_ASSERT(pool != NULL, "init failed");
+	yar_pool_set_opt(pool, YAR_POOL_MIN_IDLE, &min_idle);
+	yar_pool_set_opt(pool, YAR_POOL_KEEPALIVE, &keepalive);
+	yar_pool_set_opt(pool, YAR_POOL_BACKOFF, &backoff);
+	yar_pool_set_opt(pool, YAR_POOL_PACKAGER, &packager);
+
+	YAR_ASSERT(yar_pool_warmup(pool, base) == 1, "warmup failed");
+	YAR_ASSERT(yar_pool_warmup(pool, other) == 0, "warmed up on a second event base");
+	yar_pool_get_endpoint(pool, 0, &info[0]);
+	YAR_ASSERT(info[0].idle + info[0].warming == 3, "%d idle and %d warming connections", info[0].idle, info[0].warming);
+
+	/* the connects finish on the loop, the idle connections are pinged a few times */
+	event_base_loopexit(base, &tv);
+	event_base_dispatch(base);
+	yar_pool_get_endpoint(pool, 0, &info[0]);
+	yar_pool_get_endpoint(pool, 1, &info[1]);
+	YAR_ASSERT(info[0].idle == 3 && info[0].warming == 0 && info[0].failures == 0,
+			"%d idle, %d warming, %lu failures", info[0].idle, info[0].warming, info[0].failures);
+	YAR_ASSERT(info[1].down && info[1].failures == 1 && info[1].idle == 0 && info[1].warming == 0,
+			"dead endpoint: down %d, %lu failures", info[1].down, info[1].failures);
+
+	/* a call takes one of them and gives it back */
+	response = yar_pool_call(pool, "echo", 0, NULL);
+	YAR_ASSERT(response != NULL && yar_response_get_status(response) == 0, "call on a warm connection failed");
+	free_response(response);
+	yar_pool_get_endpoint(pool, 0, &info[0]);
+	YAR_ASSERT(info[0].idle == 3 && info[0].requests == 1, "%d idle after the call", info[0].idle);
+
+	/* the next round tops them up */
+	min_idle = 4;
+	yar_pool_set_opt(pool, YAR_POOL_MIN_IDLE, &min_idle);
+	event_base_loopexit(base, &tv);
+	event_base_dispatch(base);
+	yar_pool_get_endpoint(pool, 0, &info[0]);
+	YAR_ASSERT(info[0].idle == 4, "topped up to %d idle connections", info[0].idle);
+
+	yar_pool_destroy(pool);
+	event_base_free(base);
+	event_base_free(other);
+}
+
+typedef struct {
+	struct timeval start;
+	long elapsed;
+	async_result result;
+} timed_result;
+
+static void timed_on_complete(yar_response *response, void *data) {
+	timed_result *timed = (timed_result *)data;
+
+	timed->elapsed = elapsed_ms(&timed->start);
+	async_on_complete(response, &timed->result);
+}
+
+static void test_pool_keepalive(void) {
+	struct sockaddr_in sa;
+	socklen_t len = sizeof(sa);
+	struct event_base *base = event_base_new();
+	struct timeval tv = {1, 500 * 1000};
+	yar_pool_endpoint_info info;
+	yar_client *client = new_client();
+	yar_packager *arg;
+	timed_result timed;
+	char silent[64], *hosts[1];
+	int listener, min_idle = 1, keepalive = 50, call_timeout = 3, persistent = 1;
+	yar_pool *pool;
+
+	/* connects are taken by the backlog, nothing is ever answered */
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	YAR_ASSERT(bind(listener, (struct sockaddr *)&sa, sizeof(sa)) == 0 && listen(listener, 4) == 0, "listen failed");
+	getsockname(listener, (struct sockaddr *)&sa, &len);
+	snprintf(silent, sizeof(silent), "tcp://127.0.0.1:%d", ntohs(sa.sin_port));
+
+	hosts[0] = silent;
+	pool = yar_pool_init(hosts, 1);
+	yar_pool_set_opt(pool, YAR_POOL_MIN_IDLE, &min_idle);
+	yar_pool_set_opt(pool, YAR_POOL_KEEPALIVE, &keepalive);
+	yar_pool_set_opt(pool, YAR_POOL_CALL_TIMEOUT, &call_timeout);
+	YAR_ASSERT(yar_pool_warmup(pool, base) == 1, "warmup failed");
+
+	/* a call of a second on the same loop: the ping sent meanwhile waits for
+	 * an answer for 3 seconds, but does not hold the call up */
+	YAR_ASSERT(client != NULL, "connect failed");
+	yar_client_set_opt(client, YAR_PERSISTENT_LINK, &persistent);
+	yar_client_set_opt(client, YAR_CONNECT_TIMEOUT, &call_timeout);
+	memset(&timed, 0, sizeof(timed));
+	arg = yar_pack_start_long();
+	yar_pack_push_long(arg, 1);
+	gettimeofday(&timed.start, NULL);
+	YAR_ASSERT(yar_client_call_async(client, base, "sleep", 1, &arg, timed_on_complete, &timed) != NULL, "async call did not start");
+	yar_pack_free(arg);
+	event_base_loopexit(base, &tv);
+	event_base_dispatch(base);
+	YAR_ASSERT(timed.result.done == 1 && timed.result.status == 0, "the call did not complete");
+	YAR_ASSERT(timed.elapsed < 1300, "the call took %ldms next to a silent ping", timed.elapsed);
+	yar_pool_get_endpoint(pool, 0, &info);
+	YAR_ASSERT(info.idle == 0 && info.warming == 1, "%d idle, %d warming: no ping in flight", info.idle, info.warming);
+
+	/* the ping in flight is dropped with the pool */
+	yar_pool_destroy(pool);
+	yar_client_destroy(client);
+	event_base_free(base);
+	close(listener);
+}
+
+static void test_pool_async(void) {
+	char *hosts[] = {test_uri, test_uri};
+	int balances[] = {YAR_BALANCE_LEAST_OUTSTANDING, YAR_BALANCE_TWO_CHOICES};
+	int b, i, packager = test_packager;
+
+	for (b = 0; b < 2; b++) {
+		struct event_base *base = event_base_new();
+		yar_pool *pool = yar_pool_init(hosts, 2);
+		yar_pool_endpoint_info info[2];
+		yar_pool_request *request;
+		async_result results[10], cancelled = {0};
+
+		YAR_ASSERT(pool != NULL, "init failed");
+		YAR_ASSERT(yar_pool_set_opt(pool, YAR_POOL_BALANCE, &balances[b]) == 1, "balance %d rejected", balances[b]);
+		yar_pool_set_opt(pool, YAR_POOL_PACKAGER, &packager);
+
+		memset(results, 0, sizeof(results));
+		for (i = 0; i < 10; i++) {
+			yar_packager *args[2];
+
+			args[0] = yar_pack_start_long();
+			yar_pack_push_long(args[0], i);
+			args[1] = yar_pack_start_long();
+			yar_pack_push_long(args[1], 100);
+			results[i].expect = i + 100;
+			YAR_ASSERT(yar_pool_call_async(pool, base, "add", 2, args, async_on_complete, &results[i]) != NULL,
+					"async call #%d did not start", i);
+			yar_pack_free(args[0]);
+			yar_pack_free(args[1]);
+		}
+
+		/* nothing of it has been sent, its connection is kept */
+		request = yar_pool_call_async(pool, base, "echo", 0, NULL, async_on_complete, &cancelled);
+		YAR_ASSERT(request != NULL, "the call to cancel did not start");
+		yar_pool_request_cancel(request);
+
+		/* both endpoints take as many calls in flight */
+		yar_pool_get_endpoint(pool, 0, &info[0]);
+		yar_pool_get_endpoint(pool, 1, &info[1]);
+		YAR_ASSERT(info[0].outstanding == 5 && info[1].outstanding == 5,
+				"balance %d: %d and %d calls outstanding", balances[b], info[0].outstanding, info[1].outstanding);
+
+		event_base_dispatch(base);
+
+		YAR_ASSERT(cancelled.done == 0, "the cancelled call completed");
+		for (i = 0; i < 10; i++) {
+			YAR_ASSERT(results[i].done == 1 && results[i].status == 0 && results[i].result == results[i].expect,
+					"call #%d returned %ld (status %d), expected %ld", i, results[i].result, results[i].status, results[i].expect);
+		}
+		yar_pool_get_endpoint(pool, 0, &info[0]);
+		yar_pool_get_endpoint(pool, 1, &info[1]);
+		/* with the one of the cancelled call */
+		YAR_ASSERT(info[0].outstanding == 0 && info[0].idle + info[1].idle == 11,
+				"%d and %d idle connections kept", info[0].idle, info[1].idle);
+
+		/* dropped along with the pool */
+		YAR_ASSERT(yar_pool_call_async(pool, base, "echo", 0, NULL, async_on_complete, &cancelled) != NULL,
+				"the call to drop did not start");
+		yar_pool_destroy(pool);
+		event_base_dispatch(base);
+		YAR_ASSERT(cancelled.done == 0, "a call dropped with the pool completed");
+		event_base_free(base);
+	}
+}
+
+static int pool_call_lands(yar_pool *pool, const char *key, yar_packager *arg) {
+	yar_pool_endpoint_info before[4], after[4];
+	yar_response *response;
+	int i, num, landed = -1;
+
+	for (num = 0; yar_pool_get_endpoint(pool, num, &before[num]); num++);
+	if (key) {
+		response = yar_pool_call_key(pool, key, strlen(key), "echo", 0, NULL);
+	} else {
+		response = yar_pool_call(pool, "echo", 1, &arg);
+	}
+	if (!response) {
+		return -1;
+	}
+	free_response(response);
+	for (i = 0; i < num; i++) {
+		yar_pool_get_endpoint(pool, i, &after[i]);
+		if (after[i].requests != before[i].requests) {
+			landed = i;
+		}
+	}
+	return landed;
+}
+
+static void test_pool_hash(void) {
+	char *hosts[] = {test_uri, test_uri, test_uri};
+	yar_pool *pool = yar_pool_init(hosts, 3);
+	int i, owners[60], owned[4] = {0}, moved = 0, balance = YAR_BALANCE_CONSISTENT_HASH, param = 0;
+	char key[32];
+	yar_packager *arg;
+
+	YAR_ASSERT(pool != NULL, "init failed");
+	yar_pool_set_opt(pool, YAR_POOL_BALANCE, &balance);
+	yar_pool_set_opt(pool, YAR_POOL_HASH_PARAMETER, &param);
+
+	for (i = 0; i < 60; i++) {
+		snprintf(key, sizeof(key), "user:%d", i);
+		owners[i] = yar_pool_key_endpoint(pool, key, strlen(key));
+		YAR_ASSERT(owners[i] >= 0 && owners[i] < 3, "key %s owned by %d", key, owners[i]);
+		owned[owners[i]]++;
+	}
+	YAR_ASSERT(owned[0] && owned[1] && owned[2], "keys owned %d/%d/%d", owned[0], owned[1], owned[2]);
+
+	/* a call goes to the owner of its key, given or taken from a parameter */
+	for (i = 0; i < 6; i++) {
+		snprintf(key, sizeof(key), "user:%d", i);
+		YAR_ASSERT(pool_call_lands(pool, key, NULL) == owners[i], "key %s did not go to endpoint %d", key, owners[i]);
+		arg = yar_pack_start_string();
+		yar_pack_push_string(arg, key, strlen(key));
+		YAR_ASSERT(pool_call_lands(pool, NULL, arg) == owners[i], "parameter %s did not go to endpoint %d", key, owners[i]);
+		yar_pack_free(arg);
+	}
+	arg = yar_pack_start_long();
+	yar_pack_push_long(arg, 42);
+	YAR_ASSERT(pool_call_lands(pool, NULL, arg) == yar_pool_key_endpoint(pool, "42", 2), "an integer parameter did not hash as its digits");
+	yar_pack_free(arg);
+
+	/* a new endpoint only takes keys over, the others keep theirs */
+	yar_pool_add_endpoint(pool, test_uri);
+	for (i = 0; i < 60; i++) {
+		int owner;
+		snprintf(key, sizeof(key), "user:%d", i);
+		owner = yar_pool_key_endpoint(pool, key, strlen(key));
+		YAR_ASSERT(owner == owners[i] || owner == 3, "key %s moved from %d to %d", key, owners[i], owner);
+		moved += (owner == 3);
+	}
+	YAR_ASSERT(moved > 0 && moved < 30, "%d of 60 keys moved to the new endpoint", moved);
+
+	/* and they all go back when it leaves */
+	YAR_ASSERT(yar_pool_remove_endpoint(pool, 3) == 1, "remove failed");
+	YAR_ASSERT(yar_pool_remove_endpoint(pool, 3) == 0, "removed an endpoint past the end");
+	for (i = 0; i < 60; i++) {
+		snprintf(key, sizeof(key), "user:%d", i);
+		YAR_ASSERT(yar_pool_key_endpoint(pool, key, strlen(key)) == owners[i], "key %s did not go back", key);
+	}
+
+	/* the keys of an evicted endpoint go to the next one on the ring */
+	yar_pool_add_endpoint(pool, "tcp://127.0.0.1:1");
+	for (i = 0; i < 60; i++) {
+		snprintf(key, sizeof(key), "user:%d", i);
+		if (yar_pool_key_endpoint(pool, key, strlen(key)) == 3) {
+			int landed = pool_call_lands(pool, key, NULL);
+			YAR_ASSERT(landed >= 0 && landed < 3, "key %s owned by the dead endpoint went to %d", key, landed);
+			YAR_ASSERT(yar_pool_key_endpoint(pool, key, strlen(key)) == landed, "key %s not moved while evicted", key);
+			break;
+		}
+	}
+	YAR_ASSERT(i < 60, "no key owned by the dead endpoint");
+
+	yar_pool_destroy(pool);
+}
+
+/* the first endpoint takes connections but never answers, the call is sent
+ * again to the second and answered from there */
+static void test_pool_hedge(void) {
+	struct sockaddr_in sa;
+	socklen_t len = sizeof(sa);
+	int listener, filler, percentile = 95, delay = 50, call_timeout = 5, connect_timeout = 3000;
+	yar_pool_endpoint_info info[2];
+	yar_response *response;
+	yar_packager *arg;
+	struct timeval start;
+	char stall[64], *hosts[2];
+	yar_pool *pool;
+	long elapsed;
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	YAR_ASSERT(bind(listener, (struct sockaddr *)&sa, sizeof(sa)) == 0 && listen(listener, 4) == 0, "listen failed");
+	getsockname(listener, (struct sockaddr *)&sa, &len);
+	snprintf(stall, sizeof(stall), "tcp://127.0.0.1:%d", ntohs(sa.sin_port));
+
+	hosts[0] = stall;
+	hosts[1] = test_uri;
+	pool = yar_pool_init(hosts, 2);
+	YAR_ASSERT(pool != NULL, "init failed");
+	YAR_ASSERT(yar_pool_set_opt(pool, YAR_POOL_HEDGE_PERCENTILE, &percentile) == 1, "percentile not accepted");
+	YAR_ASSERT(yar_pool_set_opt(pool, YAR_POOL_HEDGE_DELAY, &delay) == 1, "delay not accepted");
+	YAR_ASSERT(yar_pool_hedge_method(pool, "echo") == 1, "method not accepted");
+
+	gettimeofday(&start, NULL);
+	response = yar_pool_call(pool, "echo", 0, NULL);
+	elapsed = elapsed_ms(&start);
+	YAR_ASSERT(response != NULL && yar_response_get_status(response) == 0, "the hedged call failed");
+	free_response(response);
+	YAR_ASSERT(elapsed >= 40 && elapsed < 500, "the hedged call took %ldms", elapsed);
+
+	yar_pool_get_endpoint(pool, 0, &info[0]);
+	yar_pool_get_endpoint(pool, 1, &info[1]);
+	YAR_ASSERT(info[0].requests == 1 && info[1].requests == 1,
+			"sent %lu and %lu times", info[0].requests, info[1].requests);
+	YAR_ASSERT(info[0].outstanding == 0 && info[0].failures == 0 && info[1].idle == 1,
+			"the losing send was not cancelled (%d outstanding, %lu failures)", info[0].outstanding, info[0].failures);
+	yar_pool_destroy(pool);
+	close(listener);
+
+	/* a second send to an endpoint that takes long to connect to does not
+	 * hold up the first: a listener with a full backlog never answers */
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	filler = socket(AF_INET, SOCK_STREAM, 0);
+	sa.sin_port = 0;
+	YAR_ASSERT(bind(listener, (struct sockaddr *)&sa, sizeof(sa)) == 0 && listen(listener, 0) == 0, "listen failed");
+	getsockname(listener, (struct sockaddr *)&sa, &len);
+	YAR_ASSERT(connect(filler, (struct sockaddr *)&sa, sizeof(sa)) == 0, "backlog not filled");
+	snprintf(stall, sizeof(stall), "tcp://127.0.0.1:%d", ntohs(sa.sin_port));
+
+	hosts[0] = test_uri;
+	hosts[1] = stall;
+	pool = yar_pool_init(hosts, 2);
+	yar_pool_set_opt(pool, YAR_POOL_HEDGE_PERCENTILE, &percentile);
+	yar_pool_set_opt(pool, YAR_POOL_HEDGE_DELAY, &delay);
+	yar_pool_set_opt(pool, YAR_POOL_CALL_TIMEOUT, &call_timeout);
+	yar_pool_set_opt(pool, YAR_POOL_CONNECT_TIMEOUT, &connect_timeout);
+	yar_pool_hedge_method(pool, "sleep");
+
+	arg = yar_pack_start_long();
+	yar_pack_push_long(arg, 1);
+	gettimeofday(&start, NULL);
+	response = yar_pool_call(pool, "sleep", 1, &arg);
+	elapsed = elapsed_ms(&start);
+	yar_pack_free(arg);
+	YAR_ASSERT(response != NULL && yar_response_get_status(response) == 0, "the hedged call failed");
+	free_response(response);
+	YAR_ASSERT(elapsed < 1500, "the first send waited %ldms for the second to connect", elapsed);
+	yar_pool_get_endpoint(pool, 1, &info[1]);
+	YAR_ASSERT(info[1].requests == 1 && info[1].outstanding == 0 && info[1].failures == 0,
+			"the second send: %lu requests, %d outstanding, %lu failures", info[1].requests, info[1].outstanding, info[1].failures);
+
+	yar_pool_destroy(pool);
+	close(filler);
+	close(listener);
+}
+/* }}} */
+
+/* cache {{{ */
+static long cached_add(yar_client *client, long a, long b) {
+	yar_packager *args[2];
+	yar_response *response;
+	long sum = -1;
+
+	args[0] = yar_pack_start_long();
+	yar_pack_push_long(args[0], a);
+	args[1] = yar_pack_start_long();
+	yar_pack_push_long(args[1], b);
+	response = client->call(client, "add", 2, args);
+	yar_pack_free(args[0]);
+	yar_pack_free(args[1]);
+	if (response) {
+		data_as_long(yar_response_get_response(response), &sum);
+		free_response(response);
+	}
+	return sum;
+}
+
+static void test_cache(void) {
+	yar_client *client = new_client();
+	yar_cache *cache = yar_cache_new(2);
+	yar_cache_info info;
+	int persistent = 1, never = -1;
+	unsigned int connects;
+
+	YAR_ASSERT(client != NULL && cache != NULL, "setup failed");
+	YAR_ASSERT(yar_cache_new(0) == NULL, "a cache of no entries was made");
+	YAR_ASSERT(yar_cache_set_ttl(cache, "add", 100, 5000) == 1, "ttl not accepted");
+	YAR_ASSERT(yar_client_set_opt(client, YAR_OPT_CACHE, cache) == 1, "cache not accepted");
+	yar_client_set_opt(client, YAR_PERSISTENT_LINK, &persistent);
+
+	/* a hit does not touch the connection, a call would have to reconnect */
+	YAR_ASSERT(cached_add(client, 1, 2) == 3, "first call failed");
+	shutdown(client->fd, SHUT_RDWR);
+	connects = client->connects;
+	YAR_ASSERT(cached_add(client, 1, 2) == 3, "cached call failed");
+	YAR_ASSERT(client->connects == connects, "a cache hit connected");
+	YAR_ASSERT(cached_add(client, 2, 2) == 4, "other parameters got the cached answer");
+	YAR_ASSERT(client->connects == connects + 1, "a miss did not go to the server");
+	yar_cache_get_info(cache, &info);
+	YAR_ASSERT(info.hits == 1 && info.misses == 2 && info.entries == 2, "%lu hits, %lu misses, %u entries", info.hits, info.misses, info.entries);
+
+	/* the least recently used goes: 1+2 was used last but one */
+	YAR_ASSERT(cached_add(client, 1, 2) == 3 && cached_add(client, 3, 2) == 5, "calls failed");
+	YAR_ASSERT(cached_add(client, 1, 2) == 3, "call failed");
+	yar_cache_get_info(cache, &info);
+	YAR_ASSERT(info.evictions == 1 && info.hits == 3, "%lu evictions, %lu hits", info.evictions, info.hits);
+	YAR_ASSERT(cached_add(client, 2, 2) == 4, "call failed");
+	yar_cache_get_info(cache, &info);
+	YAR_ASSERT(info.misses == 4, "the evicted entry was still there (%lu misses)", info.misses);
+
+	/* past its ttl an entry is refreshed, and served stale if that fails */
+	usleep(150 * 1000);
+	YAR_ASSERT(cached_add(client, 2, 2) == 4, "refresh failed");
+	YAR_ASSERT(cached_add(client, 2, 2) == 4, "call failed");
+	yar_cache_get_info(cache, &info);
+	YAR_ASSERT(info.hits == 4 && info.stale_hits == 0, "the refreshed entry was not fresh");
+
+	usleep(150 * 1000);
+	yar_client_set_opt(client, YAR_RECONNECT_BACKOFF_MS, &never);
+	close(client->fd);
+	client->fd = 0;
+	YAR_ASSERT(cached_add(client, 2, 2) == 4, "the stale entry was not served");
+	yar_cache_get_info(cache, &info);
+	YAR_ASSERT(info.stale_hits == 1, "%lu stale hits", info.stale_hits);
+
+	/* methods without a ttl go to the server every time */
+	YAR_ASSERT(client->call(client, "echo", 0, NULL) == NULL, "an uncached call was answered");
+
+	yar_cache_clear(cache);
+	yar_cache_get_info(cache, &info);
+	YAR_ASSERT(info.entries == 0, "%u entries after clear", info.entries);
+	yar_client_destroy(client);
+	yar_cache_destroy(cache);
+}
+/* }}} */
+
 /* concurrency {{{ */
+static void test_callf(void) {
+	yar_client *client = new_client();
+	yar_cache *cache = yar_cache_new(4);
+	yar_packager *pk;
+	yar_data *params;
+	yar_response *response;
+	yar_cache_info info;
+	const yar_data *data, *elem;
+	unsigned int size = 0;
+	int persistent = 1, bval = 0;
+	double dval = 0;
+	const char *str;
+	long lval;
+
+	YAR_ASSERT(client != NULL && cache != NULL, "setup failed");
+	yar_client_set_opt(client, YAR_PERSISTENT_LINK, &persistent);
+
+	response = yar_client_callf(client, "echo", "nbldsS", 1, -7L, 2.5, "hi", "abc", 2);
+	YAR_ASSERT(response != NULL && yar_response_get_status(response) == 0, "echo failed");
+	data = yar_response_get_response(response);
+	YAR_ASSERT(yar_unpack_data_type(data, &size) == YAR_DATA_ARRAY && size == 6, "expected an array of 6");
+	YAR_ASSERT(yar_unpack_data_type(array_at(data, 0), &size) == YAR_DATA_NULL, "nil");
+	YAR_ASSERT(yar_unpack_data_bool(array_at(data, 1), &bval) && bval == 1, "bool");
+	YAR_ASSERT(data_as_long(array_at(data, 2), &lval) && lval == -7, "long");
+	YAR_ASSERT(yar_unpack_data_value(array_at(data, 3), &dval) == YAR_DATA_DOUBLE && dval == 2.5, "double");
+	elem = array_at(data, 4);
+	YAR_ASSERT(yar_unpack_data_type(elem, &size) == YAR_DATA_STRING && size == 2 && yar_unpack_data_string(elem, &str) && !memcmp(str, "hi", 2), "string");
+	elem = array_at(data, 5);
+	YAR_ASSERT(yar_unpack_data_type(elem, &size) == YAR_DATA_STRING && size == 2 && yar_unpack_data_string(elem, &str) && !memcmp(str, "ab", 2), "sized string");
+	free_response(response);
+
+	/* a prebuilt array */
+	pk = yar_pack_start_array(2);
+	yar_pack_push_long(pk, 40);
+	yar_pack_push_long(pk, 2);
+	params = yar_pack_take_root(pk);
+	yar_pack_free(pk);
+	response = yar_client_call_data(client, "add", params);
+	YAR_ASSERT(response != NULL && data_as_long(yar_response_get_response(response), &lval) && lval == 42, "add over a value tree");
+	free_response(response);
+	YAR_ASSERT(yar_client_call_data(client, "add", array_at(params, 0)) == NULL, "a scalar taken for parameters");
+	yar_data_free(params);
+
+	/* nothing is sent for a bad format, the connection stays usable */
+	YAR_ASSERT(yar_client_callf(client, "add", "lx", 1L, 2L) == NULL, "an unknown format character taken");
+	response = yar_client_callf(client, "add", "ll", 20L, 22L);
+	YAR_ASSERT(response != NULL && data_as_long(yar_response_get_response(response), &lval) && lval == 42, "add after a bad format");
+	free_response(response);
+
+	/* the same cache entries as client->call() */
+	yar_cache_set_ttl(cache, "add", 5000, 0);
+	yar_client_set_opt(client, YAR_OPT_CACHE, cache);
+	YAR_ASSERT(cached_add(client, 5, 6) == 11, "cached add failed");
+	response = yar_client_callf(client, "add", "ll", 5L, 6L);
+	YAR_ASSERT(response != NULL && data_as_long(yar_response_get_response(response), &lval) && lval == 11, "add from the cache");
+	free_response(response);
+	yar_cache_get_info(cache, &info);
+	YAR_ASSERT(info.hits == 1 && info.misses == 1, "%lu hits, %lu misses", info.hits, info.misses);
+
+	yar_client_destroy(client);
+	yar_cache_destroy(cache);
+}
+
+/* seen[0] counts the elements that came in order, seen[1] all of them */
+static void count_element(const yar_data *element, unsigned int index, void *data) {
+	long *seen = (long *)data, val = -1;
+
+	if (data_as_long(element, &val) && val == (long)index * 10 && seen[1] == (long)index) {
+		seen[0]++;
+	}
+	seen[1]++;
+}
+
+static void test_stream_decode(void) {
+	yar_packager *pk = yar_pack_start_map(2);
+	yar_payload encoded = {0}, again = {0};
+	yar_msgpack_stream *st;
+	yar_data *root;
+	long seen[2] = {0, 0};
+	char text[300];
+	unsigned int i;
+
+	/* {"e": {"k": [nil, true, -300, 2^40, 3.5, "..."]}, "r": [0, 10, ..., 90]} */
+	memset(text, 'x', sizeof(text));
+	yar_pack_push_string(pk, "e", 1);
+	yar_pack_push_map(pk, 1);
+	yar_pack_push_string(pk, "k", 1);
+	yar_pack_push_array(pk, 6);
+	yar_pack_push_null(pk);
+	yar_pack_push_bool(pk, 1);
+	yar_pack_push_long(pk, -300);
+	yar_pack_push_ulong(pk, 1UL << 40);
+	yar_pack_push_double(pk, 3.5);
+	yar_pack_push_string(pk, text, sizeof(text));
+	yar_pack_push_string(pk, "r", 1);
+	yar_pack_push_array(pk, 10);
+	for (i = 0; i < 10; i++) {
+		yar_pack_push_long(pk, i * 10);
+	}
+	YAR_ASSERT(yar_pack_to_string(pk, &encoded) == 1, "encoding failed");
+	yar_pack_free(pk);
+
+	/* a byte at a time, every header and string is cut somewhere */
+	st = yar_msgpack_stream_new(encoded.size);
+	yar_msgpack_stream_watch(st, "r", count_element, seen);
+	for (i = 0; i + 1 < encoded.size; i++) {
+		YAR_ASSERT(yar_msgpack_stream_feed(st, encoded.data + i, 1) == 0, "complete at byte %u of %u", i, (unsigned int)encoded.size);
+	}
+	YAR_ASSERT(yar_msgpack_stream_take(st) == NULL, "an incomplete value taken");
+	YAR_ASSERT(yar_msgpack_stream_feed(st, encoded.data + i, 1) == 1, "not complete after the last byte");
+	YAR_ASSERT(seen[0] == 10 && seen[1] == 10, "%ld elements called back, %ld in order", seen[1], seen[0]);
+
+	root = yar_msgpack_stream_take(st);
+	yar_msgpack_stream_free(st);
+	YAR_ASSERT(root != NULL && yar_data_pack(root, &again, YAR_PACKAGER_MSGPACK) == 1, "re-encoding failed");
+	YAR_ASSERT(again.size == encoded.size && memcmp(again.data, encoded.data, encoded.size) == 0, "decoded value differs");
+	yar_data_free(root);
+	free(again.data);
+
+	/* cut short, not a yar type, more elements announced than bytes left */
+	st = yar_msgpack_stream_new(encoded.size);
+	YAR_ASSERT(yar_msgpack_stream_feed(st, encoded.data, encoded.size - 1) == 0, "a cut value complete");
+	yar_msgpack_stream_free(st);
+	st = yar_msgpack_stream_new(16);
+	YAR_ASSERT(yar_msgpack_stream_feed(st, "\xc4\x01", 2) == -1, "bin accepted");
+	yar_msgpack_stream_free(st);
+	st = yar_msgpack_stream_new(16);
+	YAR_ASSERT(yar_msgpack_stream_feed(st, "\xdd\xff\xff\xff\xff", 5) == -1, "a huge array accepted");
+	yar_msgpack_stream_free(st);
+	free(encoded.data);
+}
+
+static void test_element_handler(void) {
+	yar_client *client = new_client();
+	yar_element_handler handler = {count_element, NULL};
+	yar_response *response;
+	long seen[2] = {0, 0};
+	int persistent = 1, packager = YAR_PACKAGER_MSGPACK;
+
+	YAR_ASSERT(client != NULL, "connect failed");
+	yar_client_set_opt(client, YAR_PERSISTENT_LINK, &persistent);
+	yar_client_set_opt(client, YAR_OPT_PACKAGER, &packager);
+	handler.data = seen;
+	yar_client_set_opt(client, YAR_OPT_ELEMENT_HANDLER, &handler);
+	YAR_ASSERT(yar_client_get_opt(client, YAR_OPT_ELEMENT_HANDLER) != NULL, "handler not set");
+
+	/* echo answers with its parameters */
+	response = yar_client_callf(client, "echo", "lll", 0L, 10L, 20L);
+	YAR_ASSERT(response != NULL && yar_response_get_status(response) == 0, "echo failed");
+	YAR_ASSERT(seen[0] == 3 && seen[1] == 3, "%ld elements called back, %ld in order", seen[1], seen[0]);
+	free_response(response);
+
+	/* not an array */
+	response = yar_client_callf(client, "add", "ll", 1L, 2L);
+	YAR_ASSERT(response != NULL && seen[1] == 3, "a scalar result called back");
+	free_response(response);
+
+	yar_client_set_opt(client, YAR_OPT_ELEMENT_HANDLER, NULL);
+	YAR_ASSERT(yar_client_get_opt(client, YAR_OPT_ELEMENT_HANDLER) == NULL, "handler not cleared");
+	response = yar_client_callf(client, "echo", "l", 0L);
+	YAR_ASSERT(response != NULL && seen[1] == 3, "called back after clearing");
+	free_response(response);
+
+	yar_client_destroy(client);
+}
+
+typedef struct {
+	int calls;
+	int failed;
+	yar_call_stats last;
+	char method[32];
+} stats_seen;
+
+static void record_stats(const yar_call_stats *stats, void *data) {
+	stats_seen *seen = (stats_seen *)data;
+
+	seen->calls++;
+	seen->failed += !stats->ok;
+	seen->last = *stats;
+	snprintf(seen->method, sizeof(seen->method), "%s", stats->method? stats->method : "");
+}
+
+static void test_call_stats(void) {
+	struct event_base *base;
+	yar_client *client = yar_client_new(test_uri);
+	yar_stats_handler handler = {record_stats, NULL};
+	yar_response *response;
+	async_result result, batch[2];
+	stats_seen seen;
+	yar_packager *args[2];
+	int packager = test_packager, persistent = 1, batch_max = 2;
+
+	memset(&seen, 0, sizeof(seen));
+	handler.data = &seen;
+	yar_client_set_opt(client, YAR_PERSISTENT_LINK, &persistent);
+	yar_client_set_opt(client, YAR_OPT_PACKAGER, &packager);
+	yar_client_set_opt(client, YAR_OPT_STATS_HANDLER, &handler);
+	YAR_ASSERT(yar_client_get_opt(client, YAR_OPT_STATS_HANDLER) != NULL, "handler not set");
+
+	/* connecting is part of the first call */
+	response = yar_client_callf(client, "echo", "ls", 7L, "timed");
+	YAR_ASSERT(response != NULL && seen.calls == 1 && seen.last.ok, "echo not reported");
+	YAR_ASSERT(strcmp(seen.method, "echo") == 0 && seen.last.id == (unsigned int)response->id && seen.last.batch == 1,
+			"reported as '%s' #%u", seen.method, seen.last.id);
+	YAR_ASSERT(seen.last.connect > 0 && seen.last.first_byte > 0, "%lu us connecting, %lu us to the first byte",
+			seen.last.connect, seen.last.first_byte);
+	YAR_ASSERT(seen.last.bytes_received == response->payload.size && seen.last.bytes_sent > sizeof(yar_header),
+			"%u bytes received, %u sent", seen.last.bytes_received, seen.last.bytes_sent);
+	YAR_ASSERT(seen.last.total >= seen.last.connect + seen.last.write + seen.last.first_byte + seen.last.transfer + seen.last.decode,
+			"the parts add up to more than the %lu us total", seen.last.total);
+	free_response(response);
+
+	/* answered remotely with an error, still a call that went well */
+	response = client->call(client, "no_such_method", 0, NULL);
+	YAR_ASSERT(response != NULL && seen.calls == 2 && seen.last.ok && seen.last.connect < seen.last.total, "an error response not reported");
+	free_response(response);
+	yar_client_destroy(client);
+
+	/* asynchronously */
+	client = new_client();
+	YAR_ASSERT(client != NULL, "connect failed");
+	yar_client_set_opt(client, YAR_PERSISTENT_LINK, &persistent);
+	yar_client_set_opt(client, YAR_OPT_STATS_HANDLER, &handler);
+	base = event_base_new();
+	memset(&result, 0, sizeof(result));
+	args[0] = yar_pack_start_long();
+	yar_pack_push_long(args[0], 20);
+	args[1] = yar_pack_start_long();
+	yar_pack_push_long(args[1], 22);
+	result.expect = 42;
+	YAR_ASSERT(yar_client_call_async(client, base, "add", 2, args, async_on_complete, &result) != NULL, "async call did not start");
+	yar_pack_free(args[0]);
+	yar_pack_free(args[1]);
+	event_base_dispatch(base);
+	YAR_ASSERT(result.done == 1 && result.result == 42, "async call failed");
+	YAR_ASSERT(seen.calls == 3 && seen.last.ok && strcmp(seen.method, "add") == 0 && seen.last.connect == 0,
+			"async call reported as '%s', %lu us connecting", seen.method, seen.last.connect);
+	YAR_ASSERT(seen.last.bytes_sent > sizeof(yar_header) && seen.last.bytes_received > sizeof(yar_header),
+			"%u bytes sent, %u received", seen.last.bytes_sent, seen.last.bytes_received);
+
+	/* the calls of a batch share its request and response */
+	yar_client_set_opt(client, YAR_BATCH_MAX, &batch_max);
+	memset(batch, 0, sizeof(batch));
+	async_add(client, base, 1, &batch[0]);
+	async_add(client, base, 2, &batch[1]);
+	event_base_dispatch(base);
+	YAR_ASSERT(batch[0].done == 1 && batch[1].done == 1, "the batched calls did not complete");
+	YAR_ASSERT(seen.calls == 5 && seen.last.ok && seen.last.batch == 2 && seen.last.bytes_received > sizeof(yar_header),
+			"%d calls reported, the last in a batch of %u", seen.calls, seen.last.batch);
+	batch_max = 0;
+	yar_client_set_opt(client, YAR_BATCH_MAX, &batch_max);
+	event_base_free(base);
+
+	yar_client_set_opt(client, YAR_OPT_STATS_HANDLER, NULL);
+	YAR_ASSERT(yar_client_get_opt(client, YAR_OPT_STATS_HANDLER) == NULL, "handler not cleared");
+	response = client->call(client, "echo", 0, NULL);
+	YAR_ASSERT(response != NULL && seen.calls == 5, "reported after clearing");
+	free_response(response);
+	yar_client_destroy(client);
+
+	/* a failed call is reported too */
+	if (test_is_tcp) {
+		client = yar_client_new("tcp://127.0.0.1:1");
+		yar_client_set_opt(client, YAR_OPT_STATS_HANDLER, &handler);
+		YAR_ASSERT(client->call(client, "echo", 0, NULL) == NULL, "a call to a closed port succeeded");
+		YAR_ASSERT(seen.calls == 6 && seen.failed == 1 && seen.last.bytes_sent == 0, "a failed call not reported");
+		yar_client_destroy(client);
+	}
+}
+
+static void test_breaker(void) {
+	yar_breaker *breaker = yar_breaker_new();
+	yar_breaker_info info;
+	yar_response *response;
+	yar_client *client;
+	struct timeval start;
+	int failures = 2, open_time = 200, rate = 50, min_calls = 4, zero = 0, persistent = 1, backoff = 1000, i;
+	char hostname[128];
+
+	YAR_ASSERT(yar_breaker_set_opt(breaker, YAR_BREAKER_FAILURES, &failures) == 1
+			&& yar_breaker_set_opt(breaker, YAR_BREAKER_OPEN_TIME, &open_time) == 1, "options not accepted");
+	YAR_ASSERT(yar_breaker_set_opt(breaker, YAR_BREAKER_ERROR_RATE, &open_time) == 0, "an error rate over 100%% accepted");
+	YAR_ASSERT(*(int *)yar_breaker_get_opt(breaker, YAR_BREAKER_FAILURES) == 2, "failures not set");
+
+	/* opened by failures in a row, then calls fail without connecting */
+	if (test_is_tcp) {
+		for (i = 0; i < 3; i++) {
+			client = yar_client_new("tcp://127.0.0.1:1");
+			yar_client_set_opt(client, YAR_OPT_BREAKER, breaker);
+			YAR_ASSERT(client->call(client, "echo", 0, NULL) == NULL, "a call to a closed port succeeded");
+			YAR_ASSERT(client->connects == (i < 2), "call #%d connected %u times", i, client->connects);
+			yar_client_destroy(client);
+		}
+		YAR_ASSERT(yar_breaker_get_info(breaker, "127.0.0.1:1", &info) && info.state == YAR_BREAKER_OPEN
+				&& info.opened == 1 && info.rejected == 1, "circuit state %d, opened %lu, rejected %lu", info.state, info.opened, info.rejected);
+
+		/* half-open after the open time, a failed probe opens it again */
+		usleep(250 * 1000);
+		YAR_ASSERT(yar_breaker_get_info(breaker, "127.0.0.1:1", &info) && info.state == YAR_BREAKER_HALF_OPEN, "not half-open");
+		client = yar_client_new("tcp://127.0.0.1:1");
+		yar_client_set_opt(client, YAR_OPT_BREAKER, breaker);
+		YAR_ASSERT(client->call(client, "echo", 0, NULL) == NULL && client->connects == 1, "not probed");
+		yar_client_destroy(client);
+		YAR_ASSERT(yar_breaker_get_info(breaker, "127.0.0.1:1", &info) && info.state == YAR_BREAKER_OPEN && info.opened == 2,
+				"a failed probe left it %d", info.state);
+
+		/* a call the client refuses itself, backing off from reconnecting,
+		 * did not reach the server and is not counted */
+		client = yar_client_new("tcp://127.0.0.1:2");
+		yar_client_set_opt(client, YAR_PERSISTENT_LINK, &persistent);
+		yar_client_set_opt(client, YAR_RECONNECT_BACKOFF_MS, &backoff);
+		yar_client_set_opt(client, YAR_OPT_BREAKER, breaker);
+		YAR_ASSERT(client->call(client, "echo", 0, NULL) == NULL && client->call(client, "echo", 0, NULL) == NULL, "a call to a closed port succeeded");
+		YAR_ASSERT(client->connects == 1, "reconnected during the backoff");
+		YAR_ASSERT(yar_breaker_get_info(breaker, "127.0.0.1:2", &info) && info.state == YAR_BREAKER_CLOSED && info.failures == 1,
+				"the refused call was recorded: state %d, %u failures", info.state, info.failures);
+		yar_client_destroy(client);
+	}
+
+	/* a good probe closes it */
+	client = yar_client_new(test_uri);
+	yar_client_set_opt(client, YAR_PERSISTENT_LINK, &persistent);
+	yar_client_set_opt(client, YAR_OPT_BREAKER, breaker);
+	snprintf(hostname, sizeof(hostname), "%s", client->hostname);
+	yar_breaker_record(breaker, hostname, 0);
+	yar_breaker_record(breaker, hostname, 0);
+	gettimeofday(&start, NULL);
+	YAR_ASSERT(client->call(client, "echo", 0, NULL) == NULL && client->connects == 0, "called through an open circuit");
+	YAR_ASSERT(elapsed_ms(&start) < 50, "failing fast took %ldms", elapsed_ms(&start));
+	usleep(250 * 1000);
+	response = client->call(client, "echo", 0, NULL);
+	YAR_ASSERT(response != NULL && yar_breaker_get_info(breaker, hostname, &info) && info.state == YAR_BREAKER_CLOSED,
+			"the probe did not close it (%d)", info.state);
+	free_response(response);
+
+	/* an error answered by the server is not a failure */
+	for (i = 0; i < 3; i++) {
+		free_response(client->call(client, "no_such_method", 0, NULL));
+	}
+	YAR_ASSERT(yar_breaker_get_info(breaker, hostname, &info) && info.state == YAR_BREAKER_CLOSED && info.failures == 0,
+			"error responses counted as %u failures", info.failures);
+	yar_client_destroy(client);
+
+	/* opened by the error rate: 2 of 4 calls failed, not in a row */
+	yar_breaker_set_opt(breaker, YAR_BREAKER_FAILURES, &zero);
+	yar_breaker_set_opt(breaker, YAR_BREAKER_ERROR_RATE, &rate);
+	yar_breaker_set_opt(breaker, YAR_BREAKER_MIN_CALLS, &min_calls);
+	yar_breaker_record(breaker, "rate:1", 1);
+	yar_breaker_record(breaker, "rate:1", 0);
+	yar_breaker_record(breaker, "rate:1", 1);
+	YAR_ASSERT(yar_breaker_get_info(breaker, "rate:1", &info) && info.state == YAR_BREAKER_CLOSED, "opened before min calls");
+	yar_breaker_record(breaker, "rate:1", 0);
+	YAR_ASSERT(yar_breaker_get_info(breaker, "rate:1", &info) && info.state == YAR_BREAKER_OPEN, "not opened by the error rate");
+	YAR_ASSERT(yar_breaker_allow(breaker, "rate:1") == 0, "an open circuit let a call through");
+	YAR_ASSERT(yar_breaker_get_info(breaker, "never:1", &info) == 0, "info for an endpoint never called");
+
+	yar_breaker_destroy(breaker);
+}
+
+static void test_compression(void) {
+	struct event_base *base;
+	yar_client *client = new_client();
+	yar_stats_handler handler = {record_stats, NULL};
+	yar_response *response;
+	async_result result;
+	stats_seen seen;
+	yar_packager *args[2];
+	const yar_data *elem;
+	int threshold = 1024, persistent = 1, i;
+	uint size = 0, len = 100000;
+	char *big = malloc(len);
+
+	YAR_ASSERT(client != NULL, "connect failed");
+	if (!yar_client_set_opt(client, YAR_OPT_COMPRESS_THRESHOLD, &threshold)) {
+		printf("(skipped, built without zstd) ");
+		yar_client_destroy(client);
+		free(big);
+		return;
+	}
+	for (i = 0; i < (int)len; i++) {
+		big[i] = "yar-compress "[i % 13];
+	}
+	memset(&seen, 0, sizeof(seen));
+	handler.data = &seen;
+	yar_client_set_opt(client, YAR_PERSISTENT_LINK, &persistent);
+	yar_client_set_opt(client, YAR_OPT_STATS_HANDLER, &handler);
+
+	/* the first request goes as it is, the answer is compressed */
+	response = yar_client_callf(client, "echo", "S", big, len);
+	elem = response? array_at(yar_response_get_response(response), 0) : NULL;
+	YAR_ASSERT(elem && yar_unpack_data_type(elem, &size) == YAR_DATA_STRING && size == len, "echoed %u bytes", size);
+	YAR_ASSERT(seen.last.bytes_sent > len && seen.last.bytes_received < len / 10,
+			"%u bytes sent, %u received", seen.last.bytes_sent, seen.last.bytes_received);
+	YAR_ASSERT(client->compress_peer == 1, "the server did not say it takes compressed requests");
+	free_response(response);
+
+	/* from then on the requests are compressed too */
+	response = yar_client_callf(client, "echo", "S", big, len);
+	elem = response? array_at(yar_response_get_response(response), 0) : NULL;
+	YAR_ASSERT(elem && yar_unpack_data_type(elem, &size) == YAR_DATA_STRING && size == len, "echoed %u bytes", size);
+	YAR_ASSERT(seen.last.bytes_sent < len / 10, "%u bytes sent compressed", seen.last.bytes_sent);
+	free_response(response);
+
+	/* small bodies are not */
+	response = client->call(client, "echo", 0, NULL);
+	YAR_ASSERT(response != NULL && yar_response_get_status(response) == 0, "a small call failed");
+	free_response(response);
+
+	/* and asynchronously */
+	base = event_base_new();
+	memset(&result, 0, sizeof(result));
+	args[0] = yar_pack_start_string();
+	yar_pack_push_string(args[0], big, len);
+	YAR_ASSERT(yar_client_call_async(client, base, "echo", 1, args, async_on_complete, &result) != NULL, "async call did not start");
+	yar_pack_free(args[0]);
+	event_base_dispatch(base);
+	YAR_ASSERT(result.done == 1 && result.status == 0, "compressed async call failed");
+	YAR_ASSERT(seen.last.bytes_sent < len / 10 && seen.last.bytes_received < len / 10,
+			"%u bytes sent, %u received", seen.last.bytes_sent, seen.last.bytes_received);
+	event_base_free(base);
+
+	yar_client_destroy(client);
+	free(big);
+}
+
 static void test_concurrent(void) {
 	pid_t children[4];
 	int i, num_children = 4, calls = 25;
@@ -867,6 +2548,150 @@ static void test_concurrent(void) {
 }
 /* }}} */
 
+/* scoreboard {{{ */
+static yar_worker_status * find_worker(yar_worker_status *workers, int n, pid_t pid, const char *method) {
+	int i;
+	for (i = 0; i < n; i++) {
+		if ((pid && workers[i].pid == pid) || (method && workers[i].busy && strcmp(workers[i].method, method) == 0)) {
+			return &workers[i];
+		}
+	}
+	return NULL;
+}
+
+static void test_scoreboard(void) {
+	yar_worker_status workers[128], *worker;
+	int i, n, stat = 0;
+	pid_t child, pid;
+
+	n = yar_scoreboard_read(test_scoreboard_file, workers, 128);
+	YAR_ASSERT(n > 0, "no workers on the scoreboard %s (%d)", test_scoreboard_file, n);
+	for (i = 0; i < n; i++) {
+		YAR_ASSERT(workers[i].pid > 0 && kill(workers[i].pid, 0) == 0, "worker %d is not alive", workers[i].pid);
+	}
+
+	child = fork();
+	YAR_ASSERT(child != -1, "fork failed");
+	if (child == 0) {
+		yar_client *client = new_client();
+		yar_packager *arg = yar_pack_start_long();
+		yar_response *response;
+
+		yar_pack_push_long(arg, 2);
+		if (!client) {
+			_exit(1);
+		}
+		response = client->call(client, "sleep", 1, &arg);
+		_exit(response && yar_response_get_status(response) == 0? 0 : 1);
+	}
+
+	/* the call is in progress on one of the workers for the next 2 seconds */
+	usleep(800 * 1000);
+	n = yar_scoreboard_read(test_scoreboard_file, workers, 128);
+	worker = find_worker(workers, n, 0, "sleep");
+	if (!worker) {
+		waitpid(child, &stat, 0);
+		YAR_ASSERT(0, "no worker shows the sleep call in progress");
+	}
+	pid = worker->pid;
+	YAR_ASSERT(worker->connections >= 1, "busy worker has %d connections", worker->connections);
+	YAR_ASSERT(worker->request_start > 0, "busy worker has no request start time");
+	YAR_ASSERT(worker->bytes_in > 0, "busy worker has read no bytes");
+
+	YAR_ASSERT(waitpid(child, &stat, 0) == child, "waitpid failed");
+	YAR_ASSERT(WIFEXITED(stat) && WEXITSTATUS(stat) == 0, "sleep call failed (status %d)", stat);
+
+	n = yar_scoreboard_read(test_scoreboard_file, workers, 128);
+	worker = find_worker(workers, n, pid, NULL);
+	YAR_ASSERT(worker != NULL, "worker %d left the scoreboard", pid);
+	YAR_ASSERT(worker->requests >= 1, "worker %d answered no requests", pid);
+	YAR_ASSERT(worker->bytes_out > 0, "worker %d sent no bytes", pid);
+	YAR_ASSERT(strcmp(worker->method, "sleep") == 0, "worker %d last method is '%s'", pid, worker->method);
+}
+
+/* workers take 4 seconds in YAR_CHILD_INIT: the sleep call makes the master
+ * fork a spare, which it stops again while the spare is still starting up */
+static void test_drain_during_init(void) {
+	yar_worker_status workers[128];
+	yar_client *client = new_client_timeout(10);
+	yar_packager *arg = yar_pack_start_long();
+	yar_response *response;
+	pid_t pid = 0;
+	int i, n, attempts;
+
+	yar_pack_push_long(arg, 2);
+	YAR_ASSERT(client != NULL, "connect failed");
+	/* answered once the first worker is ready */
+	response = client->call(client, "sleep", 1, &arg);
+	yar_pack_free(arg);
+	YAR_ASSERT(response != NULL && yar_response_get_status(response) == 0, "sleep call failed");
+	free_response(response);
+	yar_client_destroy(client);
+
+	/* the master marks its victim within the next second or two */
+	for (attempts = 0; attempts < 40 && !pid; attempts++) {
+		n = yar_scoreboard_read(test_scoreboard_file, workers, 128);
+		for (i = 0; i < n; i++) {
+			if (workers[i].state == YAR_WORKER_DRAINING) {
+				pid = workers[i].pid;
+			}
+		}
+		if (!pid) {
+			usleep(100 * 1000);
+		}
+	}
+	YAR_ASSERT(pid != 0, "no worker was stopped after the sleep call");
+
+	/* it still finishes its YAR_CHILD_INIT, then it has to go away */
+	for (attempts = 0; attempts < 80; attempts++) {
+		n = yar_scoreboard_read(test_scoreboard_file, workers, 128);
+		for (i = 0; i < n && workers[i].pid != pid; i++);
+		if (i == n) {
+			break;
+		}
+		usleep(100 * 1000);
+	}
+	YAR_ASSERT(attempts < 80, "worker %d was stopped during its startup and never exited", pid);
+}
+
+/* the only worker accepting has a stalled request when a fast one comes in,
+ * the spare the master forks for it takes 4 seconds to start */
+static void test_scoreboard_oldest(void) {
+	yar_worker_status workers[128], *worker;
+	yar_client *client;
+	yar_response *response;
+	struct timeval mark;
+	ulong mark_us;
+	int fd, n;
+
+	/* the first bytes of a header, the request is in progress until the
+	 * connection is closed */
+	fd = raw_connect();
+	YAR_ASSERT(fd != -1, "raw connect failed");
+	YAR_ASSERT(send(fd, "\0\0\0\1", 4, 0) == 4, "send failed");
+	usleep(300 * 1000);
+
+	gettimeofday(&mark, NULL);
+	mark_us = (ulong)mark.tv_sec * 1000000 + mark.tv_usec;
+	client = new_client();
+	YAR_ASSERT(client != NULL, "connect failed");
+	response = client->call(client, "echo", 0, NULL);
+	YAR_ASSERT(response != NULL && yar_response_get_status(response) == 0, "echo call failed");
+	free_response(response);
+	yar_client_destroy(client);
+
+	/* the worker counts the call as done once it has sent the response */
+	usleep(100 * 1000);
+	n = yar_scoreboard_read(test_scoreboard_file, workers, 128);
+	worker = find_worker(workers, n, 0, "echo");
+	close(fd);
+	YAR_ASSERT(worker != NULL, "the echo call was not answered by the worker with the stalled request");
+	YAR_ASSERT(worker->busy == 1, "worker %d has %d requests in progress", worker->pid, worker->busy);
+	YAR_ASSERT(worker->request_start > 0 && worker->request_start < mark_us,
+			"worker %d shows the start of the echo call, not of the stalled request", worker->pid);
+}
+/* }}} */
+
 static int probe_server(void) {
 	int attempts = 50; /* 50 x 100ms = 5s */
 
@@ -883,7 +2708,7 @@ static int probe_server(void) {
 
 int main(int argc, char **argv) {
 	int i;
-	int probe = 0, concurrent_only = 0;
+	int probe = 0, concurrent_only = 0, slow_init = 0;
 
 	for (i = 1; i < argc; i++) {
 		if (strcmp(argv[i], "--uri") == 0 && i + 1 < argc) {
@@ -892,6 +2717,10 @@ int main(int argc, char **argv) {
 			probe = 1;
 		} else if (strcmp(argv[i], "--concurrent") == 0) {
 			concurrent_only = 1;
+		} else if (strcmp(argv[i], "--scoreboard") == 0 && i + 1 < argc) {
+			test_scoreboard_file = argv[++i];
+		} else if (strcmp(argv[i], "--slow-init") == 0) {
+			slow_init = 1;
 		} else if (strcmp(argv[i], "--packager") == 0 && i + 1 < argc) {
 			if (strcmp(argv[++i], "json") == 0) {
 				test_packager = YAR_PACKAGER_JSON;
@@ -900,13 +2729,13 @@ int main(int argc, char **argv) {
 				return 2;
 			}
 		} else {
-			fprintf(stderr, "usage: %s --uri <tcp://host:port | /path/sock> [--probe] [--concurrent] [--packager <msgpack|json>]\n", argv[0]);
+			fprintf(stderr, "usage: %s --uri <tcp://host:port | /path/sock> [--probe] [--concurrent] [--scoreboard <file> [--slow-init]] [--packager <msgpack|json>]\n", argv[0]);
 			return 2;
 		}
 	}
 
 	if (!test_uri) {
-		fprintf(stderr, "usage: %s --uri <tcp://host:port | /path/sock> [--probe] [--concurrent] [--packager <msgpack|json>]\n", argv[0]);
+		fprintf(stderr, "usage: %s --uri <tcp://host:port | /path/sock> [--probe] [--concurrent] [--scoreboard <file> [--slow-init]] [--packager <msgpack|json>]\n", argv[0]);
 		return 2;
 	}
 
@@ -919,6 +2748,19 @@ int main(int argc, char **argv) {
 	printf("yar-c test suite, uri = %s, packager = %s\n", test_uri,
 			test_packager == YAR_PACKAGER_JSON? "json" : "msgpack");
 
+	if (test_scoreboard_file && slow_init) {
+		YAR_RUN(test_drain_during_init);
+		YAR_RUN(test_scoreboard_oldest);
+		YAR_SUMMARY();
+		return yar_tests_failed? 1 : 0;
+	}
+
+	if (test_scoreboard_file) {
+		YAR_RUN(test_scoreboard);
+		YAR_SUMMARY();
+		return yar_tests_failed? 1 : 0;
+	}
+
 	if (concurrent_only) {
 		YAR_RUN(test_concurrent);
 		YAR_SUMMARY();
@@ -927,6 +2769,12 @@ int main(int argc, char **argv) {
 
 	YAR_RUN(test_connect);
 	YAR_RUN(test_connect_refused);
+	YAR_RUN(test_connect_timeout);
+	YAR_RUN(test_resolve);
+	YAR_RUN(test_connect_ipv6);
+	YAR_RUN(test_lazy_connect);
+	YAR_RUN(test_reconnect);
+	YAR_RUN(test_high_fd);
 	YAR_RUN(test_echo_no_args);
 	YAR_RUN(test_echo_scalars);
 	YAR_RUN(test_echo_composite);
@@ -937,14 +2785,38 @@ int main(int argc, char **argv) {
 	YAR_RUN(test_undefined_method);
 	YAR_RUN(test_server_error);
 	YAR_RUN(test_persistent);
+	YAR_RUN(test_ping);
+	YAR_RUN(test_list);
 	YAR_RUN(test_non_persistent_single_call);
 	YAR_RUN(test_big_payload);
 	YAR_RUN(test_concurrent);
+	YAR_RUN(test_async);
+	YAR_RUN(test_async_pipelining);
+	YAR_RUN(test_async_cancel);
+	YAR_RUN(test_async_batch);
+	YAR_RUN(test_concurrent_client);
+	YAR_RUN(test_shared_client);
+	YAR_RUN(test_pool);
+	YAR_RUN(test_pool_warmup);
+	YAR_RUN(test_pool_keepalive);
+	YAR_RUN(test_pool_async);
+	YAR_RUN(test_pool_hash);
+	YAR_RUN(test_pool_hedge);
+	YAR_RUN(test_cache);
+	YAR_RUN(test_callf);
+	YAR_RUN(test_stream_decode);
+	YAR_RUN(test_element_handler);
+	YAR_RUN(test_call_stats);
+	YAR_RUN(test_breaker);
+	YAR_RUN(test_compression);
 	YAR_RUN(test_malformed_garbage_header);
 	YAR_RUN(test_malformed_huge_body_len);
 	/* keep the timeout tests last: they occupy the (single-process) server
-	   for ~3 seconds */
+	   for ~10 seconds */
 	YAR_RUN(test_timeout);
+	YAR_RUN(test_async_timeout);
+	YAR_RUN(test_concurrent_client_timeout);
+	YAR_RUN(test_timeout_ms);
 	YAR_RUN(test_recovery_after_timeout);
 
 	YAR_SUMMARY();
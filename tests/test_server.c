@@ -268,6 +268,14 @@ static void test_handler_big(yar_request *request, yar_response *response, void
 }
 /* }}} */
 
+static int test_init_delay = 0;
+
+/* a worker that takes long to start, -i */
+static void test_child_init(void *data) /* {{{ */ {
+	sleep(test_init_delay);
+}
+/* }}} */
+
 static yar_server_handler test_handlers[] = {
 	{"echo", sizeof("echo") - 1, test_handler_echo},
 	{"add", sizeof("add") - 1, test_handler_add},
@@ -281,11 +289,15 @@ static yar_server_handler test_handlers[] = {
 int main(int argc, char **argv) {
 	int opt;
 	int max_children = 0;
+	int max_requests = 0;
+	int pm = YAR_PM_STATIC, start_children = 0, min_spare = 0, max_spare = 0;
 	int standalone = 0;
 	int read_timeout = 10;
-	char *hostname = NULL, *log_file = NULL, *pid_file = NULL;
+	char *hostname = NULL, *log_file = NULL, *pid_file = NULL, *scoreboard_file = NULL;
+	char *worker_cpus = NULL;
+	int affinity = YAR_AFFINITY_NONE;
 
-	while ((opt = getopt(argc, argv, "S:n:l:p:X")) != -1) {
+	while ((opt = getopt(argc, argv, "S:n:r:D:s:a:i:l:p:X")) != -1) {
 		switch (opt) {
 			case 'S':
 				hostname = optarg;
@@ -293,6 +305,27 @@ int main(int argc, char **argv) {
 			case 'n':
 				max_children = atoi(optarg);
 				break;
+			case 'r':
+				max_requests = atoi(optarg);
+				break;
+			case 'D':
+				/* start:min spare:max spare */
+				pm = YAR_PM_DYNAMIC;
+				sscanf(optarg, "%d:%d:%d", &start_children, &min_spare, &max_spare);
+				break;
+			case 's':
+				scoreboard_file = optarg;
+				break;
+			case 'a':
+				/* cpu|node[:cpu list] */
+				affinity = strncmp(optarg, "node", 4) == 0? YAR_AFFINITY_NODE : YAR_AFFINITY_CPU;
+				if ((worker_cpus = strchr(optarg, ':'))) {
+					worker_cpus++;
+				}
+				break;
+			case 'i':
+				test_init_delay = atoi(optarg);
+				break;
 			case 'l':
 				log_file = optarg;
 				break;
@@ -303,13 +336,13 @@ int main(int argc, char **argv) {
 				standalone = 1;
 				break;
 			default:
-				fprintf(stderr, "usage: %s -S <host:port|/path/sock> [-n workers] [-l logfile] [-p pidfile] [-X]\n", argv[0]);
+				fprintf(stderr, "usage: %s -S <host:port|/path/sock> [-n workers] [-r max requests] [-D start:min spare:max spare] [-s scoreboard] [-a cpu|node[:cpu list]] [-i init seconds] [-l logfile] [-p pidfile] [-X]\n", argv[0]);
 				return 2;
 		}
 	}
 
 	if (!hostname) {
-		fprintf(stderr, "usage: %s -S <host:port|/path/sock> [-n workers] [-l logfile] [-p pidfile] [-X]\n", argv[0]);
+		fprintf(stderr, "usage: %s -S <host:port|/path/sock> [-n workers] [-r max requests] [-D start:min spare:max spare] [-s scoreboard] [-a cpu|node[:cpu list]] [-i init seconds] [-l logfile] [-p pidfile] [-X]\n", argv[0]);
 		return 2;
 	}
 
@@ -318,6 +351,11 @@ int main(int argc, char **argv) {
 	}
 	yar_server_set_opt(YAR_STAND_ALONE, &standalone);
 	yar_server_set_opt(YAR_MAX_CHILDREN, &max_children);
+	yar_server_set_opt(YAR_MAX_REQUESTS_PER_WORKER, &max_requests);
+	yar_server_set_opt(YAR_PROCESS_MANAGER, &pm);
+	yar_server_set_opt(YAR_START_CHILDREN, &start_children);
+	yar_server_set_opt(YAR_MIN_SPARE_CHILDREN, &min_spare);
+	yar_server_set_opt(YAR_MAX_SPARE_CHILDREN, &max_spare);
 	yar_server_set_opt(YAR_READ_TIMEOUT, &read_timeout);
 	if (log_file) {
 		yar_server_set_opt(YAR_LOG_FILE, log_file);
@@ -325,6 +363,18 @@ int main(int argc, char **argv) {
 	if (pid_file) {
 		yar_server_set_opt(YAR_PID_FILE, pid_file);
 	}
+	if (scoreboard_file) {
+		yar_server_set_opt(YAR_SCOREBOARD_FILE, scoreboard_file);
+	}
+	if (affinity != YAR_AFFINITY_NONE) {
+		yar_server_set_opt(YAR_WORKER_AFFINITY, &affinity);
+		if (worker_cpus && !yar_server_set_opt(YAR_WORKER_CPUS, worker_cpus)) {
+			return 1;
+		}
+	}
+	if (test_init_delay) {
+		yar_server_set_opt(YAR_CHILD_INIT, (void *)test_child_init);
+	}
 	yar_server_register_handler(test_handlers);
 
 	yar_server_run();
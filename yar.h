@@ -25,7 +25,13 @@
 #include "yar_response.h"
 #include "yar_request.h"
 #include "yar_protocol.h"
+#include "yar_cache.h"
+#include "yar_resolve.h"
+#include "yar_breaker.h"
 #include "yar_client.h"
+#include "yar_concurrent_client.h"
+#include "yar_shared_client.h"
+#include "yar_pool.h"
 #include "yar_server.h"
 
 #endif
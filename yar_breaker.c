@@ -0,0 +1,300 @@
+/**
+ * Yar - Concurrent RPC Server for PHP, C etc
+ *
+ * Copyright (C) 2012-2012 Xinchen Hui <laruence at gmail dot com>
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>   /* for gettimeofday */
+
+#include "yar_common.h"
+#include "yar_log.h"
+#include "yar_breaker.h"
+
+typedef struct _yar_breaker_endpoint {
+	char *hostname;
+	yar_breaker_info info;
+	ulong window_start;  /* milliseconds, as the ones below */
+	ulong open_until;
+	ulong probe_since;   /* the first probe in flight was let through */
+	uint probing;        /* probes in flight */
+} yar_breaker_endpoint;
+
+struct _yar_breaker {
+	yar_breaker_endpoint *endpoints;
+	uint num_endpoints;
+	int failures;
+	int error_rate;
+	int min_calls;
+	int window;
+	int open_time;
+	int probes;
+};
+
+static ulong yar_breaker_now() /* {{{ */ {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (ulong)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+/* }}} */
+
+static yar_breaker_endpoint * yar_breaker_find(yar_breaker *breaker, const char *hostname) /* {{{ */ {
+	uint i;
+
+	for (i = 0; i < breaker->num_endpoints; i++) {
+		if (strcmp(breaker->endpoints[i].hostname, hostname) == 0) {
+			return &breaker->endpoints[i];
+		}
+	}
+	return NULL;
+}
+/* }}} */
+
+/* the circuit to hostname, a closed one the first time it is called */
+static yar_breaker_endpoint * yar_breaker_endpoint_get(yar_breaker *breaker, const char *hostname, ulong now) /* {{{ */ {
+	yar_breaker_endpoint *endpoint = yar_breaker_find(breaker, hostname);
+
+	if (!endpoint) {
+		breaker->endpoints = realloc(breaker->endpoints, sizeof(yar_breaker_endpoint) * (breaker->num_endpoints + 1));
+		endpoint = &breaker->endpoints[breaker->num_endpoints++];
+		memset(endpoint, 0, sizeof(yar_breaker_endpoint));
+		endpoint->hostname = strdup(hostname);
+		endpoint->window_start = now;
+	}
+	return endpoint;
+}
+/* }}} */
+
+/* start counting the error rate over when the window is over */
+static void yar_breaker_roll(yar_breaker *breaker, yar_breaker_endpoint *endpoint, ulong now) /* {{{ */ {
+	if (now - endpoint->window_start >= (ulong)breaker->window) {
+		endpoint->info.calls = endpoint->info.failures = 0;
+		endpoint->window_start = now;
+	}
+}
+/* }}} */
+
+static void yar_breaker_open(yar_breaker *breaker, yar_breaker_endpoint *endpoint, ulong now) /* {{{ */ {
+	alog(YAR_WARNING, "Circuit to '%s' opened, %u failures in a row, %u of %u calls failed",
+			endpoint->hostname, endpoint->info.consecutive, endpoint->info.failures, endpoint->info.calls);
+	endpoint->info.state = YAR_BREAKER_OPEN;
+	endpoint->info.opened++;
+	endpoint->open_until = now + breaker->open_time;
+	endpoint->probing = 0;
+}
+/* }}} */
+
+yar_breaker * yar_breaker_new(void) /* {{{ */ {
+	yar_breaker *breaker = calloc(1, sizeof(yar_breaker));
+
+	breaker->failures = 5;
+	breaker->error_rate = 50;
+	breaker->min_calls = 20;
+	breaker->window = 10000;
+	breaker->open_time = 5000;
+	breaker->probes = 1;
+
+	return breaker;
+}
+/* }}} */
+
+int yar_breaker_set_opt(yar_breaker *breaker, yar_breaker_opt opt, void *val) /* {{{ */ {
+	int value = *(int *)val;
+
+	switch (opt) {
+		case YAR_BREAKER_FAILURES:
+		case YAR_BREAKER_MIN_CALLS:
+			if (value < 0) {
+				return 0;
+			}
+			*(opt == YAR_BREAKER_FAILURES? &breaker->failures : &breaker->min_calls) = value;
+		break;
+		case YAR_BREAKER_ERROR_RATE:
+			if (value < 0 || value > 100) {
+				return 0;
+			}
+			breaker->error_rate = value;
+		break;
+		case YAR_BREAKER_WINDOW:
+		case YAR_BREAKER_OPEN_TIME:
+		case YAR_BREAKER_PROBES:
+			if (value < 1) {
+				return 0;
+			}
+			if (opt == YAR_BREAKER_WINDOW) {
+				breaker->window = value;
+			} else if (opt == YAR_BREAKER_OPEN_TIME) {
+				breaker->open_time = value;
+			} else {
+				breaker->probes = value;
+			}
+		break;
+		default:
+			return 0;
+	}
+	return 1;
+}
+/* }}} */
+
+const void * yar_breaker_get_opt(yar_breaker *breaker, yar_breaker_opt opt) /* {{{ */ {
+	switch (opt) {
+		case YAR_BREAKER_FAILURES:
+			return &breaker->failures;
+		break;
+		case YAR_BREAKER_ERROR_RATE:
+			return &breaker->error_rate;
+		break;
+		case YAR_BREAKER_MIN_CALLS:
+			return &breaker->min_calls;
+		break;
+		case YAR_BREAKER_WINDOW:
+			return &breaker->window;
+		break;
+		case YAR_BREAKER_OPEN_TIME:
+			return &breaker->open_time;
+		break;
+		case YAR_BREAKER_PROBES:
+			return &breaker->probes;
+		break;
+		default:
+			return NULL;
+	}
+}
+/* }}} */
+
+/* 0 if no call went to hostname yet */
+int yar_breaker_get_info(yar_breaker *breaker, const char *hostname, yar_breaker_info *info) /* {{{ */ {
+	yar_breaker_endpoint *endpoint = yar_breaker_find(breaker, hostname);
+
+	if (!endpoint) {
+		return 0;
+	}
+	*info = endpoint->info;
+	if (info->state == YAR_BREAKER_OPEN && yar_breaker_now() >= endpoint->open_until) {
+		/* the next call probes it */
+		info->state = YAR_BREAKER_HALF_OPEN;
+	}
+	return 1;
+}
+/* }}} */
+
+void yar_breaker_destroy(yar_breaker *breaker) /* {{{ */ {
+	uint i;
+
+	for (i = 0; i < breaker->num_endpoints; i++) {
+		free(breaker->endpoints[i].hostname);
+	}
+	free(breaker->endpoints);
+	free(breaker);
+}
+/* }}} */
+
+/* whether a call may go to hostname; 0 (after logging why) while its
+ * circuit is open, or half-open with as many probes in flight as allowed.
+ * Every call let through must be recorded */
+int yar_breaker_allow(yar_breaker *breaker, const char *hostname) /* {{{ */ {
+	ulong now = yar_breaker_now();
+	yar_breaker_endpoint *endpoint = yar_breaker_endpoint_get(breaker, hostname, now);
+
+	switch (endpoint->info.state) {
+		case YAR_BREAKER_CLOSED:
+			yar_breaker_roll(breaker, endpoint, now);
+			return 1;
+		case YAR_BREAKER_OPEN:
+			if (now < endpoint->open_until) {
+				endpoint->info.rejected++;
+				alog(YAR_ERROR, "Circuit to '%s' is open for another %lums", hostname, endpoint->open_until - now);
+				return 0;
+			}
+			endpoint->info.state = YAR_BREAKER_HALF_OPEN;
+		break;
+	}
+
+	/* a probe that never came back (say it was cancelled) frees its place
+	 * after the open time */
+	if (endpoint->probing && now - endpoint->probe_since >= (ulong)breaker->open_time) {
+		endpoint->probing = 0;
+	}
+	if (endpoint->probing >= (uint)breaker->probes) {
+		endpoint->info.rejected++;
+		alog(YAR_ERROR, "Circuit to '%s' is half-open, waiting for its probes", hostname);
+		return 0;
+	}
+	if (!endpoint->probing++) {
+		endpoint->probe_since = now;
+	}
+	return 1;
+}
+/* }}} */
+
+/* the outcome of a call to hostname: ok unless the server could not be
+ * reached or did not answer properly */
+void yar_breaker_record(yar_breaker *breaker, const char *hostname, int ok) /* {{{ */ {
+	ulong now = yar_breaker_now();
+	yar_breaker_endpoint *endpoint = yar_breaker_endpoint_get(breaker, hostname, now);
+	yar_breaker_info *info = &endpoint->info;
+
+	switch (info->state) {
+		case YAR_BREAKER_OPEN:
+			/* a call let through before it opened */
+			return;
+		case YAR_BREAKER_HALF_OPEN:
+			if (endpoint->probing) {
+				endpoint->probing--;
+			}
+			if (!ok) {
+				info->consecutive++;
+				yar_breaker_open(breaker, endpoint, now);
+				return;
+			}
+			alog(YAR_NOTICE, "Circuit to '%s' closed", hostname);
+			info->state = YAR_BREAKER_CLOSED;
+			info->consecutive = info->calls = info->failures = 0;
+			endpoint->window_start = now;
+			endpoint->probing = 0;
+			return;
+	}
+
+	yar_breaker_roll(breaker, endpoint, now);
+	info->calls++;
+	if (ok) {
+		info->consecutive = 0;
+		return;
+	}
+	info->failures++;
+	info->consecutive++;
+
+	if ((breaker->failures && info->consecutive >= (uint)breaker->failures)
+			|| (breaker->error_rate && info->calls >= (uint)breaker->min_calls
+				&& info->failures * 100 >= info->calls * (uint)breaker->error_rate)) {
+		yar_breaker_open(breaker, endpoint, now);
+	}
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,63 @@
+/**
+ * Yar - Concurrent RPC Server for PHP, C etc
+ *
+ * Copyright (C) 2012-2012 Xinchen Hui <laruence at gmail dot com>
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef YAR_BREAKER_H
+#define YAR_BREAKER_H
+
+#define YAR_BREAKER_CLOSED    0
+#define YAR_BREAKER_OPEN      1
+#define YAR_BREAKER_HALF_OPEN 2
+
+typedef struct _yar_breaker yar_breaker;
+
+typedef enum _yar_breaker_opt {
+	YAR_BREAKER_FAILURES = 1, /* failures in a row that open a circuit, 0 for no limit */
+	YAR_BREAKER_ERROR_RATE,   /* percent of the calls in a window failed that opens a circuit, 0 for no limit */
+	YAR_BREAKER_MIN_CALLS,    /* calls in a window before its error rate counts */
+	YAR_BREAKER_WINDOW,       /* milliseconds the error rate is counted over */
+	YAR_BREAKER_OPEN_TIME,    /* milliseconds an open circuit fails calls before it is probed */
+	YAR_BREAKER_PROBES        /* calls let through at once while half-open */
+} yar_breaker_opt;
+
+/* the circuit to one endpoint */
+typedef struct _yar_breaker_info {
+	int state;          /* YAR_BREAKER_* */
+	uint consecutive;   /* failures in a row */
+	uint calls;         /* in the current window */
+	uint failures;      /* in the current window */
+	ulong opened;       /* times it opened */
+	ulong rejected;     /* calls failed without trying */
+} yar_breaker_info;
+
+yar_breaker * yar_breaker_new(void);
+int yar_breaker_set_opt(yar_breaker *breaker, yar_breaker_opt opt, void *val);
+const void * yar_breaker_get_opt(yar_breaker *breaker, yar_breaker_opt opt);
+int yar_breaker_get_info(yar_breaker *breaker, const char *hostname, yar_breaker_info *info);
+void yar_breaker_destroy(yar_breaker *breaker);
+
+int yar_breaker_allow(yar_breaker *breaker, const char *hostname);
+void yar_breaker_record(yar_breaker *breaker, const char *hostname, int ok);
+#endif
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,363 @@
+/**
+ * Yar - Concurrent RPC Server for PHP, C etc
+ *
+ * Copyright (C) 2012-2012 Xinchen Hui <laruence at gmail dot com>
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>   /* for gettimeofday */
+
+#include "yar_common.h"
+#include "yar_pack.h"
+#include "yar_log.h"
+#include "yar_cache.h"
+
+typedef struct _yar_cache_rule {
+	char *method;
+	int ttl;    /* milliseconds, fresh for so long */
+	int stale;  /* milliseconds after that, kept for when the refresh fails */
+} yar_cache_rule;
+
+typedef struct _yar_cache_entry {
+	char *key;
+	uint len;
+	uint hash;
+	yar_payload payload;  /* the whole response, as received */
+	ulong expires;
+	ulong stale_until;
+	struct _yar_cache_entry *chain;  /* next in the same bucket */
+	struct _yar_cache_entry *prev;   /* more recently used */
+	struct _yar_cache_entry *next;   /* less recently used */
+} yar_cache_entry;
+
+struct _yar_cache {
+	yar_cache_entry **buckets;
+	uint mask;
+	yar_cache_entry *head;  /* most recently used */
+	yar_cache_entry *tail;  /* least recently used, the next evicted */
+	uint num_entries;
+	uint max_entries;
+	yar_cache_rule *rules;
+	uint num_rules;
+	yar_cache_info info;
+};
+
+static ulong yar_cache_now() /* {{{ */ {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (ulong)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+/* }}} */
+
+/* fnv-1a */
+static uint yar_cache_hash(const char *key, uint len) /* {{{ */ {
+	uint hash = 2166136261U;
+
+	while (len--) {
+		hash ^= (unsigned char)*key++;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+/* }}} */
+
+static void yar_cache_unlink(yar_cache *cache, yar_cache_entry *entry) /* {{{ */ {
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		cache->head = entry->next;
+	}
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		cache->tail = entry->prev;
+	}
+	entry->prev = entry->next = NULL;
+}
+/* }}} */
+
+static void yar_cache_push(yar_cache *cache, yar_cache_entry *entry) /* {{{ */ {
+	entry->next = cache->head;
+	if (cache->head) {
+		cache->head->prev = entry;
+	} else {
+		cache->tail = entry;
+	}
+	cache->head = entry;
+}
+/* }}} */
+
+static yar_cache_entry ** yar_cache_slot(yar_cache *cache, const char *key, uint len, uint hash) /* {{{ */ {
+	yar_cache_entry **slot = &cache->buckets[hash & cache->mask];
+
+	while (*slot) {
+		if ((*slot)->hash == hash && (*slot)->len == len && memcmp((*slot)->key, key, len) == 0) {
+			break;
+		}
+		slot = &(*slot)->chain;
+	}
+	return slot;
+}
+/* }}} */
+
+static void yar_cache_drop(yar_cache *cache, yar_cache_entry *entry) /* {{{ */ {
+	yar_cache_entry **slot = yar_cache_slot(cache, entry->key, entry->len, entry->hash);
+
+	*slot = entry->chain;
+	yar_cache_unlink(cache, entry);
+	cache->num_entries--;
+	free(entry->key);
+	free(entry->payload.data);
+	free(entry);
+}
+/* }}} */
+
+static yar_cache_rule * yar_cache_rule_find(yar_cache *cache, const char *method) /* {{{ */ {
+	uint i;
+
+	for (i = 0; i < cache->num_rules; i++) {
+		if (strcmp(cache->rules[i].method, method) == 0) {
+			return &cache->rules[i];
+		}
+	}
+	return NULL;
+}
+/* }}} */
+
+yar_cache * yar_cache_new(uint max_entries) /* {{{ */ {
+	yar_cache *cache;
+	uint size = 16;
+
+	if (!max_entries) {
+		alog(YAR_ERROR, "A cache must hold at least one entry");
+		return NULL;
+	}
+
+	/* about one entry per bucket when full */
+	while (size < max_entries) {
+		size <<= 1;
+	}
+
+	cache = calloc(1, sizeof(yar_cache));
+	cache->buckets = calloc(size, sizeof(yar_cache_entry *));
+	cache->mask = size - 1;
+	cache->max_entries = max_entries;
+
+	return cache;
+}
+/* }}} */
+
+/* methods without a ttl are never cached; setting it again replaces it,
+ * a ttl of 0 stops caching the method */
+int yar_cache_set_ttl(yar_cache *cache, const char *method, int ttl, int stale) /* {{{ */ {
+	yar_cache_rule *rule;
+
+	if (!method || !*method || ttl < 0 || stale < 0) {
+		return 0;
+	}
+
+	if (!(rule = yar_cache_rule_find(cache, method))) {
+		cache->rules = realloc(cache->rules, sizeof(yar_cache_rule) * (cache->num_rules + 1));
+		rule = &cache->rules[cache->num_rules++];
+		rule->method = strdup(method);
+	}
+	rule->ttl = ttl;
+	rule->stale = stale;
+
+	return 1;
+}
+/* }}} */
+
+void yar_cache_get_info(yar_cache *cache, yar_cache_info *info) /* {{{ */ {
+	*info = cache->info;
+	info->entries = cache->num_entries;
+}
+/* }}} */
+
+void yar_cache_clear(yar_cache *cache) /* {{{ */ {
+	while (cache->head) {
+		yar_cache_drop(cache, cache->head);
+	}
+}
+/* }}} */
+
+void yar_cache_destroy(yar_cache *cache) /* {{{ */ {
+	uint i;
+
+	yar_cache_clear(cache);
+	for (i = 0; i < cache->num_rules; i++) {
+		free(cache->rules[i].method);
+	}
+	free(cache->rules);
+	free(cache->buckets);
+	free(cache);
+}
+/* }}} */
+
+/* 0 if the method is not cached; packager is the one of the response, the
+ * parameters are encoded as msgpack whatever it is */
+int yar_cache_key_init(yar_cache *cache, const char *hostname, int packager, const char *method, uint num_args,
+		yar_packager *parameters[], yar_cache_key *key) /* {{{ */ {
+	yar_cache_rule *rule = yar_cache_rule_find(cache, method);
+	yar_payload encoded = {0};
+	yar_packager *array;
+	uint i;
+	int ret;
+
+	if (!rule || !rule->ttl) {
+		return 0;
+	}
+
+	array = yar_pack_start_array(num_args);
+	for (i = 0; i < num_args; i++) {
+		yar_pack_push_packager(array, parameters[i]);
+	}
+	if (!yar_pack_to_string(array, &encoded)) {
+		yar_pack_free(array);
+		return 0;
+	}
+	yar_pack_free(array);
+
+	ret = yar_cache_key_init_encoded(cache, hostname, packager, method, encoded.data, encoded.size, key);
+	free(encoded.data);
+
+	return ret;
+}
+/* }}} */
+
+/* as yar_cache_key_init(), the parameters already msgpack-encoded as one
+ * array, NULL for none */
+int yar_cache_key_init_encoded(yar_cache *cache, const char *hostname, int packager, const char *method,
+		const char *params, uint len, yar_cache_key *key) /* {{{ */ {
+	yar_cache_rule *rule = yar_cache_rule_find(cache, method);
+	uint hlen = strlen(hostname) + 1, mlen = strlen(method) + 1;
+
+	if (!rule || !rule->ttl) {
+		return 0;
+	}
+
+	if (!params) {
+		/* an empty array, as yar_cache_key_init() has it */
+		params = "\x90";
+		len = 1;
+	}
+
+	key->len = hlen + 1 + mlen + len;
+	key->data = malloc(key->len);
+	memcpy(key->data, hostname, hlen);
+	key->data[hlen] = (char)packager;
+	memcpy(key->data + hlen + 1, method, mlen);
+	memcpy(key->data + hlen + 1 + mlen, params, len);
+
+	key->hash = yar_cache_hash(key->data, key->len);
+	key->ttl = rule->ttl;
+	key->stale = rule->stale;
+
+	return 1;
+}
+/* }}} */
+
+void yar_cache_key_free(yar_cache_key *key) /* {{{ */ {
+	free(key->data);
+	key->data = NULL;
+}
+/* }}} */
+
+/* one of YAR_CACHE_*; payload gets a copy of the response, fresh or stale,
+ * the caller frees it. Entries past their stale time are dropped */
+int yar_cache_find(yar_cache *cache, yar_cache_key *key, yar_payload *payload) /* {{{ */ {
+	yar_cache_entry *entry = *yar_cache_slot(cache, key->data, key->len, key->hash);
+	ulong now = yar_cache_now();
+
+	if (entry && entry->stale_until <= now) {
+		yar_cache_drop(cache, entry);
+		entry = NULL;
+	}
+	if (!entry) {
+		cache->info.misses++;
+		return YAR_CACHE_MISS;
+	}
+
+	yar_cache_unlink(cache, entry);
+	yar_cache_push(cache, entry);
+
+	payload->data = malloc(entry->payload.size);
+	payload->size = entry->payload.size;
+	memcpy(payload->data, entry->payload.data, entry->payload.size);
+
+	if (entry->expires <= now) {
+		cache->info.misses++;
+		return YAR_CACHE_STALE;
+	}
+	cache->info.hits++;
+	return YAR_CACHE_FRESH;
+}
+/* }}} */
+
+void yar_cache_served_stale(yar_cache *cache) /* {{{ */ {
+	cache->info.stale_hits++;
+}
+/* }}} */
+
+/* replaces the entry of the key, if any, and evicts the least recently
+ * used one when the cache is full */
+void yar_cache_store(yar_cache *cache, yar_cache_key *key, const yar_payload *payload) /* {{{ */ {
+	yar_cache_entry **slot = yar_cache_slot(cache, key->data, key->len, key->hash);
+	yar_cache_entry *entry = *slot;
+	ulong now = yar_cache_now();
+
+	if (entry) {
+		free(entry->payload.data);
+		yar_cache_unlink(cache, entry);
+	} else {
+		if (cache->num_entries >= cache->max_entries) {
+			yar_cache_drop(cache, cache->tail);
+			cache->info.evictions++;
+			/* the slot may have been the chain of the dropped entry */
+			slot = yar_cache_slot(cache, key->data, key->len, key->hash);
+		}
+		entry = calloc(1, sizeof(yar_cache_entry));
+		entry->key = malloc(key->len);
+		memcpy(entry->key, key->data, key->len);
+		entry->len = key->len;
+		entry->hash = key->hash;
+		*slot = entry;
+		cache->num_entries++;
+	}
+
+	entry->payload.data = malloc(payload->size);
+	entry->payload.size = payload->size;
+	memcpy(entry->payload.data, payload->data, payload->size);
+	entry->expires = now + key->ttl;
+	entry->stale_until = entry->expires + key->stale;
+	yar_cache_push(cache, entry);
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,67 @@
+/**
+ * Yar - Concurrent RPC Server for PHP, C etc
+ *
+ * Copyright (C) 2012-2012 Xinchen Hui <laruence at gmail dot com>
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef YAR_CACHE_H
+#define YAR_CACHE_H
+
+#define YAR_CACHE_MISS  0
+#define YAR_CACHE_FRESH 1
+#define YAR_CACHE_STALE 2
+
+typedef struct _yar_cache yar_cache;
+
+typedef struct _yar_cache_info {
+	uint entries;
+	ulong hits;
+	ulong stale_hits;  /* stale entries served as their refresh failed */
+	ulong misses;
+	ulong evictions;   /* least recently used entries dropped for room */
+} yar_cache_info;
+
+/* a cached call, as the client looks it up */
+typedef struct _yar_cache_key {
+	char *data;        /* host name, packager, method and encoded parameters */
+	uint len;
+	uint hash;
+	int ttl;
+	int stale;
+} yar_cache_key;
+
+yar_cache * yar_cache_new(uint max_entries);
+int yar_cache_set_ttl(yar_cache *cache, const char *method, int ttl, int stale);
+void yar_cache_get_info(yar_cache *cache, yar_cache_info *info);
+void yar_cache_clear(yar_cache *cache);
+void yar_cache_destroy(yar_cache *cache);
+
+int yar_cache_key_init(yar_cache *cache, const char *hostname, int packager, const char *method, uint num_args,
+		yar_packager *parameters[], yar_cache_key *key);
+int yar_cache_key_init_encoded(yar_cache *cache, const char *hostname, int packager, const char *method,
+		const char *params, uint len, yar_cache_key *key);
+int yar_cache_find(yar_cache *cache, yar_cache_key *key, yar_payload *payload);
+void yar_cache_store(yar_cache *cache, yar_cache_key *key, const yar_payload *payload);
+void yar_cache_served_stale(yar_cache *cache);
+void yar_cache_key_free(yar_cache_key *key);
+#endif
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
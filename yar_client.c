@@ -25,10 +25,16 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>  	/* for offsetof */
 #include <sys/types.h>
+#include <sys/time.h>   /* for gettimeofday */
+#include <poll.h>
 #include <sys/socket.h> /* for sockets */
 #include <sys/un.h>  	/* for un */
-#include <netdb.h>  	/* for gethostbyname */
+#include <netinet/in.h>
+#include <netinet/tcp.h> /* for TCP_NODELAY */
+#include "event.h" 		/* for libevent */
 
 #include "yar_common.h"
 #include "yar_pack.h"
@@ -36,356 +42,2017 @@
 #include "yar_protocol.h"
 #include "yar_response.h"
 #include "yar_request.h"
+#include "yar_msgpack.h"
+#include "yar_cache.h"
+#include "yar_resolve.h"
+#include "yar_breaker.h"
 #include "yar_client.h"
 
+struct _yar_call {
+	yar_client *client;
+	unsigned int id;
+	yar_payload payload; /* the request, freed once it is sent */
+	uint bytes_sent;
+	yar_call_callback callback; /* NULL once cancelled */
+	void *data;
+	ulong deadline;             /* milliseconds, 0 for none */
+	int envelope;               /* the payload is a bare {i,m,p}, to be framed when it is sent */
+	uint batch;                 /* calls framed into its request, itself included, if more than 1 */
+	uint control;               /* YAR_PROTOCOL_PING for a ping, 0 for a call */
+	int framed;                 /* it went into the batch request of a call before it */
+	yar_response *answer;       /* its entry of a batch response */
+	yar_call_stats stats;       /* filled in as it goes, if the client has a stats handler */
+	ulong started;              /* microseconds, as the ones below */
+	ulong write_at;
+	ulong sent_at;
+	struct _yar_call *next; /* in client->pending */
+};
+
+/* the asynchronous side of a client: requests are written out in the order
+ * they were made, as fast as the socket takes them, and answers are matched
+ * to the calls by id as they come back */
+struct _yar_client_io {
+	struct event_base *base;
+	struct event ev_read;
+	struct event ev_write;
+	struct event ev_batch; /* the batch window */
+	int read_added;
+	int write_added;
+	int batch_added;
+	int connecting;
+	ulong read_until;  /* when the waits time out, in milliseconds */
+	ulong write_until;
+	ulong connect_at;  /* microseconds, as the one below */
+	ulong first_byte_at;
+	yar_call *last;    /* the tail of client->pending */
+	yar_call *sending; /* the first call in client->pending not sent completely */
+	char header_buf[sizeof(yar_header)];
+	uint header_read;
+	uint total_read;
+	yar_response *response; /* being read */
+};
+
+static unsigned int yar_client_next_id(yar_client *client) /* {{{ */ {
+	if (!++client->sequence) {
+		/* 0 means no id check to yar_client_unpack() */
+		++client->sequence;
+	}
+	return client->sequence;
+}
+/* }}} */
+
+static void yar_call_free(yar_call *call) /* {{{ */ {
+	if (call->payload.data) {
+		free(call->payload.data);
+	}
+	if (call->answer) {
+		yar_response_free(call->answer);
+		free(call->answer);
+	}
+	if (call->stats.method) {
+		free((char *)call->stats.method);
+	}
+	free(call);
+}
+/* }}} */
+
+/* take the calls in progress out of the client, returns the list of them */
+static yar_call * yar_client_io_reset(yar_client *client) /* {{{ */ {
+	yar_client_io *io = client->io;
+	yar_call *calls = client->pending;
+
+	if (io->read_added) {
+		event_del(&io->ev_read);
+		io->read_added = 0;
+	}
+	if (io->write_added) {
+		event_del(&io->ev_write);
+		io->write_added = 0;
+	}
+	if (io->batch_added) {
+		event_del(&io->ev_batch);
+		io->batch_added = 0;
+	}
+	if (io->response) {
+		yar_response_free(io->response);
+		free(io->response);
+		io->response = NULL;
+	}
+	io->header_read = 0;
+	io->last = io->sending = NULL;
+	client->pending = NULL;
+
+	return calls;
+}
+/* }}} */
+
 static void yar_client_hangup(yar_client *client) /* {{{ */ {
 	if (client->fd > 0) {
 		close(client->fd);
 	}
-	client->fd = 0;
+	client->fd = 0;
+	/* the next connection may be to another server */
+	client->compress_peer = 0;
+}
+/* }}} */
+
+void yar_client_destroy(yar_client *client) /* {{{ */ {
+	if (client->io) {
+		/* calls in progress are dropped, their callbacks are not called */
+		yar_call *call = yar_client_io_reset(client);
+		while (call) {
+			yar_call *next = call->next;
+			yar_call_free(call);
+			call = next;
+		}
+		free(client->io);
+	}
+	yar_client_hangup(client);
+	free(client);
+}
+/* }}} */
+
+/* wait for the fd to become readable (for_read = 1) or writable (for_read = 0)
+   for timeout milliseconds, returns the poll() status. poll(), unlike select(),
+   takes any fd number, a process may hold far more than FD_SETSIZE sockets */
+static int yar_client_wait(int fd, int for_read, int timeout) /* {{{ */ {
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = for_read? POLLIN : POLLOUT;
+	pfd.revents = 0;
+
+	/* an error or a hangup counts as ready, the recv() or send() tells which */
+	return poll(&pfd, 1, timeout);
+}
+/* }}} */
+
+static ulong yar_client_now() /* {{{ */ {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (ulong)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+/* }}} */
+
+/* in microseconds, for the timings of calls */
+static ulong yar_client_clock() /* {{{ */ {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (ulong)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+/* }}} */
+
+/* the absolute deadline of a call starting now, 0 if it has none */
+static ulong yar_client_deadline(yar_client *client) /* {{{ */ {
+	return client->deadline? yar_client_now() + client->deadline : 0;
+}
+/* }}} */
+
+/* the addresses to connect to: the socket path, or what the host resolves
+ * to (see yar_resolve()) */
+static uint yar_client_addresses(yar_client *client, yar_address *addrs) /* {{{ */ {
+	char *hostname = client->hostname, host[1024];
+	int port;
+
+	if (hostname[0] == '/') {
+		/* unix domain socket */
+		struct sockaddr_un *usa = (struct sockaddr_un *)&addrs[0].sa;
+
+		if (strlen(hostname) >= sizeof(usa->sun_path)) {
+			alog(YAR_ERROR, "Unix socket path too long '%s'", hostname);
+			return 0;
+		}
+		bzero(&addrs[0], sizeof(yar_address));
+		usa->sun_family = AF_UNIX;
+		memcpy(usa->sun_path, hostname, strlen(hostname) + 1);
+		addrs[0].len = SUN_LEN(usa);
+		return 1;
+	}
+
+	if (!yar_resolve_split(hostname, host, sizeof(host), &port)) {
+		return 0;
+	}
+	return yar_resolve(host, port, 0, addrs, YAR_RESOLVE_MAX_ADDRS);
+}
+/* }}} */
+
+/* a non-blocking connect to addr into *fd; 1 connected, 0 in progress, -1
+ * failed (the socket is closed then) */
+static int yar_client_socket(yar_address *addr, int *fd) /* {{{ */ {
+	int sockfd, family = addr->sa.ss_family;
+
+	if ((sockfd = socket(family, SOCK_STREAM, 0)) == -1) {
+		alog(YAR_ERROR, "Failed to create a socket '%s'", strerror(errno));
+		return -1;
+	}
+	if (family != AF_UNIX) {
+		int val = 1;
+
+		setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (char*)&val, sizeof(val));
+		/* a request goes out in one send, do not hold its tail back */
+		setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, (char*)&val, sizeof(val));
+	}
+	yar_set_non_blocking(sockfd);
+	*fd = sockfd;
+
+	if (connect(sockfd, (const struct sockaddr *)&addr->sa, addr->len) == 0) {
+		return 1;
+	} else if (errno == EINPROGRESS) {
+		return 0;
+	}
+
+	alog(YAR_ERROR, "Failed to connect to host '%s'", strerror(errno));
+	close(sockfd);
+	return -1;
+}
+/* }}} */
+
+/* start connecting, for the event loop to wait on; the addresses are tried
+ * in turn until one does not fail at once. 1 connected, 0 in progress, -1
+ * failed */
+static int yar_client_connect_start(yar_client *client) /* {{{ */ {
+	yar_address addrs[YAR_RESOLVE_MAX_ADDRS];
+	uint count = yar_client_addresses(client, addrs), i;
+	int status;
+
+	client->connects++;
+	for (i = 0; i < count; i++) {
+		if ((status = yar_client_socket(&addrs[i], &client->fd)) >= 0) {
+			return status;
+		}
+	}
+	client->fd = 0;
+
+	return -1;
+}
+/* }}} */
+
+/* how a connect in progress ended, once the socket turned writable */
+static int yar_client_connect_result(yar_client *client) /* {{{ */ {
+	int error = 0;
+	socklen_t len = sizeof(error);
+
+	if (getsockopt(client->fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1) {
+		error = errno;
+	}
+	if (error) {
+		alog(YAR_ERROR, "Failed to connect to host '%s'", strerror(error));
+		yar_client_hangup(client);
+		return 0;
+	}
+
+	return 1;
+}
+/* }}} */
+
+/* happy eyeballs (RFC 8305): the addresses are raced, the next one is
+ * started when the ones in flight did not connect within
+ * YAR_CONNECT_ATTEMPT_DELAY, or at once when one failed; the first to
+ * connect wins, the others are closed */
+static int yar_client_connect_race(yar_client *client, yar_address *addrs, uint count, int timeout) /* {{{ */ {
+	struct pollfd pfds[YAR_RESOLVE_MAX_ADDRS];
+	ulong start = yar_client_now(), next_at = start, now;
+	uint started = 0, live = 0, i;
+	int winner = -1;
+
+	while (winner < 0 && (now = yar_client_now()) - start < (ulong)timeout) {
+		int wait = timeout - (now - start), status;
+
+		if (started < count && (!live || now >= next_at)) {
+			int fd;
+
+			status = yar_client_socket(&addrs[started++], &fd);
+			if (status == 1) {
+				winner = fd;
+			} else if (status == 0) {
+				pfds[live].fd = fd;
+				pfds[live].events = POLLOUT;
+				pfds[live].revents = 0;
+				live++;
+				next_at = now + YAR_CONNECT_ATTEMPT_DELAY;
+			}
+			continue;
+		}
+		if (!live) {
+			break;
+		}
+
+		if (started < count && next_at - now < (ulong)wait) {
+			wait = next_at - now;
+		}
+		if ((status = poll(pfds, live, wait)) == -1 && errno != EINTR) {
+			alog(YAR_ERROR, "Failed to connect to host '%s'", strerror(errno));
+			break;
+		}
+
+		for (i = 0; status > 0 && i < live; ) {
+			int error = 0;
+			socklen_t len = sizeof(error);
+
+			if (!pfds[i].revents) {
+				i++;
+				continue;
+			}
+			if (getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1) {
+				error = errno;
+			}
+			if (!error) {
+				winner = pfds[i].fd;
+			} else {
+				alog(YAR_DEBUG, "Failed to connect to host '%s'", strerror(error));
+				close(pfds[i].fd);
+				/* a failed attempt lets the next one start right away */
+				next_at = 0;
+			}
+			pfds[i] = pfds[--live];
+			if (winner >= 0) {
+				break;
+			}
+		}
+	}
+
+	for (i = 0; i < live; i++) {
+		close(pfds[i].fd);
+	}
+	if (winner < 0) {
+		if (started < count || live) {
+			alog(YAR_ERROR, "Connect to '%s' timeout", client->hostname);
+		} else {
+			alog(YAR_ERROR, "Failed to connect to '%s'", client->hostname);
+		}
+		return 0;
+	}
+	client->fd = winner;
+
+	return 1;
+}
+/* }}} */
+
+/* connect, for at most the connect timeout and never past the deadline */
+static int yar_client_connect_until(yar_client *client, ulong deadline) /* {{{ */ {
+	int timeout = client->connect_timeout? client->connect_timeout : 1000;
+	yar_address addrs[YAR_RESOLVE_MAX_ADDRS];
+	uint count;
+
+	if (client->fd > 0) {
+		return 1;
+	}
+
+	if (deadline) {
+		ulong now = yar_client_now();
+		if (deadline <= now) {
+			timeout = 0;
+		} else if (deadline - now < (ulong)timeout) {
+			timeout = deadline - now;
+		}
+	}
+
+	client->connects++;
+	if (!(count = yar_client_addresses(client, addrs))) {
+		return 0;
+	}
+
+	/* an unreachable host would otherwise take the kernel's SYN retries */
+	return yar_client_connect_race(client, addrs, count, timeout);
+}
+/* }}} */
+
+int yar_client_connect(yar_client *client) /* {{{ */ {
+	return yar_client_connect_until(client, 0);
+}
+/* }}} */
+
+/* a cheap check that an idle connection is still good, the server closes
+ * keep-alive connections after its read timeout; nothing is sent */
+int yar_client_alive(yar_client *client) /* {{{ */ {
+	char c;
+	int bytes;
+
+	if (client->fd <= 0) {
+		return 0;
+	}
+	if (client->pending) {
+		return 1;
+	}
+
+	do {
+		bytes = recv(client->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	} while (bytes == -1 && errno == EINTR);
+
+	/* EOF, an error, or bytes nobody asked for */
+	if (bytes != -1 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+		yar_client_hangup(client);
+		return 0;
+	}
+
+	return 1;
+}
+/* }}} */
+
+/* a client from yar_client_new() connects on its first call, a persistent
+ * one connects again on the next call after it lost its connection (also
+ * to the server closing it while idle), backing off while that fails.
+ * Returns whether the client has to connect now, 0 if it is connected, -1
+ * (after logging why) if it may not */
+static int yar_client_must_connect(yar_client *client) /* {{{ */ {
+	int reconnect = client->persistent && client->reconnect_backoff >= 0;
+	ulong now;
+
+	if (client->fd > 0) {
+		if (!reconnect || client->pending || yar_client_alive(client)) {
+			return 0;
+		}
+		alog(YAR_DEBUG, "Connection to '%s' closed by the server", client->hostname);
+	} else if (client->connects && !reconnect) {
+		alog(YAR_ERROR, "Client is not connected");
+		return -1;
+	}
+
+	now = yar_client_now();
+	if (now < client->retry_at) {
+		alog(YAR_ERROR, "Not reconnecting to '%s' for another %lums", client->hostname, client->retry_at - now);
+		return -1;
+	}
+
+	return 1;
+}
+/* }}} */
+
+static void yar_client_connect_done(yar_client *client, int connected) /* {{{ */ {
+	ulong backoff;
+	uint i;
+
+	if (connected) {
+		client->connect_failures = 0;
+		client->retry_at = 0;
+		return;
+	}
+
+	backoff = client->reconnect_backoff? client->reconnect_backoff : 100;
+	for (i = 0; i < client->connect_failures && backoff < YAR_RECONNECT_MAX_BACKOFF; i++) {
+		backoff *= 2;
+	}
+	if (backoff > YAR_RECONNECT_MAX_BACKOFF && (ulong)client->reconnect_backoff < YAR_RECONNECT_MAX_BACKOFF) {
+		backoff = YAR_RECONNECT_MAX_BACKOFF;
+	}
+	client->connect_failures++;
+	client->retry_at = yar_client_now() + backoff;
+}
+/* }}} */
+
+/* connect without waiting, for an event loop to wait on client->fd: 1
+ * connected, 0 in progress (call yar_client_connect_end() once the fd is
+ * writable), -1 failed */
+int yar_client_connect_begin(yar_client *client) /* {{{ */ {
+	int status = yar_client_connect_start(client);
+
+	if (status == -1) {
+		alog(YAR_ERROR, "Failed to connect to '%s'", client->hostname);
+		yar_client_connect_done(client, 0);
+	} else if (status) {
+		yar_client_connect_done(client, 1);
+	}
+
+	return status;
+}
+/* }}} */
+
+int yar_client_connect_end(yar_client *client) /* {{{ */ {
+	int connected = yar_client_connect_result(client);
+
+	yar_client_connect_done(client, connected);
+
+	return connected;
+}
+/* }}} */
+
+static int yar_client_ready(yar_client *client, ulong deadline) /* {{{ */ {
+	int connected;
+
+	switch (yar_client_must_connect(client)) {
+		case 0:
+			return 1;
+		case -1:
+			return 0;
+	}
+
+	connected = yar_client_connect_until(client, deadline);
+	yar_client_connect_done(client, connected);
+
+	return connected;
+}
+/* }}} */
+
+/* yar_client_wait() for the read or write timeout, but never past the
+ * deadline of the call; returns 0 (after logging why) if the fd did not get
+ * ready in time */
+static int yar_client_await(yar_client *client, int for_read, ulong deadline) /* {{{ */ {
+	int timeout = for_read? client->read_timeout : client->write_timeout;
+	int wait, status;
+
+	timeout = timeout? timeout : 1000; /* default 1 second */
+	while (1) {
+		wait = timeout;
+		if (deadline) {
+			ulong now = yar_client_now();
+			if (now >= deadline) {
+				alog(YAR_ERROR, "Call deadline exceeded");
+				return 0;
+			}
+			if (deadline - now < (ulong)wait) {
+				wait = deadline - now;
+			}
+		}
+
+		if ((status = yar_client_wait(client->fd, for_read, wait)) > 0) {
+			return 1;
+		} else if (status == 0) {
+			if (wait < timeout) {
+				/* it was the deadline */
+				continue;
+			}
+			alog(YAR_ERROR, for_read? "Read response timeout" : "Send request timeout");
+			return 0;
+		} else if (errno != EINTR) {
+			alog(YAR_ERROR, "Poll for client failed '%s'", strerror(errno));
+			return 0;
+		}
+	}
+}
+/* }}} */
+
+/* send a whole request out, returns 0 (after logging why) if that failed */
+static int yar_client_send(yar_client *client, yar_payload *payload, ulong deadline) /* {{{ */ {
+	int bytes_sent;
+	uint bytes_left = payload->size, offset = 0;
+
+	while (bytes_left) {
+		if (!yar_client_await(client, 0, deadline)) {
+			return 0;
+		}
+
+		do {
+			bytes_sent = send(client->fd, payload->data + offset, bytes_left, 0);
+		} while (bytes_sent == -1 && errno == EINTR);
+
+		if (bytes_sent == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				continue;
+			}
+			alog(YAR_ERROR, "Send request failed '%s'", strerror(errno));
+			return 0;
+		}
+
+		offset += bytes_sent;
+		bytes_left -= bytes_sent;
+	}
+
+	return 1;
+}
+/* }}} */
+
+/* validate a received response header and make room for the body after it */
+static int yar_client_response_header(yar_response *response, char *header_buf) /* {{{ */ {
+	yar_header *response_header = (yar_header *)header_buf;
+
+	if (!yar_protocol_parse(response_header)) {
+		alog(YAR_ERROR, "Parsing response header failed, maybe not responsed by a rpc server?");
+		return 0;
+	}
+
+	if (response_header->body_len > YAR_MAX_BODY_SIZE) {
+		alog(YAR_ERROR, "Response body too large %u", response_header->body_len);
+		return 0;
+	}
+
+	response->payload.data = malloc(sizeof(yar_header) + response_header->body_len);
+	response->payload.size = sizeof(yar_header) + response_header->body_len;
+	memcpy(response->payload.data, header_buf, sizeof(yar_header));
+
+	return 1;
+}
+/* }}} */
+
+/* a decoder of the msgpack body of a response, behind its packager tag */
+static yar_msgpack_stream * yar_client_stream(yar_client *client, yar_response *response) /* {{{ */ {
+	uint offset = sizeof(yar_header) + sizeof(YAR_PACKAGER);
+	yar_msgpack_stream *stream;
+
+	if (response->payload.size <= offset || !(stream = yar_msgpack_stream_new(response->payload.size - offset))) {
+		return NULL;
+	}
+	if (client->elements.callback) {
+		yar_msgpack_stream_watch(stream, "r", client->elements.callback, client->elements.data);
+	}
+	return stream;
+}
+/* }}} */
+
+/* give the stream the body bytes from..to of the payload, the packager tag
+ * excepted */
+static void yar_client_stream_feed(yar_msgpack_stream *stream, yar_response *response, uint from, uint to) /* {{{ */ {
+	uint offset = sizeof(yar_header) + sizeof(YAR_PACKAGER);
+
+	from = from < offset? offset : from;
+	if (to > from) {
+		yar_msgpack_stream_feed(stream, response->payload.data + from, to - from);
+	}
+}
+/* }}} */
+
+/* read a whole response into response->payload, its header (parsed, in host
+ * order) first; returns 0 (after logging why) if that failed. With stream,
+ * a msgpack body is decoded into *stream as it arrives, so the value is
+ * ready soon after the last byte. With stats, the time to the first byte,
+ * the transfer and the bytes read are recorded */
+static int yar_client_receive(yar_client *client, yar_response *response, ulong deadline, yar_msgpack_stream **stream,
+		yar_call_stats *stats) /* {{{ */ {
+	int bytes_read;
+	uint total_read, header_read;
+	char header_buf[sizeof(yar_header)];
+	ulong start = stats? yar_client_clock() : 0, first = 0;
+
+	/* read the response header, it may arrive in several segments */
+	header_read = 0;
+	while (header_read < sizeof(yar_header)) {
+		if (!yar_client_await(client, 1, deadline)) {
+			return 0;
+		}
+
+		do {
+			bytes_read = recv(client->fd, header_buf + header_read, sizeof(yar_header) - header_read, 0);
+		} while (bytes_read == -1 && errno == EINTR);
+
+		if (bytes_read == 0) {
+			alog(YAR_ERROR, "Server closed connection prematurely");
+			return 0;
+		} else if (bytes_read == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				continue;
+			}
+			alog(YAR_ERROR, "Failed read response '%s'", strerror(errno));
+			return 0;
+		}
+
+		if (stats) {
+			if (!first) {
+				first = yar_client_clock();
+				stats->first_byte = first - start;
+			}
+			stats->bytes_received += bytes_read;
+		}
+		header_read += bytes_read;
+	}
+
+	if (!yar_client_response_header(response, header_buf)) {
+		return 0;
+	}
+	total_read = sizeof(yar_header);
+	if (stream && !(((yar_header *)header_buf)->reserved & YAR_PROTOCOL_COMPRESSED)) {
+		*stream = yar_client_stream(client, response);
+	}
+
+	/* read the response body */
+	while (total_read < response->payload.size) {
+		if (!yar_client_await(client, 1, deadline)) {
+			return 0;
+		}
+
+		do {
+			bytes_read = recv(client->fd, response->payload.data + total_read, response->payload.size - total_read, 0);
+		} while (bytes_read == -1 && errno == EINTR);
+
+		if (bytes_read == 0) {
+			alog(YAR_ERROR, "Lost connection to server");
+			return 0;
+		} else if (bytes_read == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				continue;
+			}
+			alog(YAR_ERROR, "Failed read response '%s'", strerror(errno));
+			return 0;
+		}
+
+		if (stream && *stream) {
+			yar_client_stream_feed(*stream, response, total_read, total_read + bytes_read);
+		}
+		if (stats) {
+			stats->bytes_received += bytes_read;
+		}
+		total_read += bytes_read;
+	}
+
+	if (stats) {
+		stats->transfer = yar_client_clock() - first;
+	}
+	return 1;
+}
+/* }}} */
+
+/* inflate a compressed response body in place, its header then reads as if
+ * it never was; a server that takes compressed requests says so in every
+ * answer to a client that does */
+static int yar_client_inflate(yar_client *client, yar_response *response) /* {{{ */ {
+	yar_header *header = (yar_header *)response->payload.data;
+
+	if (header->reserved & YAR_PROTOCOL_ACCEPT_COMPRESSED) {
+		client->compress_peer = 1;
+	}
+	if (!(header->reserved & YAR_PROTOCOL_COMPRESSED)) {
+		return 1;
+	}
+
+	if (!yar_protocol_decompress(&response->payload, sizeof(yar_header) + sizeof(YAR_PACKAGER), YAR_MAX_BODY_SIZE)) {
+		alog(YAR_ERROR, "Failed to decompress response body");
+		return 0;
+	}
+	header = (yar_header *)response->payload.data;
+	header->reserved &= ~YAR_PROTOCOL_COMPRESSED;
+	header->body_len = response->payload.size - sizeof(yar_header);
+
+	return 1;
+}
+/* }}} */
+
+static int yar_client_check_tag(yar_client *client, yar_response *response) /* {{{ */ {
+	char *tag = response->payload.data + sizeof(yar_header);
+
+	if (response->payload.size < sizeof(yar_header) + sizeof(YAR_PACKAGER)) {
+		alog(YAR_ERROR, "Response has no body");
+		return 0;
+	}
+
+	if (client->packager == YAR_PACKAGER_JSON) {
+		if (strncmp(tag, YAR_PACKAGER_JSON_TAG, sizeof(YAR_PACKAGER_JSON_TAG) - 1) != 0) {
+			alog(YAR_ERROR, "Response packager is not JSON");
+			return 0;
+		}
+	} else if (strncmp(tag, YAR_PACKAGER, sizeof(YAR_PACKAGER) - 1) != 0) {
+		alog(YAR_ERROR, "Response packager is not msgpack");
+		return 0;
+	}
+
+	return 1;
+}
+/* }}} */
+
+/* check the packager tag of a received response, unpack its body and make
+ * sure it answers request_id (0 to skip that, the body may not carry one) */
+/* stream, if any, has decoded the body while it was read; else it is
+ * decoded here, a msgpack one by a stream too if the elements of the
+ * result are called back */
+static int yar_client_unpack(yar_client *client, yar_response *response, unsigned int request_id, yar_msgpack_stream *stream) /* {{{ */ {
+	yar_msgpack_stream *own = NULL;
+	int unpacked;
+
+	if (!yar_client_check_tag(client, response) || !yar_client_inflate(client, response)) {
+		return 0;
+	}
+
+	if (!stream && client->elements.callback && client->packager == YAR_PACKAGER_MSGPACK
+			&& (own = stream = yar_client_stream(client, response))) {
+		yar_client_stream_feed(stream, response, 0, response->payload.size);
+	}
+
+	if (stream) {
+		yar_data *root = yar_msgpack_stream_take(stream);
+
+		unpacked = root && yar_response_unpack_data(response, root);
+		if (own) {
+			yar_msgpack_stream_free(own);
+		}
+	} else {
+		unpacked = yar_response_unpack(response, response->payload.data, response->payload.size, sizeof(yar_header) + sizeof(YAR_PACKAGER), (yar_packager_type)client->packager);
+	}
+	if (!unpacked) {
+		alog(YAR_ERROR, "Unpack response failed");
+		return 0;
+	}
+
+	if (request_id && response->id != (long)request_id) {
+		alog(YAR_ERROR, "Response id mismatch, expect %u, got %ld", request_id, response->id);
+		return 0;
+	}
+
+	return 1;
+}
+/* }}} */
+
+/* the {i,m,p} envelope of a call into payload, after extra_bytes left for
+ * the caller to fill */
+static int yar_client_envelope(yar_client *client, unsigned int request_id, char *method, uint num_args, yar_packager *parameters[],
+		yar_payload *payload, int extra_bytes) /* {{{ */ {
+	yar_request  *request;
+
+	request = calloc(1, sizeof(yar_request));
+	request->id = request_id;
+	request->method = strdup(method);
+	request->mlen = strlen(method);
+	if (num_args) {
+		uint i;
+		yar_packager *packager = yar_pack_start_array(num_args);
+		for (i = 0; i < num_args; i++) {
+			yar_pack_push_packager(packager, parameters[i]);
+		}
+		yar_request_set_parameters(request, packager);
+		yar_pack_free(packager);
+	}
+
+	if (!yar_request_pack(request, payload, extra_bytes, (yar_packager_type)client->packager)) {
+		alog(YAR_ERROR, "Packing request failed");
+		yar_request_free(request);
+		free(request);
+		return 0;
+	}
+	yar_request_free(request);
+	free(request);
+
+	return 1;
+}
+/* }}} */
+
+/* the header and packager tag in front of a body, flags are YAR_PROTOCOL_*.
+ * With compression on, the server is told it may compress its answer, and
+ * a large body is compressed once the server said it takes that */
+static void yar_client_frame(yar_client *client, unsigned int request_id, yar_payload *payload, uint flags) /* {{{ */ {
+	uint offset = sizeof(yar_header) + sizeof(YAR_PACKAGER);
+	yar_header header = {0};
+
+	if (client->persistent) {
+		flags |= YAR_PROTOCOL_PERSISTENT;
+	}
+	if (client->compress_threshold) {
+		flags |= YAR_PROTOCOL_ACCEPT_COMPRESSED;
+		if (client->compress_peer && payload->size - offset >= (uint)client->compress_threshold
+				&& yar_protocol_compress(payload, offset)) {
+			flags |= YAR_PROTOCOL_COMPRESSED;
+		}
+	}
+	yar_protocol_render(&header, request_id, YAR_CLIENT_NAME, NULL, payload->size - sizeof(yar_header), flags);
+
+	memcpy(payload->data, (char *)&header, sizeof(yar_header));
+	memcpy(payload->data + sizeof(yar_header), client->packager == YAR_PACKAGER_JSON? YAR_PACKAGER_JSON_TAG : YAR_PACKAGER, sizeof(YAR_PACKAGER));
+}
+/* }}} */
+
+/* build the whole request (header, packager tag and body) into payload */
+static int yar_client_pack(yar_client *client, unsigned int request_id, char *method, uint num_args, yar_packager *parameters[], yar_payload *payload) /* {{{ */ {
+	if (!yar_client_envelope(client, request_id, method, num_args, parameters, payload, sizeof(yar_header) + sizeof(YAR_PACKAGER))) {
+		return 0;
+	}
+	yar_client_frame(client, request_id, payload, 0);
+
+	return 1;
+}
+/* }}} */
+
+/* tell the stats handler about a call that is done, if it had one when
+ * the call started */
+static void yar_client_report(yar_stats_handler *handler, yar_call_stats *stats, int ok, ulong started) /* {{{ */ {
+	if (handler->callback && started) {
+		stats->ok = ok;
+		stats->total = yar_client_clock() - started;
+		handler->callback(stats, handler->data);
+	}
+}
+/* }}} */
+
+/* tell the breaker (if any) how a call it let through went */
+static void yar_client_outcome(yar_client *client, int ok) /* {{{ */ {
+	if (client->breaker) {
+		yar_breaker_record(client->breaker, client->hostname, ok);
+	}
+}
+/* }}} */
+
+/* send a packed request and read the answer to it, payload is taken over */
+static yar_response * yar_client_exchange(yar_client *client, char *method, unsigned int request_id, yar_payload *payload) /* {{{ */ {
+	ulong deadline = yar_client_deadline(client);
+	yar_msgpack_stream *stream = NULL;
+	yar_response *response = NULL;
+	yar_call_stats stats = {0}, *timed = client->stats.callback? &stats : NULL;
+	ulong started = timed? yar_client_clock() : 0, mark = started;
+	int must;
+
+	stats.method = method;
+	stats.id = request_id;
+	stats.batch = 1;
+
+	if (client->pending) {
+		alog(YAR_ERROR, "Client has asynchronous calls in progress");
+		free(payload->data);
+		return NULL;
+	}
+
+	/* refused by the client itself (not connected, backing off), nothing
+	 * was tried, so it is not a call for the breaker either */
+	if ((must = yar_client_must_connect(client)) == -1
+			|| (client->breaker && !yar_breaker_allow(client->breaker, client->hostname))) {
+		free(payload->data);
+		yar_client_report(&client->stats, &stats, 0, started);
+		return NULL;
+	}
+
+	if (must) {
+		int connected = yar_client_connect_until(client, deadline);
+
+		yar_client_connect_done(client, connected);
+		if (!connected) {
+			free(payload->data);
+			yar_client_outcome(client, 0);
+			stats.connect = timed? yar_client_clock() - started : 0;
+			yar_client_report(&client->stats, &stats, 0, started);
+			return NULL;
+		}
+	}
+
+	if (timed) {
+		stats.connect = (mark = yar_client_clock()) - started;
+	}
+	if (!yar_client_send(client, payload, deadline)) {
+		goto error;
+	}
+	if (timed) {
+		stats.write = yar_client_clock() - mark;
+		stats.bytes_sent = payload->size;
+	}
+
+	free(payload->data);
+	payload->data = NULL;
+
+	response = calloc(1, sizeof(yar_response));
+	if (!yar_client_receive(client, response, deadline, client->packager == YAR_PACKAGER_MSGPACK? &stream : NULL, timed)) {
+		goto error;
+	}
+	mark = timed? yar_client_clock() : 0;
+	if (!yar_client_unpack(client, response, request_id, stream)) {
+		goto error;
+	}
+	if (timed) {
+		stats.decode = yar_client_clock() - mark;
+	}
+	if (stream) {
+		yar_msgpack_stream_free(stream);
+	}
+
+	yar_client_outcome(client, 1);
+	yar_client_report(&client->stats, &stats, 1, started);
+	return response;
+
+error:
+	yar_client_outcome(client, 0);
+	yar_client_report(&client->stats, &stats, 0, started);
+	if (stream) {
+		yar_msgpack_stream_free(stream);
+	}
+	if (payload->data) {
+		free(payload->data);
+	}
+	if (response) {
+		yar_response_free(response);
+		free(response);
+	}
+	/* the stream can not be trusted anymore, do not let further calls reuse it */
+	yar_client_hangup(client);
+	return NULL;
+}
+/* }}} */
+
+static yar_response * yar_client_request(yar_client *client, char *method, uint num_args, yar_packager *parameters[]) /* {{{ */ {
+	unsigned int request_id = yar_client_next_id(client);
+	yar_payload payload = {0};
+
+	if (!yar_client_pack(client, request_id, method, num_args, parameters, &payload)) {
+		return NULL;
+	}
+
+	return yar_client_exchange(client, method, request_id, &payload);
+}
+/* }}} */
+
+/* a response rebuilt from a cached one, payload is taken over */
+static yar_response * yar_client_cached(yar_client *client, yar_payload *payload) /* {{{ */ {
+	yar_response *response = calloc(1, sizeof(yar_response));
+
+	response->payload = *payload;
+	if (!yar_client_unpack(client, response, 0, NULL)) {
+		yar_response_free(response);
+		free(response);
+		return NULL;
+	}
+	return response;
+}
+/* }}} */
+
+/* once a cached method went to the server: a good response is stored, a
+ * failed call is answered by the stale copy in payload (if any). The key
+ * and payload are released */
+static yar_response * yar_client_cache_settle(yar_client *client, char *method, yar_cache_key *key, int found,
+		yar_payload *payload, yar_response *response) /* {{{ */ {
+	if (response) {
+		/* errors are not cached, the next call tries again */
+		if (response->status == 0) {
+			yar_cache_store(client->cache, key, &response->payload);
+		}
+		free(payload->data);
+	} else if (found == YAR_CACHE_STALE) {
+		alog(YAR_WARNING, "Refreshing '%s' failed, serving the cached response", method);
+		yar_cache_served_stale(client->cache);
+		response = yar_client_cached(client, payload);
+	}
+	yar_cache_key_free(key);
+
+	return response;
+}
+/* }}} */
+
+/* a fresh cached response is returned without any I/O; a stale one only if
+ * its refresh fails, while the stale time lasts */
+static yar_response * yar_client_caller(yar_client *client, char *method, uint num_args, yar_packager *parameters[]) /* {{{ */ {
+	yar_payload payload = {0};
+	yar_response *response;
+	yar_cache_key key;
+	int found;
+
+	if (!client->cache || !yar_cache_key_init(client->cache, client->hostname, client->packager, method, num_args, parameters, &key)) {
+		return yar_client_request(client, method, num_args, parameters);
+	}
+
+	found = yar_cache_find(client->cache, &key, &payload);
+	if (found == YAR_CACHE_FRESH) {
+		yar_cache_key_free(&key);
+		return yar_client_cached(client, &payload);
+	}
+
+	response = yar_client_request(client, method, num_args, parameters);
+	return yar_client_cache_settle(client, method, &key, found, &payload, response);
+}
+/* }}} */
+
+/* the msgpack body of a request re-encoded as JSON, for a client set to
+ * the JSON packager */
+static int yar_client_transcode(yar_payload *payload) /* {{{ */ {
+	uint extra_bytes = sizeof(yar_header) + sizeof(YAR_PACKAGER);
+	yar_data *envelope = yar_data_unpack(payload->data + extra_bytes, payload->size - extra_bytes, YAR_PACKAGER_MSGPACK);
+	yar_payload json = {0};
+	char *data;
+
+	if (!envelope || !yar_data_pack(envelope, &json, YAR_PACKAGER_JSON)) {
+		if (envelope) {
+			yar_data_free(envelope);
+		}
+		return 0;
+	}
+	yar_data_free(envelope);
+
+	if (!(data = realloc(payload->data, extra_bytes + json.size))) {
+		free(json.data);
+		return 0;
+	}
+	memcpy(data + extra_bytes, json.data, json.size);
+	payload->data = data;
+	payload->size = extra_bytes + json.size;
+	free(json.data);
+
+	return 1;
+}
+/* }}} */
+
+static yar_response * yar_client_send_packed(yar_client *client, char *method, unsigned int request_id, yar_payload *payload) /* {{{ */ {
+	if (client->packager == YAR_PACKAGER_JSON && !yar_client_transcode(payload)) {
+		alog(YAR_ERROR, "Packing request failed");
+		free(payload->data);
+		return NULL;
+	}
+	yar_client_frame(client, request_id, payload, 0);
+
+	return yar_client_exchange(client, method, request_id, payload);
+}
+/* }}} */
+
+/* a call packed by yar_msgpack_encode_call*(), its parameters at
+ * params_offset of payload; as yar_client_caller() for the cache, the key
+ * is taken from the encoded parameters */
+static yar_response * yar_client_call_packed(yar_client *client, char *method, unsigned int request_id,
+		yar_payload *payload, uint params_offset) /* {{{ */ {
+	char *params = payload->data + params_offset;
+	uint len = payload->size - params_offset;
+	yar_payload cached = {0};
+	yar_response *response;
+	yar_cache_key key;
+	int found;
+
+	if (len == 1 && (unsigned char)*params == 0xc0) {
+		/* nil, no parameters */
+		params = NULL;
+	}
+
+	if (!client->cache || !yar_cache_key_init_encoded(client->cache, client->hostname, client->packager, method, params, len, &key)) {
+		return yar_client_send_packed(client, method, request_id, payload);
+	}
+
+	found = yar_cache_find(client->cache, &key, &cached);
+	if (found == YAR_CACHE_FRESH) {
+		free(payload->data);
+		yar_cache_key_free(&key);
+		return yar_client_cached(client, &cached);
+	}
+
+	response = yar_client_send_packed(client, method, request_id, payload);
+	return yar_client_cache_settle(client, method, &key, found, &cached, response);
+}
+/* }}} */
+
+/* as client->call(), the parameters given by format, one character each:
+ *   n  nil (takes no argument)      b  bool (int)
+ *   l  long                         u  ulong
+ *   d  double                       s  string (char *, NUL terminated, NULL for nil)
+ *   S  string (char *, uint len)    D  any value (yar_data *, NULL for nil)
+ * they are encoded straight into the request, no packager is built */
+yar_response * yar_client_callf(yar_client *client, char *method, const char *format, ...) /* {{{ */ {
+	unsigned int request_id = yar_client_next_id(client);
+	yar_payload payload = {0};
+	uint params_offset;
+	va_list args;
+	int ok;
+
+	va_start(args, format);
+	ok = yar_msgpack_encode_call(&payload, sizeof(yar_header) + sizeof(YAR_PACKAGER), request_id, method, strlen(method),
+			format, args, &params_offset);
+	va_end(args);
+	if (!ok) {
+		alog(YAR_ERROR, "Packing request failed, format '%s'", format);
+		return NULL;
+	}
+
+	return yar_client_call_packed(client, method, request_id, &payload, params_offset);
+}
+/* }}} */
+
+/* as client->call(), the parameters a prebuilt array value tree (NULL for
+ * none), encoded straight into the request */
+yar_response * yar_client_call_data(yar_client *client, char *method, const yar_data *parameters) /* {{{ */ {
+	unsigned int request_id;
+	yar_payload payload = {0};
+	uint params_offset, size;
+
+	if (parameters && yar_unpack_data_type(parameters, &size) != YAR_DATA_ARRAY) {
+		alog(YAR_ERROR, "Parameters of '%s' must be an array", method);
+		return NULL;
+	}
+
+	request_id = yar_client_next_id(client);
+	if (!yar_msgpack_encode_call_data(&payload, sizeof(yar_header) + sizeof(YAR_PACKAGER), request_id, method, strlen(method),
+			parameters, &params_offset)) {
+		alog(YAR_ERROR, "Packing request failed");
+		return NULL;
+	}
+
+	return yar_client_call_packed(client, method, request_id, &payload, params_offset);
+}
+/* }}} */
+
+/* send a PING or LIST request (a bare header, plus the packager tag for LIST)
+ * and read the answer to it, see yar_server_control() */
+static yar_response * yar_client_control(yar_client *client, uint flag) /* {{{ */ {
+	ulong deadline = yar_client_deadline(client);
+	unsigned int request_id;
+	char buf[sizeof(yar_header) + sizeof(YAR_PACKAGER)];
+	yar_header *response_header;
+	yar_response *response;
+	yar_payload payload;
+
+	if (!yar_client_ready(client, deadline)) {
+		return NULL;
+	}
+
+	if (client->pending) {
+		alog(YAR_ERROR, "Client has asynchronous calls in progress");
+		return NULL;
+	}
+
+	request_id = yar_client_next_id(client);
+
+	payload.data = buf;
+	payload.size = flag == YAR_PROTOCOL_PING? sizeof(yar_header) : sizeof(buf);
+	memset(buf, 0, sizeof(yar_header));
+	yar_protocol_render((yar_header *)buf, request_id, YAR_CLIENT_NAME, NULL, payload.size - sizeof(yar_header),
+			flag | (client->persistent? YAR_PROTOCOL_PERSISTENT : 0));
+	memcpy(buf + sizeof(yar_header), client->packager == YAR_PACKAGER_JSON? YAR_PACKAGER_JSON_TAG : YAR_PACKAGER, sizeof(YAR_PACKAGER));
+
+	response = calloc(1, sizeof(yar_response));
+	if (!yar_client_send(client, &payload, deadline) || !yar_client_receive(client, response, deadline, NULL, NULL)) {
+		goto error;
+	}
+
+	/* the answer is told by the header, the body (if any) does not carry the id */
+	response_header = (yar_header *)response->payload.data;
+	if (response_header->id != request_id || !(response_header->reserved & flag)) {
+		alog(YAR_ERROR, "Unexpected answer to a %s request", flag == YAR_PROTOCOL_PING? "ping" : "list");
+		goto error;
+	}
+	response->id = request_id;
+
+	if (flag == YAR_PROTOCOL_LIST && !yar_client_unpack(client, response, 0, NULL)) {
+		goto error;
+	}
+
+	return response;
+
+error:
+	yar_response_free(response);
+	free(response);
+	yar_client_hangup(client);
+	return NULL;
+}
+/* }}} */
+
+int yar_client_ping(yar_client *client) /* {{{ */ {
+	yar_response *response = yar_client_control(client, YAR_PROTOCOL_PING);
+
+	if (!response) {
+		return 0;
+	}
+	yar_response_free(response);
+	free(response);
+
+	return 1;
+}
+/* }}} */
+
+yar_response * yar_client_list(yar_client *client) /* {{{ */ {
+	return yar_client_control(client, YAR_PROTOCOL_LIST);
+}
+/* }}} */
+
+static void yar_client_io_on_read(int fd, short ev, void *arg);
+static void yar_client_io_on_write(int fd, short ev, void *arg);
+
+/* (re)add the read or write event, to time out when the wait does or when
+ * the first deadline of the calls in progress passes, whichever comes first */
+static void yar_client_io_arm(yar_client *client, int for_read) /* {{{ */ {
+	yar_client_io *io = client->io;
+	ulong now = yar_client_now(), until = for_read? io->read_until : io->write_until;
+	struct timeval tv;
+	yar_call *call;
+
+	for (call = client->pending; call; call = call->next) {
+		if (call->callback && call->deadline && call->deadline < until) {
+			until = call->deadline;
+		}
+	}
+	until = until > now? until - now : 0;
+	tv.tv_sec = until / 1000;
+	tv.tv_usec = (until % 1000) * 1000;
+
+	if (for_read) {
+		event_set(&io->ev_read, client->fd, EV_READ, yar_client_io_on_read, client);
+		event_base_set(io->base, &io->ev_read);
+		event_add(&io->ev_read, &tv);
+		io->read_added = 1;
+	} else {
+		event_set(&io->ev_write, client->fd, EV_WRITE, yar_client_io_on_write, client);
+		event_base_set(io->base, &io->ev_write);
+		event_add(&io->ev_write, &tv);
+		io->write_added = 1;
+	}
+}
+/* }}} */
+
+/* like yar_client_wait(), the timeout applies to every single wait */
+static void yar_client_io_wait(yar_client *client, int for_read) /* {{{ */ {
+	yar_client_io *io = client->io;
+	int timeout;
+
+	if (for_read) {
+		timeout = client->read_timeout;
+	} else {
+		timeout = io->connecting? client->connect_timeout : client->write_timeout;
+	}
+	timeout = timeout? timeout : 1000; /* default 1 second */
+	*(for_read? &io->read_until : &io->write_until) = yar_client_now() + timeout;
+
+	yar_client_io_arm(client, for_read);
+}
+/* }}} */
+
+/* an event timed out, if a call is past its deadline it fails on its own, the
+ * connection stays; returns 0 if the wait itself timed out */
+static int yar_client_io_expire(yar_client *client, int for_read) /* {{{ */ {
+	yar_client_io *io = client->io;
+	ulong now = yar_client_now();
+	yar_call_callback callback;
+	yar_call *call;
+	void *data;
+
+	for (call = client->pending; call; call = call->next) {
+		if (call->callback && call->deadline && call->deadline <= now) {
+			break;
+		}
+	}
+
+	if (!call) {
+		if (now < (for_read? io->read_until : io->write_until)) {
+			/* woken for a deadline another event took care of */
+			yar_client_io_arm(client, for_read);
+			return 1;
+		}
+		return 0;
+	}
+
+	alog(YAR_ERROR, "Call deadline exceeded");
+	callback = call->callback;
+	data = call->data;
+	if (!call->control) {
+		yar_client_outcome(client, 0);
+	}
+	yar_client_report(&client->stats, &call->stats, 0, call->started);
+	/* an answer to it that is on its way is dropped */
+	yar_call_cancel(call);
+
+	if (client->pending && client->pending != io->sending && !io->read_added) {
+		yar_client_io_arm(client, 1);
+	}
+	if (io->sending && !io->write_added) {
+		yar_client_io_arm(client, 0);
+	}
+
+	/* the callbacks of the others expired with it are called from the loop */
+	callback(NULL, data);
+	return 1;
+}
+/* }}} */
+
+/* the connection broke, every call in progress fails with it */
+static void yar_client_io_fail(yar_client *client) /* {{{ */ {
+	yar_stats_handler handler = client->stats;
+	yar_call *call = yar_client_io_reset(client), *failed;
+
+	for (failed = call; failed; failed = failed->next) {
+		if (failed->callback && !failed->control) {
+			yar_client_outcome(client, 0);
+		}
+	}
+
+	/* the stream can not be trusted anymore, do not let further calls reuse it */
+	yar_client_hangup(client);
+
+	/* the client is not touched anymore, the callbacks may destroy it */
+	while (call) {
+		yar_call *next = call->next;
+		if (call->callback) {
+			yar_client_report(&handler, &call->stats, 0, call->started);
+			call->callback(NULL, call->data);
+		}
+		yar_call_free(call);
+		call = next;
+	}
+}
+/* }}} */
+
+static uint yar_client_batch_limit(yar_client *client) /* {{{ */ {
+	return client->batch_max > 1? client->batch_max : 1;
+}
+/* }}} */
+
+/* turn the bare envelopes of the calls from call on into one request: a
+ * batch of up to batch_max of them, or a plain request if it is alone */
+static void yar_client_io_frame(yar_client *client, yar_call *call) /* {{{ */ {
+	uint num = 0, limit = yar_client_batch_limit(client), size, offset;
+	yar_payload payload;
+	yar_call *member;
+
+	for (member = call, size = 0; member && member->envelope && num < limit; member = member->next, num++) {
+		size += YAR_BATCH_ENTRY_PREFIX + member->payload.size;
+	}
+
+	if (num == 1) {
+		payload.size = sizeof(yar_header) + sizeof(YAR_PACKAGER) + call->payload.size;
+		payload.data = malloc(payload.size);
+		memcpy(payload.data + sizeof(yar_header) + sizeof(YAR_PACKAGER), call->payload.data, call->payload.size);
+		yar_client_frame(client, call->id, &payload, 0);
+	} else {
+		payload.size = sizeof(yar_header) + sizeof(YAR_PACKAGER) + size;
+		payload.data = malloc(payload.size);
+		offset = sizeof(yar_header) + sizeof(YAR_PACKAGER);
+		for (member = call; num--; member = member->next) {
+			yar_protocol_batch_put(payload.data + offset, member->payload.size);
+			memcpy(payload.data + offset + YAR_BATCH_ENTRY_PREFIX, member->payload.data, member->payload.size);
+			offset += YAR_BATCH_ENTRY_PREFIX + member->payload.size;
+			member->envelope = 0;
+			if (member != call) {
+				member->framed = 1;
+				free(member->payload.data);
+				member->payload.data = NULL;
+			}
+			call->batch++;
+		}
+		yar_client_frame(client, call->id, &payload, YAR_PROTOCOL_BATCH);
+	}
+
+	free(call->payload.data);
+	call->envelope = 0;
+	call->payload = payload;
+}
+/* }}} */
+
+static void yar_client_io_on_write(int fd, short ev, void *arg) /* {{{ */ {
+	yar_client *client = (yar_client *)arg;
+	yar_client_io *io = client->io;
+
+	io->write_added = 0;
+	if (ev == EV_TIMEOUT) {
+		if (yar_client_io_expire(client, 0)) {
+			return;
+		}
+		if (io->connecting) {
+			alog(YAR_ERROR, "Connect to '%s' timeout", client->hostname);
+			io->connecting = 0;
+			yar_client_connect_done(client, 0);
+		} else {
+			alog(YAR_ERROR, "Send request timeout");
+		}
+		yar_client_io_fail(client);
+		return;
+	}
+
+	if (io->connecting) {
+		io->connecting = 0;
+		if (!yar_client_connect_result(client)) {
+			yar_client_connect_done(client, 0);
+			yar_client_io_fail(client);
+			return;
+		}
+		yar_client_connect_done(client, 1);
+		if (client->stats.callback) {
+			ulong now = yar_client_clock();
+			yar_call *call;
+
+			/* every call so far waited for it, from when it was made */
+			for (call = client->pending; call; call = call->next) {
+				call->stats.connect = now - (call->started > io->connect_at? call->started : io->connect_at);
+			}
+		}
+	}
+
+	/* several requests go out before any answer is read */
+	while (io->sending) {
+		yar_call *call = io->sending;
+		int bytes_sent;
+
+		if (call->envelope) {
+			yar_client_io_frame(client, call);
+		}
+		if (call->started && !call->write_at) {
+			call->write_at = yar_client_clock();
+		}
+
+		do {
+			bytes_sent = send(fd, call->payload.data + call->bytes_sent, call->payload.size - call->bytes_sent, 0);
+		} while (bytes_sent == -1 && errno == EINTR);
+
+		if (bytes_sent == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			alog(YAR_ERROR, "Send request failed '%s'", strerror(errno));
+			yar_client_io_fail(client);
+			return;
+		}
+
+		call->bytes_sent += bytes_sent;
+		if (call->bytes_sent < call->payload.size) {
+			continue;
+		}
+
+		if (call->started) {
+			call->sent_at = yar_client_clock();
+			call->stats.write = call->sent_at - call->write_at;
+			call->stats.bytes_sent = call->payload.size;
+		}
+		free(call->payload.data);
+		call->payload.data = NULL;
+		io->sending = call->next;
+		while (io->sending && io->sending->framed) {
+			/* it went out with the batch */
+			io->sending = io->sending->next;
+		}
+		if (!io->read_added) {
+			yar_client_io_wait(client, 1);
+		}
+	}
+
+	if (io->sending) {
+		yar_client_io_wait(client, 0);
+	}
+}
+/* }}} */
+
+static void yar_client_io_on_batch(int fd, short ev, void *arg) /* {{{ */ {
+	yar_client *client = (yar_client *)arg;
+	yar_client_io *io = client->io;
+
+	io->batch_added = 0;
+	if (io->sending && !io->write_added) {
+		yar_client_io_wait(client, 0);
+	}
+}
+/* }}} */
+
+/* whether to hold the write back for more calls to join the batch: the
+ * window is open and the calls not sent yet do not fill a batch */
+static int yar_client_io_gather(yar_client *client) /* {{{ */ {
+	yar_client_io *io = client->io;
+	uint num = 0, limit = yar_client_batch_limit(client);
+	struct timeval tv;
+	yar_call *call;
+
+	if (limit == 1 || !client->batch_window || io->write_added) {
+		return 0;
+	}
+	for (call = io->sending; call && call->envelope && num < limit; call = call->next) {
+		num++;
+	}
+	if (num >= limit) {
+		if (io->batch_added) {
+			event_del(&io->ev_batch);
+			io->batch_added = 0;
+		}
+		return 0;
+	}
+
+	if (!io->batch_added) {
+		tv.tv_sec = client->batch_window / 1000;
+		tv.tv_usec = (client->batch_window % 1000) * 1000;
+		evtimer_set(&io->ev_batch, yar_client_io_on_batch, client);
+		event_base_set(io->base, &io->ev_batch);
+		evtimer_add(&io->ev_batch, &tv);
+		io->batch_added = 1;
+	}
+	return 1;
+}
+/* }}} */
+
+/* hand the entries of a batch response out to the calls of the batch, by
+ * id; a call whose entry is missing or broken gets NULL, like a failed one */
+static void yar_client_io_split(yar_client *client, yar_call *calls, yar_response *batch) /* {{{ */ {
+	uint offset = 0, size, len;
+	char *body, *entry;
+	yar_call *call;
+
+	if (yar_client_check_tag(client, batch) && yar_client_inflate(client, batch)) {
+		body = batch->payload.data + sizeof(yar_header) + sizeof(YAR_PACKAGER);
+		size = batch->payload.size - sizeof(yar_header) - sizeof(YAR_PACKAGER);
+		while (yar_protocol_batch_next(body, size, &offset, &entry, &len) == 1) {
+			yar_response *response = calloc(1, sizeof(yar_response));
+
+			response->payload.data = malloc(len);
+			response->payload.size = len;
+			memcpy(response->payload.data, entry, len);
+			if (!yar_response_unpack(response, response->payload.data, len, 0, (yar_packager_type)client->packager)) {
+				alog(YAR_ERROR, "Unpack batch entry failed");
+				yar_response_free(response);
+				free(response);
+				continue;
+			}
+			for (call = calls; call; call = call->next) {
+				if (call->id == (unsigned int)response->id && !call->answer) {
+					break;
+				}
+			}
+			if (!call) {
+				alog(YAR_ERROR, "Batch entry id %ld does not answer any request", response->id);
+				yar_response_free(response);
+				free(response);
+				continue;
+			}
+			call->answer = response;
+		}
+	}
+
+	yar_response_free(batch);
+	free(batch);
 }
 /* }}} */
 
-void yar_client_destroy(yar_client *client) /* {{{ */ {
-	yar_client_hangup(client);
-	free(client);
+/* the timings of a call answered by the response just read, up to its last
+ * byte */
+static void yar_client_io_timed(yar_client *client, yar_call *call, yar_response *response) /* {{{ */ {
+	yar_client_io *io = client->io;
+
+	call->stats.first_byte = io->first_byte_at > call->sent_at? io->first_byte_at - call->sent_at : 0;
+	call->stats.transfer = yar_client_clock() - io->first_byte_at;
+	call->stats.bytes_received = response->payload.size;
 }
 /* }}} */
 
-/* wait for the fd to become readable (for_read = 1) or writable (for_read = 0),
-   the fd_set and timeout are re-armed on every call, returns the select() status */
-static int yar_client_wait(int fd, int for_read, int timeout) /* {{{ */ {
-	fd_set fds;
-	struct timeval tv;
+static void yar_client_io_on_read(int fd, short ev, void *arg) /* {{{ */ {
+	yar_client *client = (yar_client *)arg;
+	yar_client_io *io = client->io;
+	yar_stats_handler handler = client->stats;
+	yar_response *response;
+	yar_call *call, *last, **prev;
+	int bytes_read;
+	ulong mark = 0;
+	uint i;
 
-	FD_ZERO(&fds);
-	FD_SET(fd, &fds);
+	io->read_added = 0;
+	if (ev == EV_TIMEOUT) {
+		if (yar_client_io_expire(client, 1)) {
+			return;
+		}
+		alog(YAR_ERROR, "Read response timeout");
+		yar_client_io_fail(client);
+		return;
+	}
 
-	tv.tv_sec = timeout;
-	tv.tv_usec = 0;
+	if (!io->response) {
+		io->response = calloc(1, sizeof(yar_response));
+	}
+	response = io->response;
 
-	if (for_read) {
-		return select(fd + 1, &fds, NULL, NULL, &tv);
+	if (io->header_read < sizeof(yar_header)) {
+		do {
+			bytes_read = recv(fd, io->header_buf + io->header_read, sizeof(yar_header) - io->header_read, 0);
+		} while (bytes_read == -1 && errno == EINTR);
 	} else {
-		return select(fd + 1, NULL, &fds, NULL, &tv);
+		do {
+			bytes_read = recv(fd, response->payload.data + io->total_read, response->payload.size - io->total_read, 0);
+		} while (bytes_read == -1 && errno == EINTR);
 	}
-}
-/* }}} */
 
-static yar_response * yar_client_caller(yar_client *client, char *method, uint num_args, yar_packager *parameters[]) /* {{{ */ {
-	int bytes_sent, bytes_read, select_result;
-	uint bytes_left, offset, total_read, header_read;
-	uint timeout;
-	unsigned int request_id = 1000; /* dummy id */
-	char header_buf[sizeof(yar_header)];
-	yar_header *response_header;
-	yar_response *response = NULL;
-	yar_request  *request;
-	yar_header header = {0};
-	yar_payload payload = {0};
+	if (bytes_read == 0) {
+		alog(YAR_ERROR, io->header_read < sizeof(yar_header)? "Server closed connection prematurely" : "Lost connection to server");
+		yar_client_io_fail(client);
+		return;
+	} else if (bytes_read == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			yar_client_io_wait(client, 1);
+			return;
+		}
+		alog(YAR_ERROR, "Failed read response '%s'", strerror(errno));
+		yar_client_io_fail(client);
+		return;
+	}
 
-	if (client->fd <= 0) {
-		alog(YAR_ERROR, "Client is not connected");
-		return NULL;
+	if (io->header_read < sizeof(yar_header)) {
+		if (!io->header_read && client->stats.callback) {
+			io->first_byte_at = yar_client_clock();
+		}
+		io->header_read += bytes_read;
+		if (io->header_read < sizeof(yar_header)) {
+			yar_client_io_wait(client, 1);
+			return;
+		}
+		if (!yar_client_response_header(response, io->header_buf)) {
+			yar_client_io_fail(client);
+			return;
+		}
+		io->total_read = sizeof(yar_header);
+	} else {
+		io->total_read += bytes_read;
 	}
 
-	timeout = client->timeout? client->timeout : 1; /* default 1 second */
+	if (io->total_read < response->payload.size) {
+		yar_client_io_wait(client, 1);
+		return;
+	}
 
-	request = calloc(1, sizeof(yar_request));
-	request->id = request_id;
-	request->method = strdup(method);
-	request->mlen = strlen(method);
-	if (num_args) {
-		uint i;
-		yar_packager *packager = yar_pack_start_array(num_args);
-		for (i = 0; i < num_args; i++) {
-			yar_pack_push_packager(packager, parameters[i]);
+	/* a whole answer, find the (sent) call it is for, most likely the oldest */
+	for (prev = &client->pending; (call = *prev) && call != io->sending; prev = &call->next) {
+		if (call->id == ((yar_header *)response->payload.data)->id) {
+			break;
 		}
-		yar_request_set_parameters(request, packager);
-		yar_pack_free(packager);
 	}
-
-	if (!yar_request_pack(request, &payload, sizeof(yar_header) + sizeof(YAR_PACKAGER), (yar_packager_type)client->packager)) {
-		alog(YAR_ERROR, "Packing request failed");
-		yar_request_free(request);
-		free(request);
-		return NULL;
+	if (!call || call == io->sending) {
+		alog(YAR_ERROR, "Response id %u does not answer any request", ((yar_header *)response->payload.data)->id);
+		yar_client_io_fail(client);
+		return;
+	}
+	if (!(((yar_header *)response->payload.data)->reserved & YAR_PROTOCOL_BATCH) != !(call->batch > 1)) {
+		alog(YAR_ERROR, "Response id %u does not answer a %s request", call->id, call->batch > 1? "batch" : "single");
+		yar_client_io_fail(client);
+		return;
 	}
 
-	yar_protocol_render(&header, request_id, YAR_CLIENT_NAME, NULL, payload.size - sizeof(yar_header), client->persistent? YAR_PROTOCOL_PERSISTENT : 0);
+	/* the calls of a batch are answered together, they follow each other */
+	for (last = call, i = 1; i < call->batch; i++) {
+		last = last->next;
+	}
+	*prev = last->next;
+	last->next = NULL;
+	if (io->last == last) {
+		io->last = (prev == &client->pending)? NULL : (yar_call *)((char *)prev - offsetof(yar_call, next));
+	}
+	io->response = NULL;
+	io->header_read = 0;
+	if (client->pending && client->pending != io->sending) {
+		/* more answers to come */
+		yar_client_io_wait(client, 1);
+	}
+	if (call->started) {
+		yar_client_io_timed(client, call, response);
+		mark = yar_client_clock();
+	}
 
-	memcpy(payload.data, (char *)&header, sizeof(yar_header));
-	memcpy(payload.data + sizeof(yar_header), client->packager == YAR_PACKAGER_JSON? YAR_PACKAGER_JSON_TAG : YAR_PACKAGER, sizeof(YAR_PACKAGER));
-	yar_request_free(request);
-	free(request);
+	if (call->batch > 1) {
+		yar_call *member;
 
-	offset = 0;
-	bytes_left = payload.size;
-	while (bytes_left) {
-		if ((select_result = yar_client_wait(client->fd, 0, timeout)) == 0) {
-			alog(YAR_ERROR, "Send request timeout");
-			goto error;
-		} else if (select_result == -1) {
-			if (errno == EINTR) {
-				continue;
+		yar_client_io_split(client, call, response);
+		if (call->started) {
+			/* the whole batch request and response is each call's */
+			call->stats.decode = yar_client_clock() - mark;
+			call->stats.batch = call->batch;
+			for (member = call->next; member; member = member->next) {
+				member->stats.batch = call->stats.batch;
+				member->stats.write = call->stats.write;
+				member->stats.first_byte = call->stats.first_byte;
+				member->stats.transfer = call->stats.transfer;
+				member->stats.decode = call->stats.decode;
+				member->stats.bytes_sent = call->stats.bytes_sent;
+				member->stats.bytes_received = call->stats.bytes_received;
 			}
-			alog(YAR_ERROR, "Select for client failed '%s'", strerror(errno));
-			goto error;
 		}
-
-		do {
-			bytes_sent = send(client->fd, payload.data + offset, bytes_left, 0);
-		} while (bytes_sent == -1 && errno == EINTR);
-
-		if (bytes_sent == -1) {
-			if (errno == EAGAIN || errno == EWOULDBLOCK) {
-				continue;
+		for (member = call; member; member = member->next) {
+			if (member->callback) {
+				yar_client_outcome(client, member->answer != NULL);
 			}
-			alog(YAR_ERROR, "Send request failed '%s'", strerror(errno));
-			goto error;
 		}
-
-		offset += bytes_sent;
-		bytes_left -= bytes_sent;
+		/* the callbacks may destroy the client, the calls are not in it anymore */
+		while (call) {
+			yar_call *next = call->next;
+			if (call->callback) {
+				yar_client_report(&handler, &call->stats, call->answer != NULL, call->started);
+				call->callback(call->answer, call->data);
+				call->answer = NULL;
+			}
+			yar_call_free(call);
+			call = next;
+		}
+		return;
 	}
 
-	free(payload.data);
-	payload.data = NULL;
+	if (!call->callback) {
+		/* cancelled */
+		yar_response_free(response);
+		free(response);
+	} else if (call->control) {
+		/* answered by the header, there is no body to unpack */
+		if (!(((yar_header *)response->payload.data)->reserved & call->control)) {
+			alog(YAR_ERROR, "Unexpected answer to a ping request");
+			yar_response_free(response);
+			free(response);
+			response = NULL;
+		} else {
+			response->id = call->id;
+		}
+		call->callback(response, call->data);
+	} else if (!yar_client_unpack(client, response, call->id, NULL)) {
+		/* the stream is still in step, only this call is lost */
+		yar_response_free(response);
+		free(response);
+		yar_client_outcome(client, 0);
+		yar_client_report(&handler, &call->stats, 0, call->started);
+		call->callback(NULL, call->data);
+	} else {
+		if (call->started) {
+			call->stats.decode = yar_client_clock() - mark;
+		}
+		yar_client_outcome(client, 1);
+		yar_client_report(&handler, &call->stats, 1, call->started);
+		call->callback(response, call->data);
+	}
+	/* the callback may have destroyed the client */
+	yar_call_free(call);
+}
+/* }}} */
 
-	response = calloc(1, sizeof(yar_response));
+/* whether a call can be made on base, and has to connect first: 1 if so, 0
+ * if it is connected, -1 (after logging why) if it can not be made */
+static int yar_client_io_begin(yar_client *client, struct event_base *base) /* {{{ */ {
+	if (!client->io) {
+		client->io = calloc(1, sizeof(yar_client_io));
+	}
+	if (client->pending && client->io->base != base) {
+		alog(YAR_ERROR, "Client has calls in progress on another event base");
+		return -1;
+	}
+	/* refused by the client itself (not connected, backing off), nothing
+	 * was tried, so it is not a call for the breaker either */
+	return yar_client_must_connect(client);
+}
+/* }}} */
 
-	/* read the response header, it may arrive in several segments */
-	header_read = 0;
-	while (header_read < sizeof(yar_header)) {
-		if ((select_result = yar_client_wait(client->fd, 1, timeout)) == 0) {
-			alog(YAR_ERROR, "Read response timeout");
-			goto error;
-		} else if (select_result == -1) {
-			if (errno == EINTR) {
-				continue;
-			}
-			alog(YAR_ERROR, "Select for client failed '%s'", strerror(errno));
-			goto error;
-		}
+/* start connecting if it must, and queue the call for the loop on base;
+ * returns 0 if the connect failed at once, the call is not queued then */
+static int yar_client_io_queue(yar_client *client, struct event_base *base, yar_call *call, int must) /* {{{ */ {
+	yar_client_io *io = client->io;
 
-		do {
-			bytes_read = recv(client->fd, header_buf + header_read, sizeof(yar_header) - header_read, 0);
-		} while (bytes_read == -1 && errno == EINTR);
+	if (must) {
+		/* connect in the background, the first write waits for it */
+		int status;
 
-		if (bytes_read == 0) {
-			alog(YAR_ERROR, "Server closed connection prematurely");
-			goto error;
-		} else if (bytes_read == -1) {
-			if (errno == EAGAIN || errno == EWOULDBLOCK) {
-				continue;
-			}
-			alog(YAR_ERROR, "Failed read response '%s'", strerror(errno));
-			goto error;
+		io->connect_at = call->started;
+		status = yar_client_connect_start(client);
+		if (status == -1) {
+			yar_client_connect_done(client, 0);
+			return 0;
+		}
+		io->connecting = !status;
+		if (status) {
+			yar_client_connect_done(client, 1);
+			call->stats.connect = call->started? yar_client_clock() - call->started : 0;
 		}
-
-		header_read += bytes_read;
 	}
+	io->base = base;
 
-	response_header = (yar_header *)header_buf;
-	if (!yar_protocol_parse(response_header)) {
-		alog(YAR_ERROR, "Parsing response header failed, maybe not responsed by a rpc server?");
-		goto error;
+	if (io->last) {
+		io->last->next = call;
+	} else {
+		client->pending = call;
+	}
+	io->last = call;
+	if (!io->sending) {
+		io->sending = call;
 	}
 
-	if (response_header->body_len > YAR_MAX_BODY_SIZE) {
-		alog(YAR_ERROR, "Response body too large %u", response_header->body_len);
-		goto error;
+	/* the socket is most likely writable already, but the callback must not
+	 * run before this returns, so the first send waits for the loop as well */
+	if (call->envelope && yar_client_io_gather(client)) {
+		return 1;
+	}
+	if (!io->write_added) {
+		yar_client_io_wait(client, 0);
+	} else if (call->deadline) {
+		/* it may be due before the wait in progress times out */
+		event_del(&io->ev_write);
+		yar_client_io_arm(client, 0);
 	}
 
-	response->payload.data = malloc(sizeof(yar_header) + response_header->body_len);
-	response->payload.size = sizeof(yar_header) + response_header->body_len;
-	memcpy(response->payload.data, header_buf, sizeof(yar_header));
-	total_read = sizeof(yar_header);
+	return 1;
+}
+/* }}} */
 
-	/* read the response body */
-	while (total_read < response->payload.size) {
-		if ((select_result = yar_client_wait(client->fd, 1, timeout)) == 0) {
-			alog(YAR_ERROR, "Read response timeout");
-			goto error;
-		} else if (select_result == -1) {
-			if (errno == EINTR) {
-				continue;
-			}
-			alog(YAR_ERROR, "Select for client failed '%s'", strerror(errno));
-			goto error;
-		}
+yar_call * yar_client_call_async(yar_client *client, struct event_base *base, char *method, uint num_args,
+		yar_packager *parameters[], yar_call_callback callback, void *data) /* {{{ */ {
+	ulong started = client->stats.callback? yar_client_clock() : 0;
+	yar_call *call;
+	int must;
 
-		do {
-			bytes_read = recv(client->fd, response->payload.data + total_read, response->payload.size - total_read, 0);
-		} while (bytes_read == -1 && errno == EINTR);
+	if ((must = yar_client_io_begin(client, base)) == -1) {
+		return NULL;
+	}
 
-		if (bytes_read == 0) {
-			alog(YAR_ERROR, "Lost connection to server");
-			goto error;
-		} else if (bytes_read == -1) {
-			if (errno == EAGAIN || errno == EWOULDBLOCK) {
-				continue;
-			}
-			alog(YAR_ERROR, "Failed read response '%s'", strerror(errno));
-			goto error;
+	call = calloc(1, sizeof(yar_call));
+	call->client = client;
+	call->id = yar_client_next_id(client);
+	call->callback = callback;
+	call->data = data;
+	call->deadline = yar_client_deadline(client);
+
+	if (yar_client_batch_limit(client) > 1) {
+		/* framed when it is sent, maybe with the calls made after it */
+		call->envelope = 1;
+		if (!yar_client_envelope(client, call->id, method, num_args, parameters, &call->payload, 0)) {
+			free(call);
+			return NULL;
 		}
+	} else if (!yar_client_pack(client, call->id, method, num_args, parameters, &call->payload)) {
+		free(call);
+		return NULL;
+	}
 
-		total_read += bytes_read;
+	if (client->breaker && !yar_breaker_allow(client->breaker, client->hostname)) {
+		yar_call_free(call);
+		return NULL;
 	}
 
-	{
-		char *tag = response->payload.data + sizeof(yar_header);
-		if (client->packager == YAR_PACKAGER_JSON) {
-			if (strncmp(tag, YAR_PACKAGER_JSON_TAG, sizeof(YAR_PACKAGER_JSON_TAG) - 1) != 0) {
-				alog(YAR_ERROR, "Response packager is not JSON");
-				goto error;
-			}
-		} else if (strncmp(tag, YAR_PACKAGER, sizeof(YAR_PACKAGER) - 1) != 0) {
-			alog(YAR_ERROR, "Response packager is not msgpack");
-			goto error;
-		}
+	if (started) {
+		call->started = started;
+		call->stats.method = strdup(method);
+		call->stats.id = call->id;
+		call->stats.batch = 1;
 	}
 
-	if (!yar_response_unpack(response, response->payload.data, response->payload.size, sizeof(yar_header) + sizeof(YAR_PACKAGER), (yar_packager_type)client->packager)) {
-		alog(YAR_ERROR, "Unpack response failed");
-		goto error;
+	if (!yar_client_io_queue(client, base, call, must)) {
+		yar_client_outcome(client, 0);
+		yar_call_free(call);
+		return NULL;
 	}
 
-	if (response->id != (long)request_id) {
-		alog(YAR_ERROR, "Response id mismatch, expect %u, got %ld", request_id, response->id);
-		goto error;
+	return call;
+}
+/* }}} */
+
+/* a ping sent from the loop, as yar_client_call_async(); the callback gets
+ * the bare answer, or NULL. Neither timed nor told to the breaker, as
+ * yar_client_ping() */
+yar_call * yar_client_ping_async(yar_client *client, struct event_base *base, yar_call_callback callback, void *data) /* {{{ */ {
+	yar_call *call;
+	int must;
+
+	if ((must = yar_client_io_begin(client, base)) == -1) {
+		return NULL;
 	}
 
-	return response;
+	call = calloc(1, sizeof(yar_call));
+	call->client = client;
+	call->id = yar_client_next_id(client);
+	call->callback = callback;
+	call->data = data;
+	call->deadline = yar_client_deadline(client);
+	call->control = YAR_PROTOCOL_PING;
 
-error:
-	if (payload.data) {
-		free(payload.data);
+	call->payload.size = sizeof(yar_header);
+	call->payload.data = calloc(1, sizeof(yar_header));
+	yar_protocol_render((yar_header *)call->payload.data, call->id, YAR_CLIENT_NAME, NULL, 0,
+			YAR_PROTOCOL_PING | (client->persistent? YAR_PROTOCOL_PERSISTENT : 0));
+
+	if (!yar_client_io_queue(client, base, call, must)) {
+		yar_call_free(call);
+		return NULL;
 	}
-	if (response) {
-		yar_response_free(response);
-		free(response);
+
+	return call;
+}
+/* }}} */
+
+void yar_call_cancel(yar_call *call) /* {{{ */ {
+	yar_client *client = call->client;
+	yar_client_io *io = client->io;
+	yar_call *prev = NULL, *current;
+
+	if (call->bytes_sent || call->batch > 1 || call->framed) {
+		/* the rest of it (or of its batch) still has to go out, and the
+		 * answer will come in, it is dropped when it does */
+		call->callback = NULL;
+		return;
 	}
-	/* the stream can not be trusted anymore, do not let further calls reuse it */
-	yar_client_hangup(client);
-	return NULL;
+
+	for (current = client->pending; current != call; current = current->next) {
+		prev = current;
+	}
+	if (prev) {
+		prev->next = call->next;
+	} else {
+		client->pending = call->next;
+	}
+	if (io->last == call) {
+		io->last = prev;
+	}
+	if (io->sending == call) {
+		io->sending = call->next;
+		if (!io->sending && io->write_added) {
+			event_del(&io->ev_write);
+			io->write_added = 0;
+		}
+	}
+
+	yar_call_free(call);
 }
 /* }}} */
 
-yar_client * yar_client_init(char *hostname) /* {{{ */ {
-	struct sockaddr_storage sa;
-	socklen_t sa_len = 0;
-	bzero(&sa, sizeof(sa));
-	int sockfd;
-	yar_client *client = calloc(1, sizeof(yar_client));
+/* nothing is connected yet, the first call (or yar_client_connect()) does */
+yar_client * yar_client_new(char *hostname) /* {{{ */ {
+	yar_client *client;
 
 	/* accept the PHP-style tcp:// scheme so one URI works for both clients */
 	if (strncasecmp(hostname, "tcp://", sizeof("tcp://") - 1) == 0) {
 		hostname += sizeof("tcp://") - 1;
 	}
 
-	client->hostname = hostname;
-	client->call = yar_client_caller;
-
-	if (strncasecmp(hostname, "http://", sizeof("http://")) == 0
-			|| strncasecmp(hostname, "https://", sizeof("https://")) == 0) {
+	if (strncasecmp(hostname, "http://", sizeof("http://") - 1) == 0
+			|| strncasecmp(hostname, "https://", sizeof("https://") - 1) == 0) {
 		/* libcurl */
-		free(client);
 		return NULL;
 	} else if (hostname[0] == '/') {
-		/* unix domain socket */
-		struct sockaddr_un *usa;
-		usa = (struct sockaddr_un *)&sa;
-		if (strlen(hostname) >= sizeof(usa->sun_path)) {
+		if (strlen(hostname) >= sizeof(((struct sockaddr_un *)0)->sun_path)) {
 			alog(YAR_ERROR, "Unix socket path too long '%s'", hostname);
-			free(client);
-			return NULL;
-		}
-		if ((sockfd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
-			alog(YAR_ERROR, "Failed to create a socket '%s'", strerror(errno));
-			free(client);
-			return NULL;
-		}
-		usa->sun_family = AF_UNIX;
-		memcpy(usa->sun_path, hostname, strlen(hostname) + 1);
-		sa_len = SUN_LEN(usa);
-	} else {
-		/* IPV4, we don't support IPV6 for now */
-		char *delim, *p, host[1024];
-		int port, addrtype;
-		struct hostent *hptr;
-		struct sockaddr_in *isa;
-		if ((delim = strchr(hostname, ':'))) {
-			if ((size_t)(delim - hostname) >= sizeof(host)) {
-				alog(YAR_ERROR, "Host name too long");
-				free(client);
-				return NULL;
-			}
-			memcpy(host, hostname, delim - hostname);
-			host[delim - hostname] = '\0';
-			port = atoi(delim + 1);
-		} else {
-			alog(YAR_ERROR, "Port doesn't specificed");
-			free(client);
-			return NULL;
-		}
-
-		if ((hptr = gethostbyname(host)) == NULL) {
-			alog(YAR_ERROR, "Failed to resolve host name '%s'", host);
-			free(client);
-			return NULL;
-		}
-
-		{
-			/* see yar_copy_unaligned(): the hostent members are misaligned on
-			 * some platforms, copy them out byte-wise instead of loading them */
-			char **addr_list;
-			char *addr;
-			yar_copy_unaligned(&addrtype, &hptr->h_addrtype, sizeof(addrtype));
-			yar_copy_unaligned(&addr_list, &hptr->h_addr_list, sizeof(addr_list));
-			yar_copy_unaligned(&addr, addr_list, sizeof(addr));
-			p = addr;
-		}
-		if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-			alog(YAR_ERROR, "Failed to create a socket '%s'", strerror(errno));
-			free(client);
 			return NULL;
 		}
+	} else if (!strchr(hostname, ':')) {
+		alog(YAR_ERROR, "Port doesn't specificed");
+		return NULL;
+	}
 
-		switch (addrtype) {
-			case AF_INET:
-				{
-					int val = 1;
-					isa = (struct sockaddr_in *)&sa;
-					bzero(isa, sizeof(struct sockaddr_in));
+	client = calloc(1, sizeof(yar_client));
+	client->hostname = hostname;
+	client->call = yar_client_caller;
 
-					isa->sin_family = AF_INET;
-					isa->sin_port = htons(port);
-					memcpy(&isa->sin_addr, p, sizeof(struct in_addr));
+	return client;
+}
+/* }}} */
 
-					setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (char*)&val, sizeof(val));
-					sa_len = sizeof(struct sockaddr_in);
-				}
-				break;
-			default:
-				alog(YAR_ERROR, "Unknown address type %d", addrtype);
-				close(sockfd);
-				free(client);
-				return NULL;
-		}
-	}
+yar_client * yar_client_init(char *hostname) /* {{{ */ {
+	yar_client *client = yar_client_new(hostname);
 
-	if (connect(sockfd, (const struct sockaddr *)&sa, sa_len) == -1) {
-		alog(YAR_ERROR, "Failed to connect to host '%s'", strerror(errno));
-		close(sockfd);
-		free(client);
+	if (client && !yar_client_connect(client)) {
+		yar_client_destroy(client);
 		return NULL;
 	}
 
-	yar_set_non_blocking(sockfd);
-
-	client->fd = sockfd;
-
 	return client;
 }
 /* }}} */
@@ -397,10 +2064,71 @@ int yar_client_set_opt(yar_client *client, yar_client_opt opt, void *val) /* {{{
 		break;
 		case YAR_CONNECT_TIMEOUT:
 			client->timeout = *(int *)val;
+			client->connect_timeout = client->write_timeout = client->read_timeout = client->timeout * 1000;
 		break;
 		case YAR_OPT_PACKAGER:
 			client->packager = *(int *)val;
 		break;
+		case YAR_CONNECT_TIMEOUT_MS:
+		case YAR_WRITE_TIMEOUT_MS:
+		case YAR_READ_TIMEOUT_MS:
+		case YAR_CALL_DEADLINE_MS:
+			if (*(int *)val < 0) {
+				return 0;
+			}
+			if (opt == YAR_CONNECT_TIMEOUT_MS) {
+				client->connect_timeout = *(int *)val;
+			} else if (opt == YAR_WRITE_TIMEOUT_MS) {
+				client->write_timeout = *(int *)val;
+			} else if (opt == YAR_READ_TIMEOUT_MS) {
+				client->read_timeout = *(int *)val;
+			} else {
+				client->deadline = *(int *)val;
+			}
+		break;
+		case YAR_RECONNECT_BACKOFF_MS:
+			if (*(int *)val < -1) {
+				return 0;
+			}
+			client->reconnect_backoff = *(int *)val;
+		break;
+		case YAR_OPT_CACHE:
+			client->cache = (struct _yar_cache *)val;
+		break;
+		case YAR_OPT_BREAKER:
+			client->breaker = (struct _yar_breaker *)val;
+		break;
+		case YAR_OPT_COMPRESS_THRESHOLD:
+			if (*(int *)val < 0) {
+				return 0;
+			}
+			if (*(int *)val && !yar_protocol_compression()) {
+				alog(YAR_WARNING, "Compression is not available, built without zstd");
+				return 0;
+			}
+			client->compress_threshold = *(int *)val;
+		break;
+		case YAR_OPT_ELEMENT_HANDLER:
+			if (val) {
+				client->elements = *(yar_element_handler *)val;
+			} else {
+				memset(&client->elements, 0, sizeof(yar_element_handler));
+			}
+		break;
+		case YAR_OPT_STATS_HANDLER:
+			if (val) {
+				client->stats = *(yar_stats_handler *)val;
+			} else {
+				memset(&client->stats, 0, sizeof(yar_stats_handler));
+			}
+		break;
+		case YAR_BATCH_MAX:
+		case YAR_BATCH_WINDOW_MS:
+			if (*(int *)val < 0) {
+				return 0;
+			}
+			*(opt == YAR_BATCH_MAX? &client->batch_max : &client->batch_window) = *(int *)val;
+		break;
 		default:
 			return 0;
 	}
@@ -419,6 +2147,42 @@ const void * yar_client_get_opt(yar_client *client, yar_client_opt opt) /* {{{ *
 		case YAR_OPT_PACKAGER:
 			return &client->packager;
 		break;
+		case YAR_CONNECT_TIMEOUT_MS:
+			return &client->connect_timeout;
+		break;
+		case YAR_WRITE_TIMEOUT_MS:
+			return &client->write_timeout;
+		break;
+		case YAR_READ_TIMEOUT_MS:
+			return &client->read_timeout;
+		break;
+		case YAR_CALL_DEADLINE_MS:
+			return &client->deadline;
+		break;
+		case YAR_RECONNECT_BACKOFF_MS:
+			return &client->reconnect_backoff;
+		break;
+		case YAR_OPT_CACHE:
+			return client->cache;
+		break;
+		case YAR_OPT_BREAKER:
+			return client->breaker;
+		break;
+		case YAR_OPT_COMPRESS_THRESHOLD:
+			return &client->compress_threshold;
+		break;
+		case YAR_BATCH_MAX:
+			return &client->batch_max;
+		break;
+		case YAR_BATCH_WINDOW_MS:
+			return &client->batch_window;
+		break;
+		case YAR_OPT_ELEMENT_HANDLER:
+			return client->elements.callback? &client->elements : NULL;
+		break;
+		case YAR_OPT_STATS_HANDLER:
+			return client->stats.callback? &client->stats : NULL;
+		break;
 		default:
 			return NULL;
 	}
@@ -20,30 +20,113 @@
 #define YAR_CLIENT_H
 
 #define YAR_CLIENT_NAME "Yar(C)-"YAR_VERSION
+#define YAR_RECONNECT_MAX_BACKOFF 10000 /* milliseconds */
+#define YAR_CONNECT_ATTEMPT_DELAY 250   /* milliseconds before racing the next address */
 
 typedef struct _yar_client yar_client;
+typedef struct _yar_call yar_call;
+typedef struct _yar_client_io yar_client_io;
+
+struct event_base;
 
 typedef yar_response * (*yar_client_call)(yar_client *client, char *method, uint num_args, yar_packager *packager[]);
+/* response is NULL if the call failed, otherwise it is the callback's to free */
+typedef void (*yar_call_callback)(yar_response *response, void *data);
+
+/* given the elements of an array result as they are decoded, see YAR_OPT_ELEMENT_HANDLER */
+typedef struct _yar_element_handler {
+	yar_element_callback callback;
+	void *data;
+} yar_element_handler;
+
+/* where the time of a call went, in microseconds, see YAR_OPT_STATS_HANDLER */
+typedef struct _yar_call_stats {
+	const char *method;
+	unsigned int id;
+	int ok;                  /* 0 if the call failed */
+	uint batch;              /* calls sent in the same request, itself included */
+	ulong connect;           /* getting a connection, connecting if there was none */
+	ulong write;             /* from the first byte of the request sent to the last */
+	ulong first_byte;        /* from the request sent to the first byte of the response */
+	ulong transfer;          /* from the first byte of the response to the last */
+	ulong decode;            /* unpacking the response, after its last byte */
+	ulong total;
+	uint bytes_sent;
+	uint bytes_received;
+} yar_call_stats;
+
+typedef void (*yar_stats_callback)(const yar_call_stats *stats, void *data);
+
+/* called once a call is done, see YAR_OPT_STATS_HANDLER */
+typedef struct _yar_stats_handler {
+	yar_stats_callback callback;
+	void *data;
+} yar_stats_handler;
 
 struct _yar_client {
 	int fd;
 	char *hostname;
 	int persistent;
 	int timeout;
+	int connect_timeout;           /* milliseconds, as the ones below */
+	int write_timeout;
+	int read_timeout;
+	int deadline;                  /* for a whole call */
 	int packager;
+	unsigned int connects;         /* connection attempts made */
+	int reconnect_backoff;         /* milliseconds, -1 to never reconnect */
+	unsigned int connect_failures; /* in a row */
+	ulong retry_at;                /* no reconnecting before, in milliseconds */
 	yar_client_call call;
+	yar_call *pending;             /* asynchronous calls in progress, oldest first */
+	yar_client_io *io;
+	unsigned int sequence;         /* last request id */
+	struct _yar_cache *cache;      /* not owned, may be shared with other clients */
+	struct _yar_breaker *breaker;  /* not owned, may be shared with other clients of the thread */
+	int batch_max;                 /* asynchronous calls sent as one request, batching is off below 2 */
+	int batch_window;              /* milliseconds a call waits for others to join its batch */
+	yar_element_handler elements;  /* no callback for none */
+	yar_stats_handler stats;       /* no callback for none */
+	int compress_threshold;        /* bytes, 0 not to compress */
+	int compress_peer;             /* the server said it takes compressed requests */
 };
 
 typedef enum _yar_client_opt {
 	YAR_PERSISTENT_LINK = 1,
-	YAR_CONNECT_TIMEOUT,
-	YAR_OPT_PACKAGER
+	YAR_CONNECT_TIMEOUT,      /* seconds, sets the three timeouts below */
+	YAR_OPT_PACKAGER,
+	YAR_CONNECT_TIMEOUT_MS,   /* milliseconds, for connecting */
+	YAR_WRITE_TIMEOUT_MS,     /* milliseconds, for every wait to send */
+	YAR_READ_TIMEOUT_MS,      /* milliseconds, for every wait to receive */
+	YAR_CALL_DEADLINE_MS,     /* milliseconds, for a whole call, 0 for none */
+	YAR_RECONNECT_BACKOFF_MS, /* milliseconds, doubling up to YAR_RECONNECT_MAX_BACKOFF, -1 not to reconnect */
+	YAR_OPT_CACHE,            /* a yar_cache, for the methods it has a ttl for, NULL for none */
+	YAR_BATCH_MAX,            /* asynchronous calls sent together as one batch request at most */
+	YAR_BATCH_WINDOW_MS,      /* milliseconds, how long a call waits for others to batch with */
+	YAR_OPT_ELEMENT_HANDLER,  /* a yar_element_handler, for the elements of array results, NULL for none */
+	YAR_OPT_STATS_HANDLER,    /* a yar_stats_handler, told the timings of every call, NULL for none */
+	YAR_OPT_BREAKER,          /* a yar_breaker, failing calls fast while the server is down, NULL for none */
+	YAR_OPT_COMPRESS_THRESHOLD /* bytes, request bodies are compressed from so large on, 0 never to compress */
 } yar_client_opt;
 
 yar_client * yar_client_init(char *hostname);
+yar_client * yar_client_new(char *hostname);
+int yar_client_connect(yar_client *client);
+int yar_client_connect_begin(yar_client *client);
+int yar_client_connect_end(yar_client *client);
 int yar_client_set_opt(yar_client *client, yar_client_opt opt, void *val);
 const void * yar_client_get_opt(yar_client *client, yar_client_opt opt);
 
+yar_response * yar_client_callf(yar_client *client, char *method, const char *format, ...);
+yar_response * yar_client_call_data(yar_client *client, char *method, const yar_data *parameters);
+yar_call * yar_client_call_async(yar_client *client, struct event_base *base, char *method, uint num_args,
+		yar_packager *parameters[], yar_call_callback callback, void *data);
+void yar_call_cancel(yar_call *call);
+int yar_client_alive(yar_client *client);
+int yar_client_ping(yar_client *client);
+yar_call * yar_client_ping_async(yar_client *client, struct event_base *base, yar_call_callback callback, void *data);
+yar_response * yar_client_list(yar_client *client);
+
 void yar_client_destroy(yar_client *client);
 #endif
 /*
@@ -0,0 +1,294 @@
+/**
+ * Yar - Concurrent RPC Server for PHP, C etc
+ *
+ * Copyright (C) 2012-2012 Xinchen Hui <laruence at gmail dot com>
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>   /* for timeval */
+#include "event.h" 		/* for libevent */
+
+#include "yar_common.h"
+#include "yar_pack.h"
+#include "yar_log.h"
+#include "yar_response.h"
+#include "yar_client.h"
+#include "yar_concurrent_client.h"
+
+/* a connection, kept (persistent) across calls and loops for reuse */
+typedef struct _yar_concurrent_link {
+	char *hostname;
+	yar_client *client;
+	struct _yar_concurrent_link *next;
+} yar_concurrent_link;
+
+/* a call in flight */
+typedef struct _yar_concurrent_call {
+	yar_concurrent_client *cc;
+	yar_call *call;
+	yar_call_callback callback;
+	void *data;
+	struct _yar_concurrent_call *prev;
+	struct _yar_concurrent_call *next;
+} yar_concurrent_call;
+
+struct _yar_concurrent_client {
+	struct event_base *base;
+	struct event ev_timeout;
+	int timeout;
+	int packager;
+	int call_timeout;
+	int timer_armed;
+	int timed_out;
+	yar_concurrent_link *links;
+	yar_concurrent_call *calls;
+};
+
+static void yar_concurrent_link_free(yar_concurrent_link *link) /* {{{ */ {
+	yar_client_destroy(link->client);
+	free(link->hostname);
+	free(link);
+}
+/* }}} */
+
+/* an idle connection to hostname, a new one if they are all busy */
+static yar_concurrent_link * yar_concurrent_client_link(yar_concurrent_client *cc, char *hostname) /* {{{ */ {
+	int persistent = 1;
+	yar_concurrent_link *link, **prev = &cc->links;
+
+	while ((link = *prev)) {
+		if (link->client->fd <= 0) {
+			/* failed, or closed after a non-persistent call */
+			*prev = link->next;
+			yar_concurrent_link_free(link);
+			continue;
+		}
+		if (!link->client->pending && strcmp(link->hostname, hostname) == 0) {
+			return link;
+		}
+		prev = &link->next;
+	}
+
+	link = calloc(1, sizeof(yar_concurrent_link));
+	/* the client keeps a pointer to the name, it must live as long */
+	link->hostname = strdup(hostname);
+	/* not connected here: the call connects in the background on the loop, so
+	 * the connects of a fan-out overlap and are bounded by the timeouts */
+	if (!(link->client = yar_client_new(link->hostname))) {
+		free(link->hostname);
+		free(link);
+		return NULL;
+	}
+	yar_client_set_opt(link->client, YAR_PERSISTENT_LINK, &persistent);
+	yar_client_set_opt(link->client, YAR_CONNECT_TIMEOUT, &cc->call_timeout);
+	yar_client_set_opt(link->client, YAR_OPT_PACKAGER, &cc->packager);
+
+	link->next = cc->links;
+	cc->links = link;
+
+	return link;
+}
+/* }}} */
+
+static void yar_concurrent_call_unlink(yar_concurrent_call *call) /* {{{ */ {
+	yar_concurrent_client *cc = call->cc;
+
+	if (call->prev) {
+		call->prev->next = call->next;
+	} else {
+		cc->calls = call->next;
+	}
+	if (call->next) {
+		call->next->prev = call->prev;
+	}
+
+	if (!cc->calls && cc->timer_armed) {
+		/* nothing left for the loop but the timer */
+		event_del(&cc->ev_timeout);
+		cc->timer_armed = 0;
+	}
+}
+/* }}} */
+
+static void yar_concurrent_on_complete(yar_response *response, void *data) /* {{{ */ {
+	yar_concurrent_call *call = (yar_concurrent_call *)data;
+
+	yar_concurrent_call_unlink(call);
+	call->callback(response, call->data);
+	free(call);
+}
+/* }}} */
+
+/* the loop ran out of time, fail whatever is still in flight */
+static void yar_concurrent_on_timeout(int fd, short ev, void *arg) /* {{{ */ {
+	yar_concurrent_client *cc = (yar_concurrent_client *)arg;
+
+	cc->timer_armed = 0;
+	cc->timed_out = 1;
+	while (cc->calls) {
+		yar_concurrent_call *call = cc->calls;
+
+		alog(YAR_ERROR, "Concurrent call timeout");
+		yar_call_cancel(call->call);
+		yar_concurrent_call_unlink(call);
+		call->callback(NULL, call->data);
+		free(call);
+	}
+
+	/* late answers to the cancelled calls are left to read (and drop) for the
+	 * next loop, their connections stay busy until then */
+	event_base_loopbreak(cc->base);
+}
+/* }}} */
+
+yar_concurrent_client * yar_concurrent_client_init() /* {{{ */ {
+	yar_concurrent_client *cc = calloc(1, sizeof(yar_concurrent_client));
+
+	if (!(cc->base = event_base_new())) {
+		alog(YAR_ERROR, "Failed to create an event base");
+		free(cc);
+		return NULL;
+	}
+
+	return cc;
+}
+/* }}} */
+
+int yar_concurrent_client_set_opt(yar_concurrent_client *cc, yar_concurrent_opt opt, void *val) /* {{{ */ {
+	switch (opt) {
+		case YAR_CONCURRENT_TIMEOUT:
+			if (*(int *)val < 0) {
+				return 0;
+			}
+			cc->timeout = *(int *)val;
+		break;
+		case YAR_CONCURRENT_PACKAGER:
+			cc->packager = *(int *)val;
+		break;
+		case YAR_CONCURRENT_CALL_TIMEOUT:
+			cc->call_timeout = *(int *)val;
+		break;
+		default:
+			return 0;
+	}
+	return 1;
+}
+/* }}} */
+
+const void * yar_concurrent_client_get_opt(yar_concurrent_client *cc, yar_concurrent_opt opt) /* {{{ */ {
+	switch (opt) {
+		case YAR_CONCURRENT_TIMEOUT:
+			return &cc->timeout;
+		break;
+		case YAR_CONCURRENT_PACKAGER:
+			return &cc->packager;
+		break;
+		case YAR_CONCURRENT_CALL_TIMEOUT:
+			return &cc->call_timeout;
+		break;
+		default:
+			return NULL;
+	}
+}
+/* }}} */
+
+/* queue a call for the next loop, the request is packed right away (the
+ * parameters can be freed on return) but nothing is sent before the loop */
+int yar_concurrent_client_call(yar_concurrent_client *cc, char *hostname, char *method, uint num_args,
+		yar_packager *parameters[], yar_call_callback callback, void *data) /* {{{ */ {
+	yar_concurrent_link *link;
+	yar_concurrent_call *call;
+
+	if (!(link = yar_concurrent_client_link(cc, hostname))) {
+		return 0;
+	}
+
+	call = calloc(1, sizeof(yar_concurrent_call));
+	call->cc = cc;
+	call->callback = callback;
+	call->data = data;
+	if (!(call->call = yar_client_call_async(link->client, cc->base, method, num_args, parameters, yar_concurrent_on_complete, call))) {
+		free(call);
+		return 0;
+	}
+
+	call->next = cc->calls;
+	if (call->next) {
+		call->next->prev = call;
+	}
+	cc->calls = call;
+
+	return 1;
+}
+/* }}} */
+
+/* run the queued calls until they all complete, or the loop times out;
+ * every callback has been called once this returns, 0 if it timed out */
+int yar_concurrent_client_loop(yar_concurrent_client *cc) /* {{{ */ {
+	if (!cc->calls) {
+		return 1;
+	}
+
+	cc->timed_out = 0;
+	if (cc->timeout) {
+		struct timeval tv;
+
+		tv.tv_sec = cc->timeout / 1000;
+		tv.tv_usec = (cc->timeout % 1000) * 1000;
+		evtimer_set(&cc->ev_timeout, yar_concurrent_on_timeout, cc);
+		event_base_set(cc->base, &cc->ev_timeout);
+		evtimer_add(&cc->ev_timeout, &tv);
+		cc->timer_armed = 1;
+	}
+
+	event_base_dispatch(cc->base);
+
+	return !cc->timed_out;
+}
+/* }}} */
+
+void yar_concurrent_client_destroy(yar_concurrent_client *cc) /* {{{ */ {
+	/* calls never looped for are dropped, their callbacks are not called */
+	while (cc->calls) {
+		yar_concurrent_call *call = cc->calls;
+		cc->calls = call->next;
+		yar_call_cancel(call->call);
+		free(call);
+	}
+
+	while (cc->links) {
+		yar_concurrent_link *link = cc->links;
+		cc->links = link->next;
+		yar_concurrent_link_free(link);
+	}
+
+	event_base_free(cc->base);
+	free(cc);
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
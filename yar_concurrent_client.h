@@ -0,0 +1,46 @@
+/**
+ * Yar - Concurrent RPC Server for PHP, C etc
+ *
+ * Copyright (C) 2012-2012 Xinchen Hui <laruence at gmail dot com>
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef YAR_CONCURRENT_CLIENT_H
+#define YAR_CONCURRENT_CLIENT_H
+
+typedef struct _yar_concurrent_client yar_concurrent_client;
+
+typedef enum _yar_concurrent_opt {
+	YAR_CONCURRENT_TIMEOUT = 1, /* milliseconds for a whole loop, 0 for no limit */
+	YAR_CONCURRENT_PACKAGER,    /* see YAR_OPT_PACKAGER */
+	YAR_CONCURRENT_CALL_TIMEOUT /* seconds, see YAR_CONNECT_TIMEOUT */
+} yar_concurrent_opt;
+
+yar_concurrent_client * yar_concurrent_client_init();
+int yar_concurrent_client_set_opt(yar_concurrent_client *cc, yar_concurrent_opt opt, void *val);
+const void * yar_concurrent_client_get_opt(yar_concurrent_client *cc, yar_concurrent_opt opt);
+int yar_concurrent_client_call(yar_concurrent_client *cc, char *hostname, char *method, uint num_args,
+		yar_packager *parameters[], yar_call_callback callback, void *data);
+int yar_concurrent_client_loop(yar_concurrent_client *cc);
+void yar_concurrent_client_destroy(yar_concurrent_client *cc);
+
+#endif
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -18,6 +18,8 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include "msgpack.h"
 
 #include "yar_common.h"
@@ -157,6 +159,142 @@ int yar_msgpack_encode(const yar_data *data, yar_payload *out) /* {{{ */ {
 
 /* }}} */
 
+/* encode: call envelope -> msgpack bytes, without a value tree {{{ */
+
+/* the envelope up to the "p" key, after extra_bytes left blank; the bytes
+ * are written into the buffer that becomes the payload, it is not copied */
+static msgpack_sbuffer * yar_msgpack_call_start(msgpack_packer **pk, int extra_bytes, ulong id, const char *method, uint mlen) /* {{{ */ {
+	msgpack_sbuffer *bf = msgpack_sbuffer_new();
+
+	if (!bf) {
+		return NULL;
+	}
+	bf->alloc = extra_bytes + mlen + 64;
+	if (!(bf->data = malloc(bf->alloc)) || !(*pk = msgpack_packer_new(bf, msgpack_sbuffer_write))) {
+		msgpack_sbuffer_free(bf);
+		return NULL;
+	}
+	bf->size = extra_bytes;
+
+	if (msgpack_pack_map(*pk, 3) < 0
+			|| msgpack_pack_str(*pk, 1) < 0 || msgpack_pack_str_body(*pk, "i", 1) < 0
+			|| msgpack_pack_uint64(*pk, id) < 0
+			|| msgpack_pack_str(*pk, 1) < 0 || msgpack_pack_str_body(*pk, "m", 1) < 0
+			|| msgpack_pack_str(*pk, mlen) < 0 || msgpack_pack_str_body(*pk, method, mlen) < 0
+			|| msgpack_pack_str(*pk, 1) < 0 || msgpack_pack_str_body(*pk, "p", 1) < 0) {
+		msgpack_packer_free(*pk);
+		msgpack_sbuffer_free(bf);
+		return NULL;
+	}
+
+	return bf;
+}
+/* }}} */
+
+/* out takes the buffer over */
+static int yar_msgpack_call_finish(msgpack_sbuffer *bf, msgpack_packer *pk, int ok, yar_payload *out) /* {{{ */ {
+	msgpack_packer_free(pk);
+	if (ok) {
+		out->data = bf->data;
+		out->size = bf->size;
+		bf->data = NULL;
+	}
+	msgpack_sbuffer_free(bf);
+
+	return ok;
+}
+/* }}} */
+
+static int yar_msgpack_pack_arg(msgpack_packer *pk, char spec, va_list *args) /* {{{ */ {
+	switch (spec) {
+		case 'n':
+			return msgpack_pack_nil(pk) >= 0;
+		case 'b':
+			return (va_arg(*args, int)? msgpack_pack_true(pk) : msgpack_pack_false(pk)) >= 0;
+		case 'l':
+			return msgpack_pack_int64(pk, va_arg(*args, long)) >= 0;
+		case 'u':
+			return msgpack_pack_uint64(pk, va_arg(*args, ulong)) >= 0;
+		case 'd':
+			return msgpack_pack_double(pk, va_arg(*args, double)) >= 0;
+		case 's':
+		case 'S':
+			{
+				const char *str = va_arg(*args, const char *);
+				uint len;
+
+				if (spec == 'S') {
+					len = va_arg(*args, uint);
+				} else if (str) {
+					len = strlen(str);
+				} else {
+					return msgpack_pack_nil(pk) >= 0;
+				}
+				return msgpack_pack_str(pk, len) >= 0 && msgpack_pack_str_body(pk, str, len) >= 0;
+			}
+		case 'D':
+			{
+				const yar_data *data = va_arg(*args, const yar_data *);
+
+				return data? yar_msgpack_pack_data(pk, data) : msgpack_pack_nil(pk) >= 0;
+			}
+		default:
+			return 0;
+	}
+}
+/* }}} */
+
+/* a call's {i,m,p} envelope, the parameters described by format: one
+ * character per parameter, see yar_client_callf(). No parameters are sent
+ * as nil, as for a call of no packagers. params_offset gets where the
+ * parameters start in out */
+int yar_msgpack_encode_call(yar_payload *out, int extra_bytes, ulong id, const char *method, uint mlen,
+		const char *format, va_list args, uint *params_offset) /* {{{ */ {
+	uint i, num_args = strlen(format);
+	msgpack_sbuffer *bf;
+	msgpack_packer *pk;
+	va_list ap;
+	int ok;
+
+	if (strspn(format, "nbludsSD") != num_args
+			|| !(bf = yar_msgpack_call_start(&pk, extra_bytes, id, method, mlen))) {
+		return 0;
+	}
+
+	*params_offset = bf->size;
+	if (!num_args) {
+		ok = msgpack_pack_nil(pk) >= 0;
+	} else {
+		ok = msgpack_pack_array(pk, num_args) >= 0;
+		va_copy(ap, args);
+		for (i = 0; ok && i < num_args; i++) {
+			ok = yar_msgpack_pack_arg(pk, format[i], &ap);
+		}
+		va_end(ap);
+	}
+
+	return yar_msgpack_call_finish(bf, pk, ok, out);
+}
+/* }}} */
+
+/* as yar_msgpack_encode_call(), the parameters an array value tree (or
+ * NULL for none) */
+int yar_msgpack_encode_call_data(yar_payload *out, int extra_bytes, ulong id, const char *method, uint mlen,
+		const yar_data *params, uint *params_offset) /* {{{ */ {
+	msgpack_sbuffer *bf;
+	msgpack_packer *pk;
+
+	if (!(bf = yar_msgpack_call_start(&pk, extra_bytes, id, method, mlen))) {
+		return 0;
+	}
+
+	*params_offset = bf->size;
+	return yar_msgpack_call_finish(bf, pk, params? yar_msgpack_pack_data(pk, params) : msgpack_pack_nil(pk) >= 0, out);
+}
+/* }}} */
+
+/* }}} */
+
 /* decode: msgpack bytes -> value tree {{{ */
 
 static int yar_msgpack_unpack_object(yar_packager *pk, const msgpack_object *obj) /* {{{ */ {
@@ -235,6 +373,341 @@ yar_data * yar_msgpack_decode(const char *data, uint len) /* {{{ */ {
 
 /* }}} */
 
+/* decode: msgpack bytes -> value tree, as the bytes arrive {{{ */
+
+#define YAR_MSGPACK_MAX_DEPTH 512
+
+typedef struct _yar_msgpack_frame {
+	uint total;                  /* nodes in the container, keys and values for a map */
+	uint filled;
+	int map;
+} yar_msgpack_frame;
+
+/* the parser state is kept between feeds: a token header or a string may
+ * be cut anywhere, containers are built on the way down */
+struct _yar_msgpack_stream {
+	yar_packager *pk;
+	uint left;                   /* bytes the value may take still */
+	int status;                  /* 0 going on, 1 complete, -1 failed */
+	unsigned char head[9];       /* the header of the token being read */
+	uint head_len;
+	uint head_need;
+	char *str;                   /* the body of the string being read */
+	uint str_len;
+	uint str_got;
+	yar_msgpack_frame *frames;
+	int depth;
+	int capacity;
+	/* the elements of the array under key, in the top map, are called back */
+	char *key;
+	uint klen;
+	int key_match;
+	int watch_depth;             /* of the watched array, 0 for none */
+	yar_unpack_iterator *it;
+	yar_element_callback callback;
+	void *data;
+};
+
+/* bytes of a token header after its first, -1 for the types that are not
+ * part of the yar type system (bin, ext) */
+static int yar_msgpack_head_size(unsigned char b) /* {{{ */ {
+	if (b <= 0xbf || b >= 0xe0) {
+		return 0;
+	}
+	switch (b) {
+		case 0xc0: case 0xc2: case 0xc3:
+			return 0;
+		case 0xcc: case 0xd0: case 0xd9:
+			return 1;
+		case 0xcd: case 0xd1: case 0xda: case 0xdc: case 0xde:
+			return 2;
+		case 0xca: case 0xce: case 0xd2: case 0xdb: case 0xdd: case 0xdf:
+			return 4;
+		case 0xcb: case 0xcf: case 0xd3:
+			return 8;
+		default:
+			return -1;
+	}
+}
+/* }}} */
+
+/* a value is complete, and with it maybe the containers it closes */
+static int yar_msgpack_stream_done(yar_msgpack_stream *st) /* {{{ */ {
+	while (st->depth) {
+		yar_msgpack_frame *frame = &st->frames[st->depth - 1];
+
+		if (st->depth == 1 && (frame->filled & 1)) {
+			/* a value of the top map, the next key is told afresh */
+			st->key_match = 0;
+		}
+		frame->filled++;
+		if (st->depth == st->watch_depth) {
+			st->callback(yar_unpack_iterator_current(st->it), frame->filled - 1, st->data);
+			yar_unpack_iterator_next(st->it);
+		}
+		if (frame->filled < frame->total) {
+			return 1;
+		}
+		if (st->depth == st->watch_depth) {
+			yar_unpack_iterator_free(st->it);
+			st->it = NULL;
+			st->watch_depth = 0;
+		}
+		st->depth--;
+	}
+	st->status = 1;
+
+	return 1;
+}
+/* }}} */
+
+static int yar_msgpack_stream_string(yar_msgpack_stream *st, char *str, uint len) /* {{{ */ {
+	if (st->key && st->depth == 1 && st->frames[0].map && !(st->frames[0].filled & 1)) {
+		st->key_match = len == st->klen && memcmp(str, st->key, len) == 0;
+	}
+	return yar_pack_push_string(st->pk, str, len) && yar_msgpack_stream_done(st);
+}
+/* }}} */
+
+static int yar_msgpack_stream_watch_start(yar_msgpack_stream *st, uint position) /* {{{ */ {
+	yar_unpack_iterator *it = yar_unpack_iterator_init(yar_pack_root(st->pk));
+	uint i;
+
+	if (!it) {
+		return 0;
+	}
+	for (i = 0; i < position; i++) {
+		yar_unpack_iterator_next(it);
+	}
+	st->it = yar_unpack_iterator_init(yar_unpack_iterator_current(it));
+	yar_unpack_iterator_free(it);
+	st->watch_depth = st->depth;
+
+	return st->it != NULL;
+}
+/* }}} */
+
+static int yar_msgpack_stream_open(yar_msgpack_stream *st, int map, uint64_t size) /* {{{ */ {
+	uint64_t nodes = map? size * 2 : size;
+	int watch;
+
+	/* every node takes a byte at least, a bogus size is not allocated for */
+	if (nodes > st->left) {
+		return 0;
+	}
+	watch = st->callback && !map && size && st->depth == 1 && st->frames[0].map && (st->frames[0].filled & 1) && st->key_match;
+	if (!(map? yar_pack_push_map(st->pk, size) : yar_pack_push_array(st->pk, size))) {
+		return 0;
+	}
+	if (!size) {
+		return yar_msgpack_stream_done(st);
+	}
+
+	if (st->depth == st->capacity) {
+		yar_msgpack_frame *frames;
+
+		if (st->depth == YAR_MSGPACK_MAX_DEPTH) {
+			return 0;
+		}
+		st->capacity = st->capacity? st->capacity * 2 : 8;
+		if (!(frames = realloc(st->frames, st->capacity * sizeof(yar_msgpack_frame)))) {
+			return 0;
+		}
+		st->frames = frames;
+	}
+	st->frames[st->depth].total = nodes;
+	st->frames[st->depth].filled = 0;
+	st->frames[st->depth].map = map;
+	st->depth++;
+
+	return watch? yar_msgpack_stream_watch_start(st, st->frames[0].filled) : 1;
+}
+/* }}} */
+
+/* the header in st->head is complete */
+static int yar_msgpack_stream_token(yar_msgpack_stream *st) /* {{{ */ {
+	unsigned char b = st->head[0];
+	uint64_t v = 0;
+	uint i;
+
+	for (i = 1; i < st->head_need; i++) {
+		v = (v << 8) | st->head[i];
+	}
+
+	if (b <= 0x7f) {
+		return yar_pack_push_ulong(st->pk, b) && yar_msgpack_stream_done(st);
+	} else if (b >= 0xe0) {
+		return yar_pack_push_long(st->pk, (signed char)b) && yar_msgpack_stream_done(st);
+	} else if (b <= 0x8f) {
+		return yar_msgpack_stream_open(st, 1, b & 0x0f);
+	} else if (b <= 0x9f) {
+		return yar_msgpack_stream_open(st, 0, b & 0x0f);
+	} else if (b <= 0xbf) {
+		v = b & 0x1f;
+		b = 0xd9;
+	}
+
+	switch (b) {
+		case 0xc0:
+			return yar_pack_push_null(st->pk) && yar_msgpack_stream_done(st);
+		case 0xc2:
+		case 0xc3:
+			return yar_pack_push_bool(st->pk, b == 0xc3) && yar_msgpack_stream_done(st);
+		case 0xca:
+			{
+				uint32_t bits = (uint32_t)v;
+				float num;
+
+				memcpy(&num, &bits, sizeof(num));
+				return yar_pack_push_double(st->pk, num) && yar_msgpack_stream_done(st);
+			}
+		case 0xcb:
+			{
+				double num;
+
+				memcpy(&num, &v, sizeof(num));
+				return yar_pack_push_double(st->pk, num) && yar_msgpack_stream_done(st);
+			}
+		case 0xcc: case 0xcd: case 0xce: case 0xcf:
+			return yar_pack_push_ulong(st->pk, v) && yar_msgpack_stream_done(st);
+		case 0xd0: case 0xd1: case 0xd2: case 0xd3:
+			{
+				int64_t num = b == 0xd0? (int8_t)v : b == 0xd1? (int16_t)v : b == 0xd2? (int32_t)v : (int64_t)v;
+
+				/* as msgpack-c has them, positive integers are unsigned */
+				return (num >= 0? yar_pack_push_ulong(st->pk, num) : yar_pack_push_long(st->pk, num)) && yar_msgpack_stream_done(st);
+			}
+		case 0xd9: case 0xda: case 0xdb:
+			if (v > st->left) {
+				return 0;
+			}
+			if (!v) {
+				return yar_msgpack_stream_string(st, "", 0);
+			}
+			if (!(st->str = malloc(v))) {
+				return 0;
+			}
+			st->str_len = v;
+			st->str_got = 0;
+			return 1;
+		case 0xdc: case 0xdd:
+			return yar_msgpack_stream_open(st, 0, v);
+		case 0xde: case 0xdf:
+			return yar_msgpack_stream_open(st, 1, v);
+		default:
+			return 0;
+	}
+}
+/* }}} */
+
+/* limit is the most bytes the value may take */
+yar_msgpack_stream * yar_msgpack_stream_new(uint limit) /* {{{ */ {
+	yar_msgpack_stream *st = calloc(1, sizeof(yar_msgpack_stream));
+
+	if (!st) {
+		return NULL;
+	}
+	if (!(st->pk = yar_pack_start(YAR_DATA_NULL, 0))) {
+		free(st);
+		return NULL;
+	}
+	st->left = limit;
+
+	return st;
+}
+/* }}} */
+
+/* when the value is a map with an array under key, each element of the
+ * array is called back as soon as it is complete; it stays in the tree */
+void yar_msgpack_stream_watch(yar_msgpack_stream *st, const char *key, yar_element_callback callback, void *data) /* {{{ */ {
+	free(st->key);
+	st->klen = strlen(key);
+	st->key = malloc(st->klen);
+	memcpy(st->key, key, st->klen);
+	st->callback = callback;
+	st->data = data;
+}
+/* }}} */
+
+/* 1 once the value is complete (further bytes are left alone), 0 while
+ * more are needed, -1 if the bytes are not a value of the yar type system */
+int yar_msgpack_stream_feed(yar_msgpack_stream *st, const char *data, uint len) /* {{{ */ {
+	const unsigned char *p = (const unsigned char *)data;
+
+	while (st->status == 0 && len) {
+		uint n;
+
+		if (st->str) {
+			int ok;
+
+			n = st->str_len - st->str_got;
+			n = n < len? n : len;
+			memcpy(st->str + st->str_got, p, n);
+			st->str_got += n;
+			p += n;
+			len -= n;
+			st->left -= n;
+			if (st->str_got < st->str_len) {
+				break;
+			}
+			ok = yar_msgpack_stream_string(st, st->str, st->str_len);
+			free(st->str);
+			st->str = NULL;
+			if (!ok) {
+				st->status = -1;
+			}
+			continue;
+		}
+
+		if (!st->head_len) {
+			int extra = yar_msgpack_head_size(*p);
+
+			if (extra < 0) {
+				st->status = -1;
+				break;
+			}
+			st->head_need = 1 + extra;
+		}
+		n = st->head_need - st->head_len;
+		n = n < len? n : len;
+		memcpy(st->head + st->head_len, p, n);
+		st->head_len += n;
+		p += n;
+		len -= n;
+		st->left -= n;
+		if (st->head_len < st->head_need) {
+			break;
+		}
+		st->head_len = 0;
+		if (!yar_msgpack_stream_token(st)) {
+			st->status = -1;
+		}
+	}
+
+	return st->status;
+}
+/* }}} */
+
+/* the value, once complete, NULL before; the caller owns it */
+yar_data * yar_msgpack_stream_take(yar_msgpack_stream *st) /* {{{ */ {
+	return st->status == 1? yar_pack_take_root(st->pk) : NULL;
+}
+/* }}} */
+
+void yar_msgpack_stream_free(yar_msgpack_stream *st) /* {{{ */ {
+	if (st->it) {
+		yar_unpack_iterator_free(st->it);
+	}
+	free(st->str);
+	free(st->frames);
+	free(st->key);
+	yar_pack_free(st->pk);
+	free(st);
+}
+/* }}} */
+
+/* }}} */
+
 /*
  * Local variables:
  * tab-width: 4
@@ -19,11 +19,25 @@
 #ifndef YAR_MSGPACK_H
 #define YAR_MSGPACK_H
 
+#include <stdarg.h>
 #include "yar_pack.h"
 
+typedef struct _yar_msgpack_stream yar_msgpack_stream;
+
 /* msgpack codec over the yar_data value tree */
 int yar_msgpack_encode(const yar_data *data, yar_payload *out);
 yar_data * yar_msgpack_decode(const char *data, uint len);
+/* a call envelope encoded straight from its arguments, see yar_client_callf() */
+int yar_msgpack_encode_call(yar_payload *out, int extra_bytes, ulong id, const char *method, uint mlen,
+		const char *format, va_list args, uint *params_offset);
+int yar_msgpack_encode_call_data(yar_payload *out, int extra_bytes, ulong id, const char *method, uint mlen,
+		const yar_data *params, uint *params_offset);
+/* a value decoded from bytes fed as they arrive */
+yar_msgpack_stream * yar_msgpack_stream_new(uint limit);
+void yar_msgpack_stream_watch(yar_msgpack_stream *st, const char *key, yar_element_callback callback, void *data);
+int yar_msgpack_stream_feed(yar_msgpack_stream *st, const char *data, uint len);
+yar_data * yar_msgpack_stream_take(yar_msgpack_stream *st);
+void yar_msgpack_stream_free(yar_msgpack_stream *st);
 
 #endif
 
@@ -572,6 +572,11 @@ yar_data * yar_pack_take_root(yar_packager *packager) /* {{{ */ {
 }
 /* }}} */
 
+const yar_data * yar_pack_root(yar_packager *packager) /* {{{ */ {
+	return packager->root;
+}
+/* }}} */
+
 void yar_pack_free(yar_packager *packager) /* {{{ */ {
 	if (!packager) {
 		return;
@@ -593,14 +598,19 @@ void yar_unpack_free(yar_unpackager *unpk) /* {{{ */ {
 /* }}} */
 
 yar_unpackager * yar_unpack_init(char *data, uint len, yar_packager_type type) /* {{{ */ {
-	yar_unpackager *unpk;
 	yar_data *root = yar_data_unpack(data, len, type);
 
 	if (!root) {
 		return NULL;
 	}
 
-	unpk = malloc(sizeof(yar_unpackager));
+	return yar_unpack_init_data(root);
+}
+/* }}} */
+
+yar_unpackager * yar_unpack_init_data(yar_data *root) /* {{{ */ {
+	yar_unpackager *unpk = malloc(sizeof(yar_unpackager));
+
 	if (!unpk) {
 		yar_data_free(root);
 		return NULL;
@@ -47,6 +47,9 @@ typedef struct _yar_unpackager yar_unpackager;
 typedef struct _yar_unpack_iterator yar_unpack_iterator;
 typedef struct _yar_data yar_data;
 
+/* an element of an array, handed over as soon as it is decoded */
+typedef void (*yar_element_callback)(const yar_data *element, uint index, void *data);
+
 #define yar_pack_start_null() yar_pack_start(YAR_DATA_NULL, 0)
 #define yar_pack_start_bool() yar_pack_start(YAR_DATA_BOOL, 0)
 #define yar_pack_start_long() yar_pack_start(YAR_DATA_LONG, 0)
@@ -74,6 +77,8 @@ int yar_pack_to_string(yar_packager *packager, yar_payload *payload);
 int yar_pack_encode(yar_packager *packager, yar_payload *payload, yar_packager_type type);
 /* detach and return the tree built so far (the packager keeps nothing) */
 yar_data * yar_pack_take_root(yar_packager *packager);
+/* the tree built so far, still owned by the packager */
+const yar_data * yar_pack_root(yar_packager *packager);
 void yar_pack_free(yar_packager *packager);
 
 /* value tree utilities */
@@ -93,6 +98,8 @@ int yar_packager_available(yar_packager_type type);
 /* deserialization */
 void yar_unpack_free(yar_unpackager *unpk);
 yar_unpackager * yar_unpack_init(char *data, uint len, yar_packager_type type);
+/* over a value tree decoded already, which it takes over */
+yar_unpackager * yar_unpack_init_data(yar_data *root);
 const yar_data * yar_unpack_unpack(yar_unpackager *unpk);
 
 yar_data_type yar_unpack_data_type(const yar_data *data, uint *size);
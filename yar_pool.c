@@ -0,0 +1,1369 @@
+/**
+ * Yar - Concurrent RPC Server for PHP, C etc
+ *
+ * Copyright (C) 2012-2012 Xinchen Hui <laruence at gmail dot com>
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>   /* for gettimeofday */
+#include "event.h" 		/* for libevent */
+
+#include "yar_common.h"
+#include "yar_pack.h"
+#include "yar_log.h"
+#include "yar_response.h"
+#include "yar_client.h"
+#include "yar_pool.h"
+
+#define YAR_POOL_LATENCY_SAMPLES   128
+#define YAR_POOL_HEDGE_MIN_SAMPLES 16
+
+/* an idle connection kept for reuse */
+typedef struct _yar_pool_link {
+	yar_client *client;
+	ulong since;       /* milliseconds, idle since then */
+	struct _yar_pool_link *next;
+} yar_pool_link;
+
+typedef struct _yar_pool_endpoint {
+	char *hostname;
+	yar_pool_link *idle;
+	int num_idle;
+	int outstanding;
+	ulong requests;
+	ulong failures;
+	uint consecutive;  /* failures since the last success */
+	ulong retry_at;    /* milliseconds, evicted until then */
+	int warming;       /* connections being made ahead of the calls, or pinged */
+	int removed;       /* out of the pool, freed with its last call */
+} yar_pool_endpoint;
+
+/* a virtual node on the hash ring */
+typedef struct _yar_pool_point {
+	uint hash;
+	uint index;
+} yar_pool_point;
+
+/* an asynchronous call in flight, it has a connection to itself */
+struct _yar_pool_request {
+	yar_pool *pool;
+	yar_pool_endpoint *endpoint;
+	yar_client *client;
+	yar_call *call;
+	yar_call_callback callback;
+	void *data;
+	struct _yar_pool_request *prev;
+	struct _yar_pool_request *next;
+};
+
+/* a connection made, or an idle one pinged, on the loop of yar_pool_warmup() */
+typedef struct _yar_pool_warming {
+	yar_pool *pool;
+	yar_pool_endpoint *endpoint;
+	yar_client *client;
+	int connecting;    /* waiting on ev, else a ping is in flight */
+	struct event ev;
+	struct _yar_pool_warming *prev;
+	struct _yar_pool_warming *next;
+} yar_pool_warming;
+
+struct _yar_pool {
+	yar_pool_endpoint **endpoints;
+	uint num_endpoints;
+	uint *candidates;  /* endpoints not evicted, filled in for every pick */
+	uint next;         /* where the next pick starts looking */
+	unsigned int seed;
+	int balance;
+	int max_idle;
+	int backoff;
+	int max_backoff;
+	int packager;
+	int call_timeout;
+	int connect_timeout;
+	int call_deadline;
+	int hash_parameter;
+	int virtual_nodes;
+	yar_pool_point *ring;  /* sorted by hash, NULL when it needs a rebuild */
+	uint ring_size;
+	yar_pool_request *requests;
+	int hedge_percentile;
+	int hedge_delay;
+	char **hedge_methods;
+	uint num_hedge_methods;
+	ulong latencies[YAR_POOL_LATENCY_SAMPLES];  /* milliseconds, of the last hedged calls */
+	uint num_latencies;
+	uint next_latency;
+	struct event_base *base;  /* hedged calls are run on it, made with the first */
+	int min_idle;
+	int keepalive;
+	struct event_base *warm_base;  /* of yar_pool_warmup() */
+	struct event warm_timer;
+	int warm_added;
+	yar_pool_warming *warming;
+};
+
+/* one of the two sends of a hedged call */
+typedef struct _yar_pool_leg {
+	struct _yar_pool_hedge *hedge;
+	yar_pool_request *request;  /* NULL once it is done */
+} yar_pool_leg;
+
+typedef struct _yar_pool_hedge {
+	yar_pool *pool;
+	const uint *hash;
+	char *method;
+	uint num_args;
+	yar_packager **parameters;
+	yar_pool_leg legs[2];
+	uint sent;
+	ulong start;               /* milliseconds, of the first send */
+	yar_pool_endpoint *first;  /* where the first was sent, the second goes elsewhere */
+	yar_response *response;
+	struct event timer;
+} yar_pool_hedge;
+
+static ulong yar_pool_now() /* {{{ */ {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (ulong)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+/* }}} */
+
+/* fnv-1a, with the murmur3 finalizer as fnv alone clusters similar keys */
+static uint yar_pool_hash(const char *key, uint len) /* {{{ */ {
+	uint hash = 2166136261U;
+
+	while (len--) {
+		hash ^= (unsigned char)*key++;
+		hash *= 16777619U;
+	}
+
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bU;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35U;
+	hash ^= hash >> 16;
+
+	return hash;
+}
+/* }}} */
+
+static int yar_pool_point_compare(const void *a, const void *b) /* {{{ */ {
+	const yar_pool_point *p1 = (const yar_pool_point *)a, *p2 = (const yar_pool_point *)b;
+
+	if (p1->hash != p2->hash) {
+		return p1->hash < p2->hash? -1 : 1;
+	}
+	return p1->index < p2->index? -1 : (p1->index > p2->index);
+}
+/* }}} */
+
+/* ketama: every endpoint owns virtual_nodes points, hashed from its name, so
+ * adding or removing one only moves the keys between its points and the
+ * ones before them. The same name given twice gets points of its own */
+static void yar_pool_ring_build(yar_pool *pool) /* {{{ */ {
+	uint i, j, v, num = 0;
+
+	pool->ring = malloc(sizeof(yar_pool_point) * (pool->num_endpoints * pool->virtual_nodes + 1));
+	for (i = 0; i < pool->num_endpoints; i++) {
+		char *hostname = pool->endpoints[i]->hostname;
+		uint dup = 0, size = strlen(hostname) + 32;
+		char *name = malloc(size);
+
+		for (j = 0; j < i; j++) {
+			dup += (strcmp(pool->endpoints[j]->hostname, hostname) == 0);
+		}
+		for (v = 0; v < (uint)pool->virtual_nodes; v++) {
+			int len = snprintf(name, size, "%s-%u", hostname, dup * pool->virtual_nodes + v);
+			pool->ring[num].hash = yar_pool_hash(name, len);
+			pool->ring[num++].index = i;
+		}
+		free(name);
+	}
+
+	qsort(pool->ring, num, sizeof(yar_pool_point), yar_pool_point_compare);
+	pool->ring_size = num;
+}
+/* }}} */
+
+static void yar_pool_ring_reset(yar_pool *pool) /* {{{ */ {
+	free(pool->ring);
+	pool->ring = NULL;
+	pool->ring_size = 0;
+}
+/* }}} */
+
+/* the owner of the first point at or after the hash, or the next one which
+ * is not evicted; -1 if they all are */
+static int yar_pool_ring_lookup(yar_pool *pool, uint hash, ulong now, yar_pool_endpoint *exclude) /* {{{ */ {
+	uint lo = 0, hi, i;
+
+	if (!pool->ring) {
+		yar_pool_ring_build(pool);
+	}
+
+	hi = pool->ring_size;
+	while (lo < hi) {
+		uint mid = lo + (hi - lo) / 2;
+		if (pool->ring[mid].hash < hash) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	for (i = 0; i < pool->ring_size; i++) {
+		yar_pool_point *point = &pool->ring[(lo + i) % pool->ring_size];
+		yar_pool_endpoint *endpoint = pool->endpoints[point->index];
+		if (endpoint != exclude && endpoint->retry_at <= now) {
+			return point->index;
+		}
+	}
+
+	return -1;
+}
+/* }}} */
+
+/* the key of a call made without one: the value of the hash parameter, a
+ * string or an integer hashes as the same key given to yar_pool_call_key() */
+static int yar_pool_parameter_hash(yar_pool *pool, uint num_args, yar_packager *parameters[], uint *hash) /* {{{ */ {
+	yar_payload payload;
+	yar_data *data;
+	uint size;
+
+	if (pool->balance != YAR_BALANCE_CONSISTENT_HASH
+			|| pool->hash_parameter < 0 || (uint)pool->hash_parameter >= num_args) {
+		return 0;
+	}
+	if (!yar_pack_to_string(parameters[pool->hash_parameter], &payload)) {
+		return 0;
+	}
+
+	data = yar_data_unpack(payload.data, payload.size, YAR_PACKAGER_MSGPACK);
+	switch (data? yar_unpack_data_type(data, &size) : YAR_DATA_NULL) {
+		case YAR_DATA_STRING:
+			{
+				const char *str;
+				yar_unpack_data_string(data, &str);
+				*hash = yar_pool_hash(str, size);
+			}
+		break;
+		case YAR_DATA_LONG:
+		case YAR_DATA_ULONG:
+			{
+				char buf[32];
+				long num;
+				ulong unum;
+				int len;
+
+				if (yar_unpack_data_type(data, &size) == YAR_DATA_LONG) {
+					yar_unpack_data_long(data, &num);
+					len = snprintf(buf, sizeof(buf), "%ld", num);
+				} else {
+					yar_unpack_data_ulong(data, &unum);
+					len = snprintf(buf, sizeof(buf), "%lu", unum);
+				}
+				*hash = yar_pool_hash(buf, len);
+			}
+		break;
+		default:
+			*hash = yar_pool_hash(payload.data, payload.size);
+		break;
+	}
+
+	if (data) {
+		yar_data_free(data);
+	}
+	free(payload.data);
+
+	return 1;
+}
+/* }}} */
+
+static void yar_pool_drop_idle(yar_pool_endpoint *endpoint) /* {{{ */ {
+	while (endpoint->idle) {
+		yar_pool_link *link = endpoint->idle;
+		endpoint->idle = link->next;
+		yar_client_destroy(link->client);
+		free(link);
+	}
+	endpoint->num_idle = 0;
+}
+/* }}} */
+
+/* evict the endpoint, for longer every time it fails in a row */
+static void yar_pool_fail(yar_pool *pool, yar_pool_endpoint *endpoint) /* {{{ */ {
+	ulong backoff = pool->backoff;
+	uint i;
+
+	for (i = 0; i < endpoint->consecutive && backoff < (ulong)pool->max_backoff; i++) {
+		backoff *= 2;
+	}
+	if (backoff > (ulong)pool->max_backoff) {
+		backoff = pool->max_backoff;
+	}
+
+	endpoint->failures++;
+	endpoint->consecutive++;
+	endpoint->retry_at = yar_pool_now() + backoff;
+
+	/* whatever broke this connection most likely broke the others too */
+	yar_pool_drop_idle(endpoint);
+
+	alog(YAR_WARNING, "Endpoint '%s' evicted for %lums", endpoint->hostname, backoff);
+}
+/* }}} */
+
+static void yar_pool_succeed(yar_pool_endpoint *endpoint) /* {{{ */ {
+	endpoint->consecutive = 0;
+	endpoint->retry_at = 0;
+}
+/* }}} */
+
+static void yar_pool_endpoint_free(yar_pool_endpoint *endpoint) /* {{{ */ {
+	yar_pool_drop_idle(endpoint);
+	free(endpoint->hostname);
+	free(endpoint);
+}
+/* }}} */
+
+/* a call on the endpoint is over, a removed one goes with its last call */
+static void yar_pool_endpoint_done(yar_pool_endpoint *endpoint) /* {{{ */ {
+	if (--endpoint->outstanding == 0 && !endpoint->warming && endpoint->removed) {
+		yar_pool_endpoint_free(endpoint);
+	}
+}
+/* }}} */
+
+/* hash is the key of the call, NULL if it has none; exclude is an endpoint
+ * not to pick (the one a hedged call went to first) */
+static yar_pool_endpoint * yar_pool_pick(yar_pool *pool, const uint *hash, yar_pool_endpoint *exclude) /* {{{ */ {
+	yar_pool_endpoint *soonest = NULL;
+	ulong now = yar_pool_now();
+	uint i, num = 0, chosen;
+
+	if (!pool->num_endpoints) {
+		alog(YAR_ERROR, "Pool has no endpoints");
+		return NULL;
+	}
+
+	if (hash && pool->balance == YAR_BALANCE_CONSISTENT_HASH) {
+		int index = yar_pool_ring_lookup(pool, *hash, now, exclude);
+		if (index >= 0) {
+			return pool->endpoints[index];
+		}
+	}
+
+	/* start from where the last pick left off, so ties go round */
+	for (i = 0; i < pool->num_endpoints; i++) {
+		uint index = (pool->next + i) % pool->num_endpoints;
+		yar_pool_endpoint *endpoint = pool->endpoints[index];
+
+		if (endpoint == exclude) {
+			continue;
+		}
+		if (endpoint->retry_at > now) {
+			if (!soonest || endpoint->retry_at < soonest->retry_at) {
+				soonest = endpoint;
+			}
+			continue;
+		}
+		pool->candidates[num++] = index;
+	}
+
+	if (!num) {
+		/* all evicted, rather than failing, try the one due back first */
+		return soonest;
+	}
+
+	switch (pool->balance) {
+		case YAR_BALANCE_LEAST_OUTSTANDING:
+			chosen = pool->candidates[0];
+			for (i = 1; i < num; i++) {
+				if (pool->endpoints[pool->candidates[i]]->outstanding < pool->endpoints[chosen]->outstanding) {
+					chosen = pool->candidates[i];
+				}
+			}
+		break;
+		case YAR_BALANCE_TWO_CHOICES:
+			chosen = pool->candidates[rand_r(&pool->seed) % num];
+			if (num > 1) {
+				/* a second one, different from the first */
+				uint first = chosen, other;
+				for (i = 0; pool->candidates[i] != first; i++);
+				other = rand_r(&pool->seed) % (num - 1);
+				other = pool->candidates[other >= i? other + 1 : other];
+				if (pool->endpoints[other]->outstanding < pool->endpoints[first]->outstanding) {
+					chosen = other;
+				}
+			}
+		break;
+		default:
+			/* and consistent hashing for calls without a key */
+			chosen = pool->candidates[0];
+		break;
+	}
+
+	pool->next = (chosen + 1) % pool->num_endpoints;
+
+	return pool->endpoints[chosen];
+}
+/* }}} */
+
+/* a client for the endpoint with the options of the pool, not connected */
+static yar_client * yar_pool_client_new(yar_pool *pool, yar_pool_endpoint *endpoint) /* {{{ */ {
+	int persistent = 1;
+	yar_client *client;
+
+	if (!(client = yar_client_new(endpoint->hostname))) {
+		return NULL;
+	}
+	yar_client_set_opt(client, YAR_PERSISTENT_LINK, &persistent);
+	yar_client_set_opt(client, YAR_CONNECT_TIMEOUT, &pool->call_timeout);
+	yar_client_set_opt(client, YAR_CONNECT_TIMEOUT_MS, &pool->connect_timeout);
+	yar_client_set_opt(client, YAR_CALL_DEADLINE_MS, &pool->call_deadline);
+	yar_client_set_opt(client, YAR_OPT_PACKAGER, &pool->packager);
+
+	return client;
+}
+/* }}} */
+
+/* an idle connection to the endpoint, a new one if there are none; with
+ * background the new one is not connected, an asynchronous call connects it
+ * on its loop */
+static yar_client * yar_pool_acquire(yar_pool *pool, yar_pool_endpoint *endpoint, int background) /* {{{ */ {
+	yar_client *client;
+
+	while (endpoint->idle) {
+		yar_pool_link *link = endpoint->idle;
+
+		endpoint->idle = link->next;
+		endpoint->num_idle--;
+		client = link->client;
+		free(link);
+		if (yar_client_alive(client)) {
+			return client;
+		}
+		/* closed by the server while idle, not a failure */
+		yar_client_destroy(client);
+	}
+
+	if (!(client = yar_pool_client_new(pool, endpoint))) {
+		return NULL;
+	}
+	if (!background && !yar_client_connect(client)) {
+		yar_client_destroy(client);
+		return NULL;
+	}
+
+	return client;
+}
+/* }}} */
+
+static void yar_pool_release(yar_pool *pool, yar_pool_endpoint *endpoint, yar_client *client) /* {{{ */ {
+	yar_pool_link *link;
+
+	/* the answer to a cancelled call may still be on its way */
+	if (client->fd <= 0 || client->pending || endpoint->removed || endpoint->num_idle >= pool->max_idle) {
+		yar_client_destroy(client);
+		return;
+	}
+
+	link = malloc(sizeof(yar_pool_link));
+	link->client = client;
+	link->since = yar_pool_now();
+	link->next = endpoint->idle;
+	endpoint->idle = link;
+	endpoint->num_idle++;
+}
+/* }}} */
+
+/* pick an endpoint and get a connection to it, an endpoint which can not be
+ * connected to is evicted and the next one is tried */
+static yar_client * yar_pool_connect(yar_pool *pool, const uint *hash, yar_pool_endpoint *exclude, yar_pool_endpoint **endpoint, int background) /* {{{ */ {
+	uint attempts = pool->num_endpoints;
+	yar_client *client;
+
+	do {
+		if (!(*endpoint = yar_pool_pick(pool, hash, exclude))) {
+			return NULL;
+		}
+		if ((client = yar_pool_acquire(pool, *endpoint, background))) {
+			return client;
+		}
+		yar_pool_fail(pool, *endpoint);
+	} while (--attempts);
+
+	alog(YAR_ERROR, "No endpoint in the pool could be connected to");
+	return NULL;
+}
+/* }}} */
+
+static void yar_pool_request_unlink(yar_pool_request *request) /* {{{ */ {
+	yar_pool *pool = request->pool;
+
+	if (request->prev) {
+		request->prev->next = request->next;
+	} else {
+		pool->requests = request->next;
+	}
+	if (request->next) {
+		request->next->prev = request->prev;
+	}
+}
+/* }}} */
+
+static void yar_pool_on_complete(yar_response *response, void *data) /* {{{ */ {
+	yar_pool_request *request = (yar_pool_request *)data;
+	yar_pool_endpoint *endpoint = request->endpoint;
+	yar_call_callback callback = request->callback;
+
+	data = request->data;
+	yar_pool_request_unlink(request);
+	if (response) {
+		yar_pool_succeed(endpoint);
+		yar_pool_release(request->pool, endpoint, request->client);
+	} else {
+		yar_pool_fail(request->pool, endpoint);
+		yar_client_destroy(request->client);
+	}
+	yar_pool_endpoint_done(endpoint);
+	free(request);
+
+	/* the pool is done with the call, the callback may destroy it */
+	callback(response, data);
+}
+/* }}} */
+
+static void yar_pool_warming_free(yar_pool_warming *warming) /* {{{ */ {
+	yar_pool *pool = warming->pool;
+	yar_pool_endpoint *endpoint = warming->endpoint;
+
+	if (warming->prev) {
+		warming->prev->next = warming->next;
+	} else {
+		pool->warming = warming->next;
+	}
+	if (warming->next) {
+		warming->next->prev = warming->prev;
+	}
+	free(warming);
+
+	if (--endpoint->warming == 0 && !endpoint->outstanding && endpoint->removed) {
+		yar_pool_endpoint_free(endpoint);
+	}
+}
+/* }}} */
+
+static void yar_pool_warming_link(yar_pool_warming *warming) /* {{{ */ {
+	yar_pool *pool = warming->pool;
+
+	warming->next = pool->warming;
+	if (warming->next) {
+		warming->next->prev = warming;
+	}
+	pool->warming = warming;
+	warming->endpoint->warming++;
+}
+/* }}} */
+
+static void yar_pool_warm_on_connect(int fd, short event, void *data) /* {{{ */ {
+	yar_pool_warming *warming = (yar_pool_warming *)data;
+	yar_pool_endpoint *endpoint = warming->endpoint;
+	yar_client *client = warming->client;
+	int connected = 0;
+
+	if (event & EV_TIMEOUT) {
+		alog(YAR_ERROR, "Connect to '%s' timed out", endpoint->hostname);
+	} else {
+		connected = yar_client_connect_end(client);
+	}
+
+	if (connected) {
+		yar_pool_succeed(endpoint);
+		yar_pool_release(warming->pool, endpoint, client);
+	} else {
+		/* the connects started with it failed for the same reason, the
+		 * first one evicted the endpoint already */
+		if (!endpoint->removed && endpoint->retry_at <= yar_pool_now()) {
+			yar_pool_fail(warming->pool, endpoint);
+		}
+		yar_client_destroy(client);
+	}
+	yar_pool_warming_free(warming);
+}
+/* }}} */
+
+/* start a connect to the endpoint for the loop to finish, returns 0 if it
+ * failed at once */
+static int yar_pool_warm_start(yar_pool *pool, yar_pool_endpoint *endpoint) /* {{{ */ {
+	yar_pool_warming *warming;
+	yar_client *client;
+	struct timeval tv;
+	int timeout;
+
+	if (!(client = yar_pool_client_new(pool, endpoint))) {
+		return 0;
+	}
+
+	switch (yar_client_connect_begin(client)) {
+		case -1:
+			yar_client_destroy(client);
+			yar_pool_fail(pool, endpoint);
+			return 0;
+		case 1:
+			yar_pool_release(pool, endpoint, client);
+			return 1;
+	}
+
+	warming = calloc(1, sizeof(yar_pool_warming));
+	warming->pool = pool;
+	warming->endpoint = endpoint;
+	warming->client = client;
+	warming->connecting = 1;
+	yar_pool_warming_link(warming);
+
+	timeout = client->connect_timeout? client->connect_timeout : 1000;
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	event_set(&warming->ev, client->fd, EV_WRITE, yar_pool_warm_on_connect, warming);
+	event_base_set(pool->warm_base, &warming->ev);
+	event_add(&warming->ev, &tv);
+
+	return 1;
+}
+/* }}} */
+
+/* bring every endpoint not evicted up to min_idle connections, idle or
+ * being made */
+static void yar_pool_warm(yar_pool *pool) /* {{{ */ {
+	int want = pool->min_idle < pool->max_idle? pool->min_idle : pool->max_idle;
+	ulong now = yar_pool_now();
+	uint i;
+
+	for (i = 0; i < pool->num_endpoints; i++) {
+		yar_pool_endpoint *endpoint = pool->endpoints[i];
+
+		while (endpoint->retry_at <= now && endpoint->num_idle + endpoint->warming < want) {
+			if (!yar_pool_warm_start(pool, endpoint)) {
+				break;
+			}
+		}
+	}
+}
+/* }}} */
+
+static void yar_pool_warm_on_ping(yar_response *response, void *data) /* {{{ */ {
+	yar_pool_warming *warming = (yar_pool_warming *)data;
+
+	if (response) {
+		yar_response_free(response);
+		free(response);
+		yar_pool_release(warming->pool, warming->endpoint, warming->client);
+	} else {
+		/* not a failure of the endpoint, yar_pool_warm() makes another */
+		alog(YAR_DEBUG, "Idle connection to '%s' did not answer a ping", warming->endpoint->hostname);
+		yar_client_destroy(warming->client);
+	}
+	yar_pool_warming_free(warming);
+}
+/* }}} */
+
+/* ping the connections which were idle since the last round, so neither the
+ * server nor anything in between closes them. The pings are sent from the
+ * loop and not waited for: a connection is out of the idle ones until its
+ * answer is back, and dropped if none comes. The ones closed already are
+ * dropped at once, yar_pool_warm() makes them again */
+static void yar_pool_keepalive(yar_pool *pool) /* {{{ */ {
+	ulong now = yar_pool_now();
+	uint i;
+
+	for (i = 0; i < pool->num_endpoints; i++) {
+		yar_pool_endpoint *endpoint = pool->endpoints[i];
+		yar_pool_link **link = &endpoint->idle;
+
+		while (*link) {
+			yar_pool_link *current = *link;
+			yar_pool_warming *warming;
+			yar_client *client;
+
+			if (now - current->since < (ulong)pool->keepalive) {
+				link = &current->next;
+				continue;
+			}
+			*link = current->next;
+			endpoint->num_idle--;
+			client = current->client;
+			free(current);
+
+			/* a closed one is not pinged, that would connect it again */
+			if (!yar_client_alive(client)) {
+				yar_client_destroy(client);
+				continue;
+			}
+			warming = calloc(1, sizeof(yar_pool_warming));
+			warming->pool = pool;
+			warming->endpoint = endpoint;
+			warming->client = client;
+			if (!yar_client_ping_async(client, pool->warm_base, yar_pool_warm_on_ping, warming)) {
+				yar_client_destroy(client);
+				free(warming);
+				continue;
+			}
+			yar_pool_warming_link(warming);
+		}
+	}
+}
+/* }}} */
+
+static void yar_pool_warm_arm(yar_pool *pool) /* {{{ */ {
+	struct timeval tv;
+
+	if (!pool->warm_base || !pool->keepalive || pool->warm_added) {
+		return;
+	}
+
+	tv.tv_sec = pool->keepalive / 1000;
+	tv.tv_usec = (pool->keepalive % 1000) * 1000;
+	evtimer_add(&pool->warm_timer, &tv);
+	pool->warm_added = 1;
+}
+/* }}} */
+
+static void yar_pool_warm_on_timer(int fd, short event, void *data) /* {{{ */ {
+	yar_pool *pool = (yar_pool *)data;
+
+	pool->warm_added = 0;
+	if (pool->keepalive) {
+		yar_pool_keepalive(pool);
+		yar_pool_warm(pool);
+	}
+	yar_pool_warm_arm(pool);
+}
+/* }}} */
+
+yar_pool * yar_pool_init(char *hostnames[], uint num_hosts) /* {{{ */ {
+	yar_pool *pool = calloc(1, sizeof(yar_pool));
+	uint i;
+
+	pool->max_idle = 8;
+	pool->backoff = 1000;
+	pool->max_backoff = 30000;
+	pool->hash_parameter = -1;
+	pool->virtual_nodes = 160;
+	pool->hedge_delay = 10;
+	pool->seed = getpid() ^ yar_pool_now();
+
+	for (i = 0; i < num_hosts; i++) {
+		if (!yar_pool_add_endpoint(pool, hostnames[i])) {
+			yar_pool_destroy(pool);
+			return NULL;
+		}
+	}
+
+	return pool;
+}
+/* }}} */
+
+int yar_pool_set_opt(yar_pool *pool, yar_pool_opt opt, void *val) /* {{{ */ {
+	switch (opt) {
+		case YAR_POOL_BALANCE:
+			if (*(int *)val < YAR_BALANCE_ROUND_ROBIN || *(int *)val > YAR_BALANCE_CONSISTENT_HASH) {
+				return 0;
+			}
+			pool->balance = *(int *)val;
+		break;
+		case YAR_POOL_MAX_IDLE:
+			if (*(int *)val < 0) {
+				return 0;
+			}
+			pool->max_idle = *(int *)val;
+		break;
+		case YAR_POOL_BACKOFF:
+			if (*(int *)val < 0) {
+				return 0;
+			}
+			pool->backoff = *(int *)val;
+		break;
+		case YAR_POOL_MAX_BACKOFF:
+			if (*(int *)val < 0) {
+				return 0;
+			}
+			pool->max_backoff = *(int *)val;
+		break;
+		case YAR_POOL_PACKAGER:
+			pool->packager = *(int *)val;
+		break;
+		case YAR_POOL_CALL_TIMEOUT:
+			pool->call_timeout = *(int *)val;
+		break;
+		case YAR_POOL_HASH_PARAMETER:
+			pool->hash_parameter = *(int *)val;
+		break;
+		case YAR_POOL_CONNECT_TIMEOUT:
+			if (*(int *)val < 0) {
+				return 0;
+			}
+			pool->connect_timeout = *(int *)val;
+		break;
+		case YAR_POOL_CALL_DEADLINE:
+			if (*(int *)val < 0) {
+				return 0;
+			}
+			pool->call_deadline = *(int *)val;
+		break;
+		case YAR_POOL_HEDGE_PERCENTILE:
+			if (*(int *)val < 0 || *(int *)val > 100) {
+				return 0;
+			}
+			pool->hedge_percentile = *(int *)val;
+		break;
+		case YAR_POOL_HEDGE_DELAY:
+			if (*(int *)val < 0) {
+				return 0;
+			}
+			pool->hedge_delay = *(int *)val;
+		break;
+		case YAR_POOL_MIN_IDLE:
+			if (*(int *)val < 0) {
+				return 0;
+			}
+			pool->min_idle = *(int *)val;
+		break;
+		case YAR_POOL_KEEPALIVE:
+			if (*(int *)val < 0) {
+				return 0;
+			}
+			pool->keepalive = *(int *)val;
+			yar_pool_warm_arm(pool);
+		break;
+		case YAR_POOL_VIRTUAL_NODES:
+			if (*(int *)val <= 0) {
+				return 0;
+			}
+			pool->virtual_nodes = *(int *)val;
+			yar_pool_ring_reset(pool);
+		break;
+		default:
+			return 0;
+	}
+	return 1;
+}
+/* }}} */
+
+const void * yar_pool_get_opt(yar_pool *pool, yar_pool_opt opt) /* {{{ */ {
+	switch (opt) {
+		case YAR_POOL_BALANCE:
+			return &pool->balance;
+		break;
+		case YAR_POOL_MAX_IDLE:
+			return &pool->max_idle;
+		break;
+		case YAR_POOL_BACKOFF:
+			return &pool->backoff;
+		break;
+		case YAR_POOL_MAX_BACKOFF:
+			return &pool->max_backoff;
+		break;
+		case YAR_POOL_PACKAGER:
+			return &pool->packager;
+		break;
+		case YAR_POOL_CALL_TIMEOUT:
+			return &pool->call_timeout;
+		break;
+		case YAR_POOL_HASH_PARAMETER:
+			return &pool->hash_parameter;
+		break;
+		case YAR_POOL_VIRTUAL_NODES:
+			return &pool->virtual_nodes;
+		break;
+		case YAR_POOL_CONNECT_TIMEOUT:
+			return &pool->connect_timeout;
+		break;
+		case YAR_POOL_CALL_DEADLINE:
+			return &pool->call_deadline;
+		break;
+		case YAR_POOL_HEDGE_PERCENTILE:
+			return &pool->hedge_percentile;
+		break;
+		case YAR_POOL_HEDGE_DELAY:
+			return &pool->hedge_delay;
+		break;
+		case YAR_POOL_MIN_IDLE:
+			return &pool->min_idle;
+		break;
+		case YAR_POOL_KEEPALIVE:
+			return &pool->keepalive;
+		break;
+		default:
+			return NULL;
+	}
+}
+/* }}} */
+
+/* nothing is connected here, connections are made as calls need them */
+int yar_pool_add_endpoint(yar_pool *pool, char *hostname) /* {{{ */ {
+	yar_pool_endpoint *endpoint;
+
+	if (!hostname || !*hostname) {
+		alog(YAR_ERROR, "Empty endpoint host name");
+		return 0;
+	}
+
+	endpoint = calloc(1, sizeof(yar_pool_endpoint));
+	/* the clients keep a pointer to the name, it must live as long */
+	endpoint->hostname = strdup(hostname);
+
+	pool->endpoints = realloc(pool->endpoints, sizeof(yar_pool_endpoint *) * (pool->num_endpoints + 1));
+	pool->candidates = realloc(pool->candidates, sizeof(uint) * (pool->num_endpoints + 1));
+	pool->endpoints[pool->num_endpoints++] = endpoint;
+	yar_pool_ring_reset(pool);
+
+	return 1;
+}
+/* }}} */
+
+/* the endpoints after it move down by one; its calls in flight complete as
+ * usual, but their connections are closed */
+int yar_pool_remove_endpoint(yar_pool *pool, uint index) /* {{{ */ {
+	yar_pool_endpoint *endpoint;
+
+	if (index >= pool->num_endpoints) {
+		return 0;
+	}
+
+	endpoint = pool->endpoints[index];
+	memmove(pool->endpoints + index, pool->endpoints + index + 1, sizeof(yar_pool_endpoint *) * (pool->num_endpoints - index - 1));
+	pool->num_endpoints--;
+	if (pool->next >= pool->num_endpoints) {
+		pool->next = 0;
+	}
+	yar_pool_ring_reset(pool);
+
+	if (endpoint->outstanding || endpoint->warming) {
+		endpoint->removed = 1;
+		yar_pool_drop_idle(endpoint);
+	} else {
+		yar_pool_endpoint_free(endpoint);
+	}
+
+	return 1;
+}
+/* }}} */
+
+/* the connects are finished by the loop on base, which with
+ * YAR_POOL_KEEPALIVE keeps running to keep them up; the pool has to be
+ * destroyed before base is freed */
+int yar_pool_warmup(yar_pool *pool, struct event_base *base) /* {{{ */ {
+	if (pool->warm_base && pool->warm_base != base) {
+		alog(YAR_ERROR, "Pool is warmed up on another event base");
+		return 0;
+	}
+
+	if (!pool->warm_base) {
+		pool->warm_base = base;
+		evtimer_set(&pool->warm_timer, yar_pool_warm_on_timer, pool);
+		event_base_set(base, &pool->warm_timer);
+	}
+	yar_pool_warm(pool);
+	yar_pool_warm_arm(pool);
+
+	return 1;
+}
+/* }}} */
+
+/* only calls which are safe to run twice should be listed */
+int yar_pool_hedge_method(yar_pool *pool, const char *method) /* {{{ */ {
+	if (!method || !*method) {
+		return 0;
+	}
+
+	pool->hedge_methods = realloc(pool->hedge_methods, sizeof(char *) * (pool->num_hedge_methods + 1));
+	pool->hedge_methods[pool->num_hedge_methods++] = strdup(method);
+
+	return 1;
+}
+/* }}} */
+
+int yar_pool_key_endpoint(yar_pool *pool, const char *key, uint key_len) /* {{{ */ {
+	uint hash = yar_pool_hash(key, key_len);
+
+	if (!pool->num_endpoints) {
+		return -1;
+	}
+	return yar_pool_ring_lookup(pool, hash, yar_pool_now(), NULL);
+}
+/* }}} */
+
+int yar_pool_get_endpoint(yar_pool *pool, uint index, yar_pool_endpoint_info *info) /* {{{ */ {
+	yar_pool_endpoint *endpoint;
+
+	if (index >= pool->num_endpoints) {
+		return 0;
+	}
+
+	endpoint = pool->endpoints[index];
+	info->hostname = endpoint->hostname;
+	info->outstanding = endpoint->outstanding;
+	info->idle = endpoint->num_idle;
+	info->warming = endpoint->warming;
+	info->requests = endpoint->requests;
+	info->failures = endpoint->failures;
+	info->down = endpoint->retry_at > yar_pool_now();
+
+	return 1;
+}
+/* }}} */
+
+/* a call that fails once its request has been sent is not tried again on
+ * another endpoint, the server may have run it already */
+static yar_response * yar_pool_caller(yar_pool *pool, const uint *hash, char *method, uint num_args, yar_packager *parameters[]) /* {{{ */ {
+	yar_pool_endpoint *endpoint;
+	yar_response *response;
+	yar_client *client;
+
+	if (!(client = yar_pool_connect(pool, hash, NULL, &endpoint, 0))) {
+		return NULL;
+	}
+
+	endpoint->requests++;
+	endpoint->outstanding++;
+	response = client->call(client, method, num_args, parameters);
+
+	if (!response) {
+		yar_pool_fail(pool, endpoint);
+		yar_client_destroy(client);
+	} else {
+		yar_pool_succeed(endpoint);
+		yar_pool_release(pool, endpoint, client);
+	}
+	yar_pool_endpoint_done(endpoint);
+
+	return response;
+}
+/* }}} */
+
+static int yar_pool_hedged(yar_pool *pool, const char *method) /* {{{ */ {
+	uint i;
+
+	if (!pool->hedge_percentile || pool->num_endpoints < 2) {
+		return 0;
+	}
+	for (i = 0; i < pool->num_hedge_methods; i++) {
+		if (strcmp(pool->hedge_methods[i], method) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+/* }}} */
+
+static yar_response * yar_pool_caller_hedged(yar_pool *pool, const uint *hash, char *method, uint num_args, yar_packager *parameters[]);
+
+yar_response * yar_pool_call(yar_pool *pool, char *method, uint num_args, yar_packager *parameters[]) /* {{{ */ {
+	uint hash, *key = NULL;
+
+	if (yar_pool_parameter_hash(pool, num_args, parameters, &hash)) {
+		key = &hash;
+	}
+	if (yar_pool_hedged(pool, method)) {
+		return yar_pool_caller_hedged(pool, key, method, num_args, parameters);
+	}
+	return yar_pool_caller(pool, key, method, num_args, parameters);
+}
+/* }}} */
+
+yar_response * yar_pool_call_key(yar_pool *pool, const char *key, uint key_len, char *method, uint num_args, yar_packager *parameters[]) /* {{{ */ {
+	uint hash = yar_pool_hash(key, key_len);
+
+	if (yar_pool_hedged(pool, method)) {
+		return yar_pool_caller_hedged(pool, &hash, method, num_args, parameters);
+	}
+	return yar_pool_caller(pool, &hash, method, num_args, parameters);
+}
+/* }}} */
+
+/* every call gets a connection to itself, as yar_client_call_async(), the
+ * callback runs from the loop on base; a new connection is made in the
+ * background of that loop too, an endpoint whose connect fails at once is
+ * evicted and the next one is tried */
+static yar_pool_request * yar_pool_caller_async(yar_pool *pool, const uint *hash, yar_pool_endpoint *exclude, struct event_base *base,
+		char *method, uint num_args, yar_packager *parameters[], yar_call_callback callback, void *data) /* {{{ */ {
+	uint attempts = pool->num_endpoints;
+	yar_pool_endpoint *endpoint;
+	yar_pool_request *request;
+	yar_client *client;
+
+	request = calloc(1, sizeof(yar_pool_request));
+	request->pool = pool;
+	request->callback = callback;
+	request->data = data;
+
+	do {
+		if (!(client = yar_pool_connect(pool, hash, exclude, &endpoint, 1))) {
+			free(request);
+			return NULL;
+		}
+		request->endpoint = endpoint;
+		request->client = client;
+		if ((request->call = yar_client_call_async(client, base, method, num_args, parameters, yar_pool_on_complete, request))) {
+			break;
+		}
+		if (client->fd > 0) {
+			/* connected, the request could not be packed */
+			yar_pool_release(pool, endpoint, client);
+			free(request);
+			return NULL;
+		}
+		yar_pool_fail(pool, endpoint);
+		yar_client_destroy(client);
+	} while (--attempts);
+
+	if (!request->call) {
+		alog(YAR_ERROR, "No endpoint in the pool could be connected to");
+		free(request);
+		return NULL;
+	}
+
+	endpoint->requests++;
+	endpoint->outstanding++;
+
+	request->next = pool->requests;
+	if (request->next) {
+		request->next->prev = request;
+	}
+	pool->requests = request;
+
+	return request;
+}
+/* }}} */
+
+yar_pool_request * yar_pool_call_async(yar_pool *pool, struct event_base *base, char *method, uint num_args,
+		yar_packager *parameters[], yar_call_callback callback, void *data) /* {{{ */ {
+	uint hash;
+
+	if (yar_pool_parameter_hash(pool, num_args, parameters, &hash)) {
+		return yar_pool_caller_async(pool, &hash, NULL, base, method, num_args, parameters, callback, data);
+	}
+	return yar_pool_caller_async(pool, NULL, NULL, base, method, num_args, parameters, callback, data);
+}
+/* }}} */
+
+yar_pool_request * yar_pool_call_async_key(yar_pool *pool, struct event_base *base, const char *key, uint key_len,
+		char *method, uint num_args, yar_packager *parameters[], yar_call_callback callback, void *data) /* {{{ */ {
+	uint hash = yar_pool_hash(key, key_len);
+
+	return yar_pool_caller_async(pool, &hash, NULL, base, method, num_args, parameters, callback, data);
+}
+/* }}} */
+
+/* the callback is not called, a connection which has sent (part of) the
+ * request already is closed */
+void yar_pool_request_cancel(yar_pool_request *request) /* {{{ */ {
+	yar_call_cancel(request->call);
+	yar_pool_request_unlink(request);
+	yar_pool_release(request->pool, request->endpoint, request->client);
+	yar_pool_endpoint_done(request->endpoint);
+	free(request);
+}
+/* }}} */
+
+static int yar_pool_latency_compare(const void *a, const void *b) /* {{{ */ {
+	ulong l1 = *(const ulong *)a, l2 = *(const ulong *)b;
+
+	return l1 < l2? -1 : (l1 > l2);
+}
+/* }}} */
+
+/* how long a hedged call waits for its first send before it sends again:
+ * the chosen percentile of the recent latencies, never below hedge_delay,
+ * which is also used until there are enough of them */
+static ulong yar_pool_hedge_wait(yar_pool *pool) /* {{{ */ {
+	ulong sorted[YAR_POOL_LATENCY_SAMPLES], wait;
+	uint num = pool->num_latencies;
+
+	if (num < YAR_POOL_HEDGE_MIN_SAMPLES) {
+		return pool->hedge_delay;
+	}
+
+	memcpy(sorted, pool->latencies, sizeof(ulong) * num);
+	qsort(sorted, num, sizeof(ulong), yar_pool_latency_compare);
+	wait = sorted[(num - 1) * pool->hedge_percentile / 100];
+
+	return wait > (ulong)pool->hedge_delay? wait : (ulong)pool->hedge_delay;
+}
+/* }}} */
+
+static void yar_pool_hedge_on_complete(yar_response *response, void *data);
+
+static int yar_pool_hedge_send(yar_pool_hedge *hedge) /* {{{ */ {
+	yar_pool_leg *leg = &hedge->legs[hedge->sent];
+	yar_pool *pool = hedge->pool;
+
+	leg->hedge = hedge;
+	if (!(leg->request = yar_pool_caller_async(pool, hedge->hash, hedge->first, pool->base,
+					hedge->method, hedge->num_args, hedge->parameters, yar_pool_hedge_on_complete, leg))) {
+		return 0;
+	}
+
+	if (!hedge->sent) {
+		hedge->first = leg->request->endpoint;
+	}
+	hedge->sent++;
+
+	return 1;
+}
+/* }}} */
+
+/* the first answer wins and the other send is cancelled; if one fails the
+ * other is waited for, or sent right away if it was not yet */
+static void yar_pool_hedge_on_complete(yar_response *response, void *data) /* {{{ */ {
+	yar_pool_leg *leg = (yar_pool_leg *)data;
+	yar_pool_hedge *hedge = leg->hedge;
+	yar_pool_leg *other = (leg == &hedge->legs[0])? &hedge->legs[1] : &hedge->legs[0];
+	yar_pool *pool = hedge->pool;
+
+	/* the pool has freed it already */
+	leg->request = NULL;
+
+	if (response) {
+		/* the time to the first answer from the first send, as the latency of
+		 * the call: the time of the winning send alone would only ever keep
+		 * the fast ones, and hedge earlier and earlier */
+		pool->latencies[pool->next_latency] = yar_pool_now() - hedge->start;
+		pool->next_latency = (pool->next_latency + 1) % YAR_POOL_LATENCY_SAMPLES;
+		if (pool->num_latencies < YAR_POOL_LATENCY_SAMPLES) {
+			pool->num_latencies++;
+		}
+
+		hedge->response = response;
+		if (other->request) {
+			yar_pool_request_cancel(other->request);
+			other->request = NULL;
+		}
+		evtimer_del(&hedge->timer);
+		return;
+	}
+
+	if (!other->request && hedge->sent < 2) {
+		evtimer_del(&hedge->timer);
+		yar_pool_hedge_send(hedge);
+	}
+}
+/* }}} */
+
+static void yar_pool_hedge_on_timer(int fd, short event, void *data) /* {{{ */ {
+	yar_pool_hedge *hedge = (yar_pool_hedge *)data;
+
+	alog(YAR_DEBUG, "Hedging call to '%s' on another endpoint", hedge->method);
+	yar_pool_hedge_send(hedge);
+}
+/* }}} */
+
+/* the loop ends once nothing of the call is left on it */
+static yar_response * yar_pool_caller_hedged(yar_pool *pool, const uint *hash, char *method, uint num_args, yar_packager *parameters[]) /* {{{ */ {
+	yar_pool_hedge hedge;
+	struct timeval tv;
+	ulong wait;
+
+	if (!pool->base && !(pool->base = event_base_new())) {
+		alog(YAR_ERROR, "Failed to create the event base for hedged calls");
+		return NULL;
+	}
+
+	memset(&hedge, 0, sizeof(yar_pool_hedge));
+	hedge.pool = pool;
+	hedge.hash = hash;
+	hedge.method = method;
+	hedge.num_args = num_args;
+	hedge.parameters = parameters;
+	evtimer_set(&hedge.timer, yar_pool_hedge_on_timer, &hedge);
+	event_base_set(pool->base, &hedge.timer);
+
+	hedge.start = yar_pool_now();
+	if (!yar_pool_hedge_send(&hedge)) {
+		return NULL;
+	}
+
+	wait = yar_pool_hedge_wait(pool);
+	tv.tv_sec = wait / 1000;
+	tv.tv_usec = (wait % 1000) * 1000;
+	evtimer_add(&hedge.timer, &tv);
+
+	event_base_dispatch(pool->base);
+
+	return hedge.response;
+}
+/* }}} */
+
+void yar_pool_destroy(yar_pool *pool) /* {{{ */ {
+	uint i;
+
+	while (pool->warming) {
+		yar_pool_warming *warming = pool->warming;
+		if (warming->connecting) {
+			event_del(&warming->ev);
+		}
+		/* a ping in flight goes with its client */
+		yar_client_destroy(warming->client);
+		yar_pool_warming_free(warming);
+	}
+	if (pool->warm_added) {
+		evtimer_del(&pool->warm_timer);
+	}
+
+	/* calls in flight are dropped, their callbacks are not called */
+	while (pool->requests) {
+		yar_pool_request *request = pool->requests;
+		pool->requests = request->next;
+		yar_client_destroy(request->client);
+		yar_pool_endpoint_done(request->endpoint);
+		free(request);
+	}
+
+	for (i = 0; i < pool->num_endpoints; i++) {
+		yar_pool_endpoint_free(pool->endpoints[i]);
+	}
+
+	for (i = 0; i < pool->num_hedge_methods; i++) {
+		free(pool->hedge_methods[i]);
+	}
+	free(pool->hedge_methods);
+	if (pool->base) {
+		event_base_free(pool->base);
+	}
+
+	yar_pool_ring_reset(pool);
+	free(pool->endpoints);
+	free(pool->candidates);
+	free(pool);
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
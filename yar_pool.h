@@ -0,0 +1,84 @@
+/**
+ * Yar - Concurrent RPC Server for PHP, C etc
+ *
+ * Copyright (C) 2012-2012 Xinchen Hui <laruence at gmail dot com>
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef YAR_POOL_H
+#define YAR_POOL_H
+
+#define YAR_BALANCE_ROUND_ROBIN 0
+#define YAR_BALANCE_LEAST_OUTSTANDING 1
+#define YAR_BALANCE_TWO_CHOICES 2
+#define YAR_BALANCE_CONSISTENT_HASH 3
+
+typedef struct _yar_pool yar_pool;
+typedef struct _yar_pool_request yar_pool_request;
+
+typedef enum _yar_pool_opt {
+	YAR_POOL_BALANCE = 1,     /* one of YAR_BALANCE_*, round robin by default */
+	YAR_POOL_MAX_IDLE,        /* idle connections kept per endpoint */
+	YAR_POOL_BACKOFF,         /* milliseconds an endpoint is evicted for after its first failure */
+	YAR_POOL_MAX_BACKOFF,     /* milliseconds, the backoff doubles with every failure up to this */
+	YAR_POOL_PACKAGER,        /* see YAR_OPT_PACKAGER */
+	YAR_POOL_CALL_TIMEOUT,    /* seconds, see YAR_CONNECT_TIMEOUT */
+	YAR_POOL_HASH_PARAMETER,  /* index of the parameter calls without a key are hashed on, -1 for none */
+	YAR_POOL_VIRTUAL_NODES,   /* points per endpoint on the hash ring */
+	YAR_POOL_CONNECT_TIMEOUT, /* milliseconds, see YAR_CONNECT_TIMEOUT_MS */
+	YAR_POOL_CALL_DEADLINE,   /* milliseconds, see YAR_CALL_DEADLINE_MS */
+	YAR_POOL_HEDGE_PERCENTILE, /* latency percentile after which a hedged method is sent again elsewhere, 0 for never */
+	YAR_POOL_HEDGE_DELAY,     /* milliseconds, the least a hedged method waits before it is sent again */
+	YAR_POOL_MIN_IDLE,        /* connections yar_pool_warmup() keeps made ahead of the calls per endpoint */
+	YAR_POOL_KEEPALIVE        /* milliseconds, idle connections are pinged and topped up this often, 0 for never */
+} yar_pool_opt;
+
+typedef struct _yar_pool_endpoint_info {
+	const char *hostname;
+	int outstanding;        /* calls in flight */
+	int idle;               /* connections kept for reuse */
+	int warming;            /* connections being made or pinged by yar_pool_warmup() */
+	ulong requests;
+	ulong failures;         /* calls that failed on the transport, and failed connects */
+	int down;               /* evicted, backing off */
+} yar_pool_endpoint_info;
+
+yar_pool * yar_pool_init(char *hostnames[], uint num_hosts);
+int yar_pool_set_opt(yar_pool *pool, yar_pool_opt opt, void *val);
+const void * yar_pool_get_opt(yar_pool *pool, yar_pool_opt opt);
+int yar_pool_add_endpoint(yar_pool *pool, char *hostname);
+int yar_pool_remove_endpoint(yar_pool *pool, uint index);
+int yar_pool_get_endpoint(yar_pool *pool, uint index, yar_pool_endpoint_info *info);
+int yar_pool_key_endpoint(yar_pool *pool, const char *key, uint key_len);
+int yar_pool_hedge_method(yar_pool *pool, const char *method);
+int yar_pool_warmup(yar_pool *pool, struct event_base *base);
+
+yar_response * yar_pool_call(yar_pool *pool, char *method, uint num_args, yar_packager *parameters[]);
+yar_response * yar_pool_call_key(yar_pool *pool, const char *key, uint key_len, char *method, uint num_args, yar_packager *parameters[]);
+yar_pool_request * yar_pool_call_async(yar_pool *pool, struct event_base *base, char *method, uint num_args,
+		yar_packager *parameters[], yar_call_callback callback, void *data);
+yar_pool_request * yar_pool_call_async_key(yar_pool *pool, struct event_base *base, const char *key, uint key_len,
+		char *method, uint num_args, yar_packager *parameters[], yar_call_callback callback, void *data);
+void yar_pool_request_cancel(yar_pool_request *request);
+
+void yar_pool_destroy(yar_pool *pool);
+#endif
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
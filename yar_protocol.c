@@ -16,8 +16,15 @@
  *    limitations under the License.
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdlib.h>
 #include <string.h>
 #include <arpa/inet.h> /* for htonl */
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 #include "yar_common.h"
 #include "yar_protocol.h"
@@ -57,6 +64,119 @@ int yar_protocol_parse(yar_header *header) /* {{{ */ {
 	return 1;
 } /* }}} */
 
+/* write the length prefix of a batch entry of len bytes, its envelope goes
+ * right after it */
+void yar_protocol_batch_put(char *buf, uint len) /* {{{ */ {
+	uint prefix = htonl(len);
+
+	memcpy(buf, &prefix, YAR_BATCH_ENTRY_PREFIX);
+} /* }}} */
+
+/* the entry at *offset of a batch body (the packager tag excluded), offset
+ * is moved past it; returns 0 at the end, -1 if the body is cut short */
+int yar_protocol_batch_next(char *body, uint size, uint *offset, char **entry, uint *len) /* {{{ */ {
+	uint prefix;
+
+	if (*offset == size) {
+		return 0;
+	}
+	if (size - *offset < YAR_BATCH_ENTRY_PREFIX) {
+		return -1;
+	}
+
+	memcpy(&prefix, body + *offset, YAR_BATCH_ENTRY_PREFIX);
+	prefix = ntohl(prefix);
+	if (prefix > size - *offset - YAR_BATCH_ENTRY_PREFIX) {
+		return -1;
+	}
+
+	*entry = body + *offset + YAR_BATCH_ENTRY_PREFIX;
+	*len = prefix;
+	*offset += YAR_BATCH_ENTRY_PREFIX + prefix;
+
+	return 1;
+} /* }}} */
+
+/* whether the library was built with zstd, bodies are never compressed
+ * without it */
+int yar_protocol_compression(void) /* {{{ */ {
+#ifdef HAVE_ZSTD
+	return 1;
+#else
+	return 0;
+#endif
+} /* }}} */
+
+/* compress the body of payload, what follows its first offset bytes (the
+ * header and packager tag, copied as they are); returns 0 if it is left as
+ * it was, because it would not get smaller or there is no zstd */
+int yar_protocol_compress(yar_payload *payload, uint offset) /* {{{ */ {
+#ifdef HAVE_ZSTD
+	size_t bound, len;
+	char *data;
+
+	if (payload->size <= offset) {
+		return 0;
+	}
+
+	bound = ZSTD_compressBound(payload->size - offset);
+	if (!(data = malloc(offset + bound))) {
+		return 0;
+	}
+	len = ZSTD_compress(data + offset, bound, payload->data + offset, payload->size - offset, YAR_COMPRESS_LEVEL);
+	if (ZSTD_isError(len) || offset + len >= payload->size) {
+		free(data);
+		return 0;
+	}
+
+	memcpy(data, payload->data, offset);
+	free(payload->data);
+	payload->data = data;
+	payload->size = offset + len;
+
+	return 1;
+#else
+	return 0;
+#endif
+} /* }}} */
+
+/* undo yar_protocol_compress(); returns 0 if the body is broken, would take
+ * more than max bytes, or there is no zstd */
+int yar_protocol_decompress(yar_payload *payload, uint offset, uint max) /* {{{ */ {
+#ifdef HAVE_ZSTD
+	unsigned long long size;
+	size_t len;
+	char *data;
+
+	if (payload->size <= offset) {
+		return 0;
+	}
+
+	/* zstd records the size in the frame, nothing is inflated past max */
+	size = ZSTD_getFrameContentSize(payload->data + offset, payload->size - offset);
+	if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN || size > max) {
+		return 0;
+	}
+	if (!(data = malloc(offset + size))) {
+		return 0;
+	}
+	len = ZSTD_decompress(data + offset, size, payload->data + offset, payload->size - offset);
+	if (ZSTD_isError(len) || len != size) {
+		free(data);
+		return 0;
+	}
+
+	memcpy(data, payload->data, offset);
+	free(payload->data);
+	payload->data = data;
+	payload->size = offset + size;
+
+	return 1;
+#else
+	return 0;
+#endif
+} /* }}} */
+
 /*
  * Local variables:
  * tab-width: 4
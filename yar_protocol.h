@@ -22,6 +22,16 @@
 #define YAR_PROTOCOL_PERSISTENT	0x1
 #define YAR_PROTOCOL_PING		0x2
 #define YAR_PROTOCOL_LIST		0x4
+#define YAR_PROTOCOL_BATCH		0x8  /* the body is a run of entries, see yar_protocol_batch_next() */
+#define YAR_PROTOCOL_COMPRESSED	0x10 /* the body past the packager tag is zstd compressed */
+#define YAR_PROTOCOL_ACCEPT_COMPRESSED	0x20 /* the sender takes compressed bodies */
+
+/* bodies are compressed from so many bytes on by default */
+#define YAR_COMPRESS_MIN_SIZE	4096
+#define YAR_COMPRESS_LEVEL		1
+
+/* every entry of a batch starts with its length, 4 bytes in network order */
+#define YAR_BATCH_ENTRY_PREFIX	4
 
 /* keep in sync with MAX_BODY_LEN in the PHP yar socket transport */
 #define YAR_MAX_BODY_SIZE		(1024 * 1024 * 10) /* 10 M */
@@ -43,6 +53,11 @@ extern char YAR_PACKAGER_JSON_TAG[8];
 
 void yar_protocol_render(yar_header *header, uint id, char *provider, char *token, int body_len, uint reserved);
 int yar_protocol_parse(yar_header *header);
+void yar_protocol_batch_put(char *buf, uint len);
+int yar_protocol_batch_next(char *body, uint size, uint *offset, char **entry, uint *len);
+int yar_protocol_compression(void);
+int yar_protocol_compress(yar_payload *payload, uint offset);
+int yar_protocol_decompress(yar_payload *payload, uint offset, uint max);
 #endif
 /*
  * Local variables:
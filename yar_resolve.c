@@ -0,0 +1,269 @@
+/**
+ * Yar - Concurrent RPC Server for PHP, C etc
+ *
+ * Copyright (C) 2012-2012 Xinchen Hui <laruence at gmail dot com>
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>   /* for gettimeofday */
+#include <netinet/in.h>
+#include <netdb.h>      /* for getaddrinfo */
+
+#include "yar_common.h"
+#include "yar_log.h"
+#include "yar_resolve.h"
+
+/* the addresses of a host, in the order they are to be tried; the port is
+ * set when they are handed out */
+typedef struct _yar_resolve_entry {
+	char *host;
+	ulong expires;
+	uint count;
+	yar_address addrs[YAR_RESOLVE_MAX_ADDRS];
+} yar_resolve_entry;
+
+/* process wide, every client resolving the same host shares it */
+static yar_resolve_entry yar_resolve_cache[YAR_RESOLVE_CACHE_SIZE];
+static yar_resolve_info yar_resolve_counters;
+static int yar_resolve_ttl = YAR_RESOLVE_TTL;
+static pthread_mutex_t yar_resolve_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static ulong yar_resolve_now() /* {{{ */ {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (ulong)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+/* }}} */
+
+/* "host:port", the host of an IPv6 address in brackets ("[::1]:8888"); the
+ * last colon starts the port, so a bare IPv6 address works too */
+int yar_resolve_split(const char *hostname, char *host, size_t size, int *port) /* {{{ */ {
+	const char *delim = strrchr(hostname, ':');
+	size_t len;
+
+	if (!delim) {
+		alog(YAR_ERROR, "No port in '%s'", hostname);
+		return 0;
+	}
+
+	len = delim - hostname;
+	if (hostname[0] == '[' && len >= 2 && hostname[len - 1] == ']') {
+		hostname++;
+		len -= 2;
+	}
+	if (len >= size) {
+		alog(YAR_ERROR, "Host name too long");
+		return 0;
+	}
+	memcpy(host, hostname, len);
+	host[len] = '\0';
+	*port = atoi(delim + 1);
+
+	return 1;
+}
+/* }}} */
+
+static void yar_resolve_set_port(yar_address *addr, int port) /* {{{ */ {
+	if (addr->sa.ss_family == AF_INET6) {
+		((struct sockaddr_in6 *)&addr->sa)->sin6_port = htons(port);
+	} else {
+		((struct sockaddr_in *)&addr->sa)->sin_port = htons(port);
+	}
+}
+/* }}} */
+
+/* getaddrinfo(), the families interleaved starting with the first one it
+ * gave (RFC 8305), so a broken family costs one attempt and not all */
+static uint yar_resolve_lookup(const char *host, int passive, yar_address *addrs, uint max) /* {{{ */ {
+	struct addrinfo hints, *res, *ai;
+	yar_address found[2][YAR_RESOLVE_MAX_ADDRS];
+	uint counts[2] = {0, 0}, count = 0, i;
+	int error, first = -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive? AI_PASSIVE : 0;
+
+	if ((error = getaddrinfo(*host? host : NULL, "0", &hints, &res)) != 0) {
+		alog(YAR_ERROR, "Failed to resolve host name '%s' '%s'", host, gai_strerror(error));
+		return 0;
+	}
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		int family = ai->ai_family == AF_INET6;
+
+		if ((ai->ai_family != AF_INET && ai->ai_family != AF_INET6)
+				|| ai->ai_addrlen > sizeof(struct sockaddr_storage) || counts[family] == YAR_RESOLVE_MAX_ADDRS) {
+			continue;
+		}
+		if (first < 0) {
+			first = family;
+		}
+		memset(&found[family][counts[family]], 0, sizeof(yar_address));
+		memcpy(&found[family][counts[family]].sa, ai->ai_addr, ai->ai_addrlen);
+		found[family][counts[family]].len = ai->ai_addrlen;
+		counts[family]++;
+	}
+	freeaddrinfo(res);
+
+	for (i = 0; count < max && (i < counts[0] || i < counts[1]); i++) {
+		if (i < counts[first] && count < max) {
+			addrs[count++] = found[first][i];
+		}
+		if (i < counts[!first] && count < max) {
+			addrs[count++] = found[!first][i];
+		}
+	}
+	if (!count) {
+		alog(YAR_ERROR, "No address for host name '%s'", host);
+	}
+
+	return count;
+}
+/* }}} */
+
+static void yar_resolve_store(const char *host, yar_address *addrs, uint count, ulong expires) /* {{{ */ {
+	yar_resolve_entry *entry = NULL;
+	uint i;
+
+	for (i = 0; i < YAR_RESOLVE_CACHE_SIZE; i++) {
+		yar_resolve_entry *candidate = &yar_resolve_cache[i];
+
+		if (candidate->host && strcmp(candidate->host, host) == 0) {
+			entry = candidate;
+			break;
+		}
+		/* an empty slot, else the one to expire first */
+		if (!entry || (entry->host && (!candidate->host || candidate->expires < entry->expires))) {
+			entry = candidate;
+		}
+	}
+
+	if (!entry->host) {
+		yar_resolve_counters.entries++;
+	} else if (strcmp(entry->host, host) != 0) {
+		free(entry->host);
+		entry->host = NULL;
+	}
+	if (!entry->host) {
+		entry->host = strdup(host);
+	}
+	entry->expires = expires;
+	entry->count = count;
+	memcpy(entry->addrs, addrs, count * sizeof(yar_address));
+}
+/* }}} */
+
+/* the addresses of host, with port, into addrs; returns how many (0 if it
+ * did not resolve). Lookups are cached for the resolve ttl, but not the
+ * passive ones (for binding) */
+int yar_resolve(const char *host, int port, int passive, yar_address *addrs, uint max) /* {{{ */ {
+	ulong now = yar_resolve_now();
+	uint count = 0, i;
+	int ttl = 0;
+
+	if (max > YAR_RESOLVE_MAX_ADDRS) {
+		max = YAR_RESOLVE_MAX_ADDRS;
+	}
+
+	pthread_mutex_lock(&yar_resolve_lock);
+	if (!passive && (ttl = yar_resolve_ttl) > 0) {
+		for (i = 0; i < YAR_RESOLVE_CACHE_SIZE; i++) {
+			yar_resolve_entry *entry = &yar_resolve_cache[i];
+
+			if (entry->host && entry->expires > now && strcmp(entry->host, host) == 0) {
+				count = entry->count < max? entry->count : max;
+				memcpy(addrs, entry->addrs, count * sizeof(yar_address));
+				break;
+			}
+		}
+		if (count) {
+			yar_resolve_counters.hits++;
+		} else {
+			yar_resolve_counters.misses++;
+		}
+	}
+	pthread_mutex_unlock(&yar_resolve_lock);
+
+	if (!count) {
+		/* not under the lock, a slow resolver holds up only its caller */
+		yar_address resolved[YAR_RESOLVE_MAX_ADDRS];
+		uint total = yar_resolve_lookup(host, passive, resolved, YAR_RESOLVE_MAX_ADDRS);
+
+		if (!total) {
+			return 0;
+		}
+		if (ttl > 0) {
+			pthread_mutex_lock(&yar_resolve_lock);
+			yar_resolve_store(host, resolved, total, now + ttl);
+			pthread_mutex_unlock(&yar_resolve_lock);
+		}
+		count = total < max? total : max;
+		memcpy(addrs, resolved, count * sizeof(yar_address));
+	}
+
+	for (i = 0; i < count; i++) {
+		yar_resolve_set_port(&addrs[i], port);
+	}
+
+	return count;
+}
+/* }}} */
+
+/* milliseconds a lookup is reused for, 0 not to cache them */
+void yar_resolve_set_ttl(int ttl) /* {{{ */ {
+	pthread_mutex_lock(&yar_resolve_lock);
+	yar_resolve_ttl = ttl < 0? 0 : ttl;
+	pthread_mutex_unlock(&yar_resolve_lock);
+}
+/* }}} */
+
+void yar_resolve_get_info(yar_resolve_info *info) /* {{{ */ {
+	pthread_mutex_lock(&yar_resolve_lock);
+	*info = yar_resolve_counters;
+	pthread_mutex_unlock(&yar_resolve_lock);
+}
+/* }}} */
+
+/* forget every lookup, the counters are kept */
+void yar_resolve_flush(void) /* {{{ */ {
+	uint i;
+
+	pthread_mutex_lock(&yar_resolve_lock);
+	for (i = 0; i < YAR_RESOLVE_CACHE_SIZE; i++) {
+		free(yar_resolve_cache[i].host);
+		yar_resolve_cache[i].host = NULL;
+	}
+	yar_resolve_counters.entries = 0;
+	pthread_mutex_unlock(&yar_resolve_lock);
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,54 @@
+/**
+ * Yar - Concurrent RPC Server for PHP, C etc
+ *
+ * Copyright (C) 2012-2012 Xinchen Hui <laruence at gmail dot com>
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef YAR_RESOLVE_H
+#define YAR_RESOLVE_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define YAR_RESOLVE_MAX_ADDRS  8      /* addresses kept for a host */
+#define YAR_RESOLVE_CACHE_SIZE 64     /* hosts */
+#define YAR_RESOLVE_TTL        60000  /* milliseconds */
+
+typedef struct _yar_address {
+	struct sockaddr_storage sa;
+	socklen_t len;
+} yar_address;
+
+typedef struct _yar_resolve_info {
+	uint entries;
+	ulong hits;
+	ulong misses;
+} yar_resolve_info;
+
+int yar_resolve_split(const char *hostname, char *host, size_t size, int *port);
+int yar_resolve(const char *host, int port, int passive, yar_address *addrs, uint max);
+void yar_resolve_set_ttl(int ttl);
+void yar_resolve_get_info(yar_resolve_info *info);
+void yar_resolve_flush(void);
+
+#endif
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -93,9 +93,22 @@ int yar_response_pack(yar_response *response, yar_payload *payload, int extra_by
 /* }}} */
 
 int yar_response_unpack(yar_response *response, char *payload, uint len, int extra_bytes, yar_packager_type type) /* {{{ */ {
+	yar_data *root = yar_data_unpack(payload + extra_bytes, len - extra_bytes, type);
+
+	if (!root) {
+		return 0;
+	}
+
+	return yar_response_unpack_data(response, root);
+}
+/* }}} */
+
+/* as yar_response_unpack(), from the envelope decoded already; root is
+ * taken over */
+int yar_response_unpack_data(yar_response *response, yar_data *root) /* {{{ */ {
 	uint size;
 	const yar_data *obj;
-	yar_unpackager *unpk = yar_unpack_init(payload + extra_bytes, len - extra_bytes, type);
+	yar_unpackager *unpk = yar_unpack_init_data(root);
 
 	if (!unpk) {
 		return 0;
@@ -38,6 +38,7 @@ int yar_response_get_error(yar_response *response, const char **msg, uint *len);
 
 int yar_response_pack(yar_response *response, struct _yar_payload *payload, int extra_bytes, yar_packager_type type);
 int yar_response_unpack(yar_response *response, char *payload, uint len, int extra_bytes, yar_packager_type type);
+int yar_response_unpack_data(yar_response *response, yar_data *root);
 void yar_response_free(yar_response *response);
 
 #endif
@@ -16,6 +16,10 @@
  *    limitations under the License.
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE 	/* for sched_setaffinity & cpu_set_t */
+#endif
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
@@ -25,19 +29,27 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>  	/* for offsetof */
 #include <unistd.h>  	/* for fork & setsid */
 #include <time.h>  		/* for ctime */
 #include <sys/types.h>
 #include <sys/stat.h> 	/* for umask */
+#include <sys/mman.h> 	/* for mmap */
 #include <sys/socket.h> /* for sockets */
 #include <sys/un.h>  	/* for un */
 #include <sys/wait.h>   /* for waitpid */
 #include <sys/time.h>   /* for gettimeofday */
-#include <netdb.h>  	/* for gethostbyname */
+#include <sys/resource.h> /* for getrusage */
+#include <netdb.h>  	/* for getnameinfo */
 #include <pwd.h>        /* for getpwnam */
 #include <grp.h>        /* for getgrnam */
 #include <arpa/inet.h> 	/* for inet_ntop */
 #include <signal.h>
+#include <dirent.h>  	/* for opendir */
+#ifdef __linux__
+#include <sched.h>   	/* for sched_setaffinity */
+#include <sys/syscall.h> /* for set_mempolicy */
+#endif
 #include "event.h" 		/* for libevent */
 
 #include "yar_common.h"
@@ -46,9 +58,17 @@
 #include "yar_protocol.h"
 #include "yar_response.h"
 #include "yar_request.h"
+#include "yar_resolve.h"
 #include "yar_server.h"
 
+/* a scoreboard entry as seen by the server, in memory shared by the master,
+ * the workers and (with YAR_SCOREBOARD_FILE) external tools; the master owns
+ * pid/state (a worker only ever moves itself to draining), the worker owns
+ * everything else and is the only one bumping seq */
+typedef volatile yar_worker_status yar_worker_slot;
+
 typedef struct _yar_request_context {
+	int fd;
 	size_t bytes_sent;
 	struct event ev_read;
 	struct event ev_write;
@@ -60,9 +80,14 @@ typedef struct _yar_request_context {
 	ulong start_time;
 	char *remote_addr;
 	long remote_port;
+	char remote_buf[INET6_ADDRSTRLEN];
 	char header_buf[sizeof(yar_header)];
 	uint header_read;
 	uint write_registered; /* ev_write has been event_set()/event_add()ed */
+	uint served; /* requests answered on this (keep-alive) connection */
+	uint in_progress; /* a request has started arriving and is not answered yet */
+	struct _yar_request_context *prev;
+	struct _yar_request_context *next;
 } yar_request_context;
 
 struct _yar_server {
@@ -70,6 +95,10 @@ struct _yar_server {
 	int fd;
 	int ppid;
 	int max_children;
+	int pm;
+	int start_children;
+	int min_spare_children;
+	int max_spare_children;
 	int stand_alone;
 	int running_children;
 	int running;
@@ -83,8 +112,31 @@ struct _yar_server {
 	int  log_level;
 	void *data;
 	yar_server_handler *handlers;
+	yar_payload method_list[2]; /* pre-encoded LIST responses, per packager */
 	yar_init parent_init;
 	yar_init child_init;
+	/* worker recycling, limits are per worker (see yar_server_worker_limits) */
+	int max_requests;
+	int max_rss;
+	ulong request_limit;
+	ulong rss_limit;
+	ulong requests;
+	int draining;
+	int connections;
+	yar_request_context *contexts;
+	struct event ev_accept;
+	struct event ev_maintenance;
+	struct event ev_drain;
+	char *scoreboard_file;
+	int affinity;
+	char *worker_cpus;
+	int compress_threshold;
+#ifdef __linux__
+	cpu_set_t cpus; /* parsed worker_cpus */
+#endif
+	yar_scoreboard *scoreboard; /* NULL unless pre-forking */
+	yar_worker_slot *slots; /* max_children of them, the scoreboard's workers */
+	yar_worker_slot *slot;  /* the current worker's own */
 } *server;
 
 static inline ulong yar_get_microsec(void) /* {{{ */ {
@@ -193,7 +245,7 @@ static int yar_server_start_listening() /* {{{ */ {
 	struct sockaddr_storage sa;
 	socklen_t sa_len = 0;
 	bzero(&sa, sizeof(sa));
-	char addrstr[INET_ADDRSTRLEN];
+	char addrstr[INET6_ADDRSTRLEN];
 	int port = 0, sockfd = 0;
 
 	char *hostname = server->hostname;
@@ -223,64 +275,26 @@ static int yar_server_start_listening() /* {{{ */ {
 		memcpy(usa->sun_path, hostname, strlen(hostname) + 1);
 		sa_len = SUN_LEN(usa);
 	} else {
-		char *delim, *p, host[512];
-		int addrtype;
-		struct hostent *hptr;
-		struct sockaddr_in *isa;
-		if ((delim = strchr(hostname, ':'))) {
-			if ((delim - hostname) >= sizeof(host)) {
-				alog(YAR_ERROR, "Host name too long");
-				return 0;
-			}
-			memcpy(host, hostname, delim - hostname);
-			host[delim - hostname] = '\0';
-			port = atoi(delim + 1);
-		} else {
-			alog(YAR_ERROR, "Port doesn't specificed");
-			return 0;
-		}
+		char host[512];
+		yar_address addr;
+		int val = 1;
 
-		if ((hptr = gethostbyname(host)) == NULL) {
-			alog(YAR_ERROR, "Failed to resolve host name '%s'", host);
+		if (!yar_resolve_split(hostname, host, sizeof(host), &port)) {
 			return 0;
 		}
-
-		{
-			/* see yar_copy_unaligned(): the hostent members are misaligned on
-			 * some platforms, copy them out byte-wise instead of loading them */
-			char **addr_list;
-			char *addr;
-			yar_copy_unaligned(&addrtype, &hptr->h_addrtype, sizeof(addrtype));
-			yar_copy_unaligned(&addr_list, &hptr->h_addr_list, sizeof(addr_list));
-			yar_copy_unaligned(&addr, addr_list, sizeof(addr));
-			p = addr;
+		/* the first address, for a host that resolves to several */
+		if (!yar_resolve(host, port, 1, &addr, 1)) {
+			return 0;
 		}
-		if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+		if ((sockfd = socket(addr.sa.ss_family, SOCK_STREAM, 0)) == -1) {
 			alog(YAR_ERROR, "Failed to create a socket '%s'", strerror(errno));
 			return 0;
 		}
-		switch (addrtype) {
-			case AF_INET:
-				{
-					int val = 1;
-					isa = (struct sockaddr_in *)&sa;
-					bzero(isa, sizeof(struct sockaddr_in));
-
-					isa->sin_family = AF_INET;
-					isa->sin_port = htons(port);
-					memcpy(&isa->sin_addr, p, sizeof(struct in_addr));
-
-					setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (char*)&val, sizeof(val));
-					sa_len = sizeof(struct sockaddr_in);
-				}
-				break;
-			default:
-				alog(YAR_ERROR, "Unknown address type %d", addrtype);
-				close(sockfd);
-				return 0;
-		}
+		setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (char*)&val, sizeof(val));
+		memcpy(&sa, &addr.sa, addr.len);
+		sa_len = addr.len;
 
-		inet_ntop(isa->sin_family, p, addrstr, sizeof(addrstr));
+		getnameinfo((struct sockaddr *)&sa, sa_len, addrstr, sizeof(addrstr), NULL, 0, NI_NUMERICHOST);
 	}
 
 	if (bind(sockfd, (const struct sockaddr*)&sa, sa_len) == -1) {
@@ -335,6 +349,12 @@ static void yar_server_sig_handler(int signo) /* {{{ */ {
 }
 /* }}} */
 
+static void yar_server_sig_alarm(int signo) /* {{{ */ {
+	/* nothing, only here to wake the master up from waitpid() */
+	return;
+}
+/* }}} */
+
 static void yar_server_parent_init() /* {{{ */ {
 	struct sigaction act;
 
@@ -352,6 +372,14 @@ static void yar_server_parent_init() /* {{{ */ {
 	sigaction(SIGINT, &act, NULL);
 	sigaction(SIGQUIT, &act, NULL);
 
+	if (server->pm == YAR_PM_DYNAMIC && server->slots) {
+		struct itimerval timer = {{1, 0}, {1, 0}};
+
+		act.sa_handler = yar_server_sig_alarm;
+		sigaction(SIGALRM, &act, NULL);
+		setitimer(ITIMER_REAL, &timer, NULL);
+	}
+
 	if (server->pid_file) {
 		yar_record_pid(server->pid_file);
 	}
@@ -363,6 +391,194 @@ static void yar_server_parent_init() /* {{{ */ {
 }
 /* }}} */
 
+/* every worker picks its own limits in [75%, 100%] of the configured ones,
+ * so workers forked together do not all reach them (and recycle) at once */
+static void yar_server_worker_limits() /* {{{ */ {
+	unsigned int seed = getpid();
+
+	server->requests = 0;
+	server->request_limit = 0;
+	server->rss_limit = 0;
+
+	if (server->max_requests) {
+		server->request_limit = server->max_requests - rand_r(&seed) % (server->max_requests / 4 + 1);
+	}
+
+	if (server->max_rss) {
+		ulong limit = (ulong)server->max_rss * 1024;
+		server->rss_limit = limit - rand_r(&seed) % (limit / 4 + 1);
+	}
+}
+/* }}} */
+
+#ifdef __linux__
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+#define YAR_MAX_NUMA_NODES 1024
+
+/* parse a cpulist ("0-3,8,10-11", as in /sys and taskset -c), returns the
+ * number of CPUs in it, 0 if it is malformed or empty */
+static int yar_server_parse_cpus(const char *list, cpu_set_t *set) /* {{{ */ {
+	const char *p = list;
+
+	CPU_ZERO(set);
+	while (*p) {
+		char *end;
+		long first, last;
+
+		first = last = strtol(p, &end, 10);
+		if (end == p || first < 0) {
+			return 0;
+		}
+		p = end;
+		if (*p == '-') {
+			p++;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first) {
+				return 0;
+			}
+			p = end;
+		}
+		if (last >= CPU_SETSIZE) {
+			return 0;
+		}
+		while (first <= last) {
+			CPU_SET(first++, set);
+		}
+		while (*p == ',' || *p == ' ' || *p == '\n') {
+			p++;
+		}
+	}
+
+	return CPU_COUNT(set);
+}
+/* }}} */
+
+/* the CPUs of NUMA node #node, 0 if there is no such node (or no sysfs) */
+static int yar_server_node_cpus(int node, cpu_set_t *set) /* {{{ */ {
+	char path[64], list[4096];
+	size_t len;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	if (!(fp = fopen(path, "r"))) {
+		return 0;
+	}
+	len = fread(list, 1, sizeof(list) - 1, fp);
+	fclose(fp);
+	list[len] = '\0';
+
+	return yar_server_parse_cpus(list, set);
+}
+/* }}} */
+
+/* the NUMA nodes having some of the CPUs in allowed, ascending */
+static int yar_server_numa_nodes(cpu_set_t *allowed, int *nodes, int max) /* {{{ */ {
+	int n = 0, node;
+	DIR *dir = opendir("/sys/devices/system/node");
+	struct dirent *entry;
+
+	if (!dir) {
+		return 0;
+	}
+
+	while ((entry = readdir(dir)) && n < max) {
+		cpu_set_t cpus;
+		int i;
+
+		if (sscanf(entry->d_name, "node%d", &node) != 1 || !yar_server_node_cpus(node, &cpus)) {
+			continue;
+		}
+		CPU_AND(&cpus, &cpus, allowed);
+		if (!CPU_COUNT(&cpus)) {
+			continue;
+		}
+		/* readdir() has no order, keep the list sorted so every worker agrees */
+		for (i = n++; i > 0 && nodes[i - 1] > node; i--) {
+			nodes[i] = nodes[i - 1];
+		}
+		nodes[i] = node;
+	}
+	closedir(dir);
+
+	return n;
+}
+/* }}} */
+
+static int yar_server_cpu_node(int cpu) /* {{{ */ {
+	int nodes[64], n;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	n = yar_server_numa_nodes(&set, nodes, 64);
+
+	return n? nodes[0] : -1;
+}
+/* }}} */
+
+/* pin the current worker according to YAR_WORKER_AFFINITY, workers are
+ * placed by slot so a replacement lands where its predecessor was */
+static void yar_server_worker_affinity() /* {{{ */ {
+	int index, node = -1;
+	cpu_set_t allowed, cpus;
+
+	if (server->affinity == YAR_AFFINITY_NONE || !server->slot) {
+		return;
+	}
+
+	index = server->slot - server->slots;
+	if (server->worker_cpus) {
+		allowed = server->cpus;
+	} else if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+		alog(YAR_WARNING, "Failed to get the CPU affinity '%s'", strerror(errno));
+		return;
+	}
+
+	CPU_ZERO(&cpus);
+	if (server->affinity == YAR_AFFINITY_CPU) {
+		int cpu, nth = index % CPU_COUNT(&allowed);
+
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (CPU_ISSET(cpu, &allowed) && !nth--) {
+				break;
+			}
+		}
+		CPU_SET(cpu, &cpus);
+		node = yar_server_cpu_node(cpu);
+	} else {
+		int nodes[64], n = yar_server_numa_nodes(&allowed, nodes, 64);
+
+		if (!n) {
+			/* no NUMA topology exposed, nothing to spread over */
+			return;
+		}
+		node = nodes[index % n];
+		yar_server_node_cpus(node, &cpus);
+		CPU_AND(&cpus, &cpus, &allowed);
+	}
+
+	if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+		alog(YAR_WARNING, "Failed to set the CPU affinity of worker %d '%s'", getpid(), strerror(errno));
+		return;
+	}
+
+	if (node >= 0) {
+		unsigned long nodemask[YAR_MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = {0};
+
+		nodemask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+		if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodemask, YAR_MAX_NUMA_NODES + 1) == -1) {
+			alog(YAR_NOTICE, "Failed to prefer memory of node %d for worker %d '%s'", node, getpid(), strerror(errno));
+		}
+	}
+
+	alog(YAR_DEBUG, "Worker %d bound to %d CPUs of node %d", getpid(), CPU_COUNT(&cpus), node);
+}
+/* }}} */
+#endif
+
 static void yar_server_child_init() /* {{{ */ {
 
 	/* install signal handler */
@@ -371,6 +587,8 @@ static void yar_server_child_init() /* {{{ */ {
 	signal(SIGTERM, yar_server_sig_handler);
 	signal(SIGINT, yar_server_sig_handler);
 	signal(SIGQUIT, yar_server_sig_handler);
+	/* SIGUSR1 stays blocked since the fork, a drain sent while the worker is
+	 * still starting up is held until the worker loop takes it over */
 
 	/* setuid & set gid */
 	if (server->gid) {
@@ -385,32 +603,335 @@ static void yar_server_child_init() /* {{{ */ {
 		}
 	}
 
+	yar_server_worker_limits();
+#ifdef __linux__
+	yar_server_worker_affinity();
+#endif
+
 	if (server->child_init) {
 		server->child_init(server->data);
 	}
 }
 /* }}} */
 
+static inline size_t yar_scoreboard_size(int num_slots) /* {{{ */ {
+	return sizeof(yar_scoreboard) + sizeof(yar_worker_status) * num_slots;
+}
+/* }}} */
+
+static int yar_server_slots_init() /* {{{ */ {
+	void *scoreboard;
+	size_t size = yar_scoreboard_size(server->max_children);
+
+	if (server->scoreboard_file) {
+		int fd = open(server->scoreboard_file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+		if (fd == -1) {
+			alog(YAR_ERROR, "Failed to open scoreboard file %s '%s'", server->scoreboard_file, strerror(errno));
+			return 0;
+		}
+		if (ftruncate(fd, size) == -1) {
+			alog(YAR_ERROR, "Failed to size scoreboard file %s '%s'", server->scoreboard_file, strerror(errno));
+			close(fd);
+			return 0;
+		}
+		scoreboard = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+	} else {
+		scoreboard = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	}
+
+	if (scoreboard == MAP_FAILED) {
+		alog(YAR_ERROR, "Failed to map the worker slots '%s'", strerror(errno));
+		return 0;
+	}
+
+	/* both mappings are zero filled, all slots start out free */
+	server->scoreboard = (yar_scoreboard *)scoreboard;
+	server->scoreboard->slot_size = sizeof(yar_worker_status);
+	server->scoreboard->num_slots = server->max_children;
+	server->scoreboard->master = getpid();
+	server->slots = server->scoreboard->workers;
+	__sync_synchronize();
+	server->scoreboard->magic = YAR_SCOREBOARD_MAGIC;
+	return 1;
+}
+/* }}} */
+
+/* the worker's own slot is about to change, see yar_worker_status */
+static inline void yar_server_slot_lock() /* {{{ */ {
+	server->slot->seq++;
+	__sync_synchronize();
+}
+/* }}} */
+
+static inline void yar_server_slot_unlock() /* {{{ */ {
+	__sync_synchronize();
+	server->slot->seq++;
+}
+/* }}} */
+
+/* consistent copy of a slot, gives up on a worker stuck (or killed) mid update */
+static int yar_scoreboard_copy(yar_worker_slot *slot, yar_worker_status *status) /* {{{ */ {
+	int tries = 1000;
+
+	do {
+		unsigned int seq = slot->seq;
+		if (!(seq & 1)) {
+			__sync_synchronize();
+			*status = *slot;
+			__sync_synchronize();
+			if (slot->seq == seq) {
+				return 1;
+			}
+		}
+	} while (--tries);
+
+	return 0;
+}
+/* }}} */
+
+/* copy the workers in use (not free) out of a scoreboard, returns how many */
+static int yar_scoreboard_snapshot(yar_scoreboard *scoreboard, yar_worker_status *workers, int max) /* {{{ */ {
+	unsigned int i;
+	int n = 0;
+
+	for (i = 0; i < scoreboard->num_slots && n < max; i++) {
+		yar_worker_slot *slot = &scoreboard->workers[i];
+		if (slot->state == YAR_WORKER_FREE) {
+			continue;
+		}
+		if (yar_scoreboard_copy(slot, &workers[n]) && workers[n].state != YAR_WORKER_FREE) {
+			n++;
+		}
+	}
+
+	return n;
+}
+/* }}} */
+
+/* fork a worker into a free slot, returns like fork() */
+static pid_t yar_server_spawn_worker() /* {{{ */ {
+	int i;
+	pid_t pid;
+	sigset_t drain, mask;
+	yar_worker_slot *slot = NULL;
+
+	for (i = 0; i < server->max_children; i++) {
+		if (server->slots[i].state == YAR_WORKER_FREE) {
+			slot = &server->slots[i];
+			break;
+		}
+	}
+
+	if (!slot) {
+		return -1;
+	}
+
+	/* a reader may still be copying the previous worker's figures */
+	slot->seq++;
+	__sync_synchronize();
+	memset((char *)slot + offsetof(yar_worker_status, pid), 0, sizeof(yar_worker_status) - offsetof(yar_worker_status, pid));
+	slot->state = YAR_WORKER_RUNNING;
+	__sync_synchronize();
+	slot->seq++;
+	/* the master may drain the worker before it has set up its loop */
+	sigemptyset(&drain);
+	sigaddset(&drain, SIGUSR1);
+	sigprocmask(SIG_BLOCK, &drain, &mask);
+	if ((pid = fork()) == -1) {
+		alog(YAR_ERROR, "Failed to fork a worker '%s'", strerror(errno));
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+		slot->state = YAR_WORKER_FREE;
+		return -1;
+	}
+
+	slot->pid = pid? pid : getpid();
+	if (pid) {
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+		server->running_children++;
+	} else {
+		server->slot = slot;
+	}
+
+	return pid;
+}
+/* }}} */
+
+static void yar_server_reap_worker(pid_t pid) /* {{{ */ {
+	int i;
+
+	for (i = 0; i < server->max_children; i++) {
+		if (server->slots[i].pid == pid && server->slots[i].state != YAR_WORKER_FREE) {
+			server->slots[i].state = YAR_WORKER_FREE;
+			server->slots[i].pid = 0;
+			server->running_children--;
+			return;
+		}
+	}
+}
+/* }}} */
+
+/* pm=dynamic: keep the number of idle workers between the min and max spare,
+ * called once a second in the master; returns 0 in a newly forked worker */
+static int yar_server_maintain_pool() /* {{{ */ {
+	int i, idle = 0, active = 0;
+	yar_worker_slot *victim = NULL;
+
+	for (i = 0; i < server->max_children; i++) {
+		yar_worker_slot *slot = &server->slots[i];
+		if (slot->state != YAR_WORKER_RUNNING) {
+			continue;
+		}
+		active++;
+		if (!slot->busy) {
+			idle++;
+			victim = slot;
+		}
+	}
+
+	if (idle > server->max_spare_children && victim) {
+		/* one at a time, the pool shrinks slowly but grows fast */
+		alog(YAR_DEBUG, "Stopping idle worker %d, %d idle of %d workers", victim->pid, idle, active);
+		victim->state = YAR_WORKER_DRAINING;
+		kill(victim->pid, SIGUSR1);
+	} else if (idle < server->min_spare_children && active < server->max_children) {
+		int spawn = server->min_spare_children - idle;
+
+		if (spawn > server->max_children - active) {
+			spawn = server->max_children - active;
+		}
+		alog(YAR_DEBUG, "Starting %d workers, %d idle of %d workers", spawn, idle, active);
+		while (spawn--) {
+			if (yar_server_spawn_worker() == 0) {
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+/* }}} */
+
+/* validate and complete the pm=dynamic settings */
+static int yar_server_pool_check() /* {{{ */ {
+	if (server->pm != YAR_PM_DYNAMIC || server->stand_alone || !server->max_children) {
+		return 1;
+	}
+
+	if (!server->min_spare_children) {
+		server->min_spare_children = 1;
+	}
+	if (!server->max_spare_children) {
+		server->max_spare_children = server->max_children;
+	}
+	if (server->min_spare_children > server->max_spare_children
+			|| server->max_spare_children > server->max_children) {
+		alog(YAR_ERROR, "Spare workers must satisfy min spare(%d) <= max spare(%d) <= max workers(%d)",
+				server->min_spare_children, server->max_spare_children, server->max_children);
+		return 0;
+	}
+
+	if (!server->start_children) {
+		server->start_children = server->min_spare_children
+			+ (server->max_spare_children - server->min_spare_children) / 2;
+	}
+	if (server->start_children < server->min_spare_children
+			|| server->start_children > server->max_spare_children) {
+		alog(YAR_ERROR, "Start workers(%d) must be between min spare(%d) and max spare(%d)",
+				server->start_children, server->min_spare_children, server->max_spare_children);
+		return 0;
+	}
+
+	return 1;
+}
+/* }}} */
+
 static int yar_server_startup_workers() /* {{{ */ {
-	int max_childs;
-	pid_t pid = 0;
+	int num_children;
 
-	max_childs = server->max_children;
-	if (server->stand_alone || !max_childs) {
+	if (server->stand_alone || !server->max_children) {
 		yar_server_parent_init();
 		return 1;
-	} else {
-		while (max_childs-- && (pid = fork())) {
-			server->running_children++;
-		}
-		if (pid) {
-			yar_server_parent_init();
-			return 0;
-		} else {
+	}
+
+	if (!yar_server_slots_init()) {
+		/* no way to track the workers, serve from this process */
+		server->max_children = 0;
+		yar_server_parent_init();
+		return 1;
+	}
+
+	num_children = server->pm == YAR_PM_DYNAMIC? server->start_children : server->max_children;
+	while (num_children--) {
+		if (yar_server_spawn_worker() == 0) {
 			yar_server_child_init();
 			return 1;
 		}
 	}
+
+	yar_server_parent_init();
+	return 0;
+}
+/* }}} */
+
+static inline void yar_server_request_begin(yar_request_context *ctx) /* {{{ */ {
+	ctx->in_progress = 1;
+	if (server->slot) {
+		yar_server_slot_lock();
+		if (!server->slot->busy++ || ctx->start_time < server->slot->request_start) {
+			server->slot->request_start = ctx->start_time;
+		}
+		server->slot->method[0] = '\0';
+		yar_server_slot_unlock();
+	}
+}
+/* }}} */
+
+static inline void yar_server_request_end(yar_request_context *ctx) /* {{{ */ {
+	if (!ctx->in_progress) {
+		return;
+	}
+	ctx->in_progress = 0;
+	if (server->slot) {
+		ulong oldest = server->slot->request_start;
+
+		if (ctx->start_time == oldest) {
+			/* the next oldest request in progress takes over, 0 if none is left */
+			yar_request_context *other;
+
+			oldest = 0;
+			for (other = server->contexts; other; other = other->next) {
+				if (other->in_progress && (!oldest || other->start_time < oldest)) {
+					oldest = other->start_time;
+				}
+			}
+		}
+		yar_server_slot_lock();
+		server->slot->request_start = --server->slot->busy? oldest : 0;
+		yar_server_slot_unlock();
+	}
+}
+/* }}} */
+
+static inline void yar_server_request_method(yar_request *request) /* {{{ */ {
+	if (server->slot) {
+		uint len = request->mlen < YAR_SCOREBOARD_METHOD_LEN - 1? request->mlen : YAR_SCOREBOARD_METHOD_LEN - 1;
+		yar_server_slot_lock();
+		memcpy((char *)server->slot->method, request->method, len);
+		server->slot->method[len] = '\0';
+		yar_server_slot_unlock();
+	}
+}
+/* }}} */
+
+static inline void yar_server_count_bytes(ulong in, ulong out) /* {{{ */ {
+	if (server->slot) {
+		yar_server_slot_lock();
+		server->slot->bytes_in += in;
+		server->slot->bytes_out += out;
+		yar_server_slot_unlock();
+	}
 }
 /* }}} */
 
@@ -433,6 +954,236 @@ static inline yar_server_handler * yar_server_find_handler(char *name, int len)
 }
 /* }}} */
 
+static void yar_server_method_list_free() /* {{{ */ {
+	uint i;
+
+	for (i = 0; i < sizeof(server->method_list) / sizeof(yar_payload); i++) {
+		if (server->method_list[i].data) {
+			free(server->method_list[i].data);
+			server->method_list[i].data = NULL;
+			server->method_list[i].size = 0;
+		}
+	}
+}
+/* }}} */
+
+/* the LIST response (names of the registered methods), built on first use;
+ * the header is left for the caller to render, it carries the request id */
+static yar_payload * yar_server_method_list(yar_packager_type packager) /* {{{ */ {
+	yar_payload *payload = &server->method_list[packager];
+
+	if (!payload->data) {
+		uint i, num = 0;
+		yar_packager *names;
+		yar_response response = {0};
+
+		while (server->handlers && server->handlers[num].name) {
+			num++;
+		}
+		names = yar_pack_start_array(num);
+		for (i = 0; i < num; i++) {
+			yar_pack_push_string(names, server->handlers[i].name, server->handlers[i].len);
+		}
+		yar_response_set_retval(&response, names);
+		yar_pack_free(names);
+
+		if (!yar_response_pack(&response, payload, sizeof(yar_header) + sizeof(YAR_PACKAGER), packager)) {
+			yar_response_free(&response);
+			return NULL;
+		}
+		yar_response_free(&response);
+		memcpy(payload->data + sizeof(yar_header), packager == YAR_PACKAGER_JSON? YAR_PACKAGER_JSON_TAG : YAR_PACKAGER, sizeof(YAR_PACKAGER));
+	}
+
+	return payload;
+}
+/* }}} */
+
+/* PING and LIST are answered from the header, without unpacking a body or
+ * calling a handler: PING gets a bare header, LIST the cached method list */
+static int yar_server_control(yar_request_context *ctx) /* {{{ */ {
+	yar_header header = {0};
+	yar_response *response = ctx->response;
+	uint flag = (ctx->header->reserved & YAR_PROTOCOL_PING)? YAR_PROTOCOL_PING : YAR_PROTOCOL_LIST;
+
+	response->id = ctx->header->id;
+	if (flag == YAR_PROTOCOL_PING) {
+		response->payload.data = malloc(sizeof(yar_header));
+		response->payload.size = sizeof(yar_header);
+	} else {
+		yar_payload *list;
+		yar_packager_type packager = YAR_PACKAGER_MSGPACK;
+
+		/* the body is no more than the packager tag */
+		if (ctx->header->body_len >= sizeof(YAR_PACKAGER)
+				&& strncmp(ctx->request->body + sizeof(yar_header), YAR_PACKAGER_JSON_TAG, sizeof(YAR_PACKAGER_JSON_TAG) - 1) == 0
+				&& yar_packager_available(YAR_PACKAGER_JSON)) {
+			packager = YAR_PACKAGER_JSON;
+		}
+		if (!(list = yar_server_method_list(packager))) {
+			return 0;
+		}
+		if ((response->payload.data = malloc(list->size))) {
+			memcpy(response->payload.data, list->data, list->size);
+			response->payload.size = list->size;
+		}
+	}
+
+	if (!response->payload.data) {
+		return 0;
+	}
+	yar_protocol_render(&header, ctx->header->id, YAR_SERVER_NAME, NULL, response->payload.size - sizeof(yar_header), flag);
+	memcpy(response->payload.data, (char *)&header, sizeof(yar_header));
+
+	return 1;
+}
+/* }}} */
+
+/* the packager tag selects the wire codec; both packagers share the same
+ * envelope ({i,m,p}), so handlers stay format-agnostic. An unsupported one
+ * sets the error of the response */
+static yar_packager_type yar_server_packager(char *tag, yar_response *response) /* {{{ */ {
+	if (strncmp(tag, YAR_PACKAGER_JSON_TAG, sizeof(YAR_PACKAGER_JSON_TAG) - 1) == 0) {
+		if (yar_packager_available(YAR_PACKAGER_JSON)) {
+			return YAR_PACKAGER_JSON;
+		}
+		yar_response_set_error(response, YAR_ERROR, "%s", "package protocol JSON is not supported, rebuild with cJSON to enable it");
+	} else if (strncmp(tag, YAR_PACKAGER, sizeof(YAR_PACKAGER) - 1) != 0) {
+		yar_response_set_error(response, YAR_ERROR, "package protocol %.*s is not supported, only msgpack and JSON do",
+				sizeof(YAR_PACKAGER) - 1, tag);
+	}
+	return YAR_PACKAGER_MSGPACK;
+}
+/* }}} */
+
+/* call the handler of an unpacked request */
+static void yar_server_dispatch(yar_request *request, yar_response *response) /* {{{ */ {
+	yar_server_handler *handler;
+
+	yar_server_request_method(request);
+	handler = yar_server_find_handler(request->method, request->mlen);
+	if (!handler) {
+		yar_response_set_error(response, YAR_ERROR, "call to undefined method '%.*s'", request->mlen, request->method);
+	} else {
+		handler->handler(request, response, server->data);
+	}
+}
+/* }}} */
+
+/* the flags of a response to the request of ctx: a client that takes
+ * compressed bodies is told the server does too, and gets a large body
+ * (after its header and packager tag) compressed */
+static uint yar_server_compress(yar_request_context *ctx, yar_payload *payload) /* {{{ */ {
+	uint offset = sizeof(yar_header) + sizeof(YAR_PACKAGER);
+
+	if (!(ctx->header->reserved & YAR_PROTOCOL_ACCEPT_COMPRESSED) || !yar_protocol_compression()) {
+		return 0;
+	}
+	if (server->compress_threshold && payload->size - offset >= (uint)server->compress_threshold
+			&& yar_protocol_compress(payload, offset)) {
+		return YAR_PROTOCOL_ACCEPT_COMPRESSED | YAR_PROTOCOL_COMPRESSED;
+	}
+	return YAR_PROTOCOL_ACCEPT_COMPRESSED;
+}
+/* }}} */
+
+/* a compressed request body is inflated in place, returns 0 if it is broken */
+static int yar_server_inflate(yar_request_context *ctx) /* {{{ */ {
+	yar_request *request = ctx->request;
+	yar_payload payload;
+
+	if (!(ctx->header->reserved & YAR_PROTOCOL_COMPRESSED)) {
+		return 1;
+	}
+
+	payload.data = request->body;
+	payload.size = request->blen;
+	if (!yar_protocol_decompress(&payload, sizeof(yar_header) + sizeof(YAR_PACKAGER), YAR_MAX_BODY_SIZE)) {
+		return 0;
+	}
+	request->body = payload.data;
+	request->blen = request->size = payload.size;
+	ctx->header = (yar_header *)request->body;
+	ctx->header->body_len = payload.size - sizeof(yar_header);
+
+	return 1;
+}
+/* }}} */
+
+/* every entry of a batch is a request of its own ({i,m,p}), answered by an
+ * entry of the response batch ({i,s,r,e}) in the same order. To the log and
+ * the scoreboard the batch is one request */
+static int yar_server_batch(yar_request_context *ctx, yar_packager_type packager) /* {{{ */ {
+	yar_request *request = ctx->request;
+	yar_response *response = ctx->response;
+	uint offset = 0, len, num = 0, used = sizeof(yar_header) + sizeof(YAR_PACKAGER), capacity = 1024;
+	char *body = request->body + sizeof(yar_header) + sizeof(YAR_PACKAGER), *entry, *data;
+	uint size = request->blen - sizeof(yar_header) - sizeof(YAR_PACKAGER);
+	yar_header header = {0};
+	int status;
+	uint flags;
+
+	if (request->blen < sizeof(yar_header) + sizeof(YAR_PACKAGER)) {
+		return 0;
+	}
+
+	data = malloc(capacity);
+	while ((status = yar_protocol_batch_next(body, size, &offset, &entry, &len)) == 1) {
+		yar_request call = {0};
+		yar_response answer = {0};
+		yar_payload payload = {0};
+
+		if (!yar_request_unpack(&call, entry, len, 0, packager)) {
+			yar_response_set_error(&answer, YAR_ERROR, "%s", "request header verify failed");
+		} else {
+			answer.id = call.id;
+			yar_server_dispatch(&call, &answer);
+		}
+
+		if (!yar_response_pack(&answer, &payload, YAR_BATCH_ENTRY_PREFIX, packager)) {
+			yar_request_free(&call);
+			yar_response_free(&answer);
+			free(data);
+			return 0;
+		}
+		yar_protocol_batch_put(payload.data, payload.size - YAR_BATCH_ENTRY_PREFIX);
+
+		if (used + payload.size > capacity) {
+			while (used + payload.size > capacity) {
+				capacity *= 2;
+			}
+			data = realloc(data, capacity);
+		}
+		memcpy(data + used, payload.data, payload.size);
+		used += payload.size;
+		num++;
+
+		free(payload.data);
+		yar_request_free(&call);
+		yar_response_free(&answer);
+	}
+
+	if (status == -1) {
+		yar_server_log_error(ctx, "Batch request cut short after %u entries", num);
+		free(data);
+		return 0;
+	}
+
+	request->id = response->id = ctx->header->id;
+	request->method = malloc(32);
+	request->mlen = snprintf(request->method, 32, "batch(%u)", num);
+
+	memcpy(data + sizeof(yar_header), packager == YAR_PACKAGER_JSON? YAR_PACKAGER_JSON_TAG : YAR_PACKAGER, sizeof(YAR_PACKAGER));
+	response->payload.data = data;
+	response->payload.size = used;
+	flags = yar_server_compress(ctx, &response->payload);
+	yar_protocol_render(&header, ctx->header->id, YAR_SERVER_NAME, NULL, response->payload.size - sizeof(yar_header), YAR_PROTOCOL_BATCH | flags);
+	memcpy(response->payload.data, (char *)&header, sizeof(yar_header));
+
+	return 1;
+}
+/* }}} */
+
 static void yar_server_reset(yar_request_context *ctx) /* {{{ */ {
 	ctx->header = NULL;
 	ctx->header_read = 0;
@@ -449,6 +1200,22 @@ static void yar_server_reset(yar_request_context *ctx) /* {{{ */ {
 /* }}} */
 
 static void yar_server_close_connection(int fd, yar_request_context *ctx) /* {{{ */ {
+	if (ctx->prev) {
+		ctx->prev->next = ctx->next;
+	} else {
+		server->contexts = ctx->next;
+	}
+	if (ctx->next) {
+		ctx->next->prev = ctx->prev;
+	}
+	server->connections--;
+	if (server->slot) {
+		yar_server_slot_lock();
+		server->slot->connections--;
+		yar_server_slot_unlock();
+	}
+	yar_server_request_end(ctx);
+
 	close(fd);
 	event_del(&ctx->ev_read);
 	/* ev_write is only initialized once the request has been fully read;
@@ -460,6 +1227,94 @@ static void yar_server_close_connection(int fd, yar_request_context *ctx) /* {{{
 	yar_request_free(ctx->request);
 	yar_response_free(ctx->response);
 	free(ctx);
+
+	if (server->draining && !server->connections) {
+		event_loopexit(NULL);
+	}
+}
+/* }}} */
+
+/* resident set size of the current process in KB */
+static ulong yar_server_worker_rss() /* {{{ */ {
+	ulong rss = 0;
+	FILE *fp = fopen("/proc/self/statm", "r");
+
+	if (fp) {
+		ulong size, resident;
+		if (fscanf(fp, "%lu %lu", &size, &resident) == 2) {
+			rss = resident * (sysconf(_SC_PAGESIZE) / 1024);
+		}
+		fclose(fp);
+	} else {
+		/* no procfs, the peak RSS is the best we can get */
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+			rss = usage.ru_maxrss / 1024; /* bytes on macOS */
+#else
+			rss = usage.ru_maxrss;
+#endif
+		}
+	}
+
+	return rss;
+}
+/* }}} */
+
+/* stop accepting and exit once the connections in progress are done, the
+ * master forks a replacement as soon as it reaps this worker */
+static void yar_server_worker_drain() /* {{{ */ {
+	yar_request_context *ctx, *next;
+
+	if (server->draining) {
+		return;
+	}
+
+	if (server->slot) {
+		server->slot->state = YAR_WORKER_DRAINING;
+		event_del(&server->ev_drain);
+	}
+	event_del(&server->ev_accept);
+	if (server->rss_limit) {
+		event_del(&server->ev_maintenance);
+	}
+
+	/* idle keep-alive connections would hold the worker until they time out,
+	 * fresh ones are left alone, their first request is likely on the way */
+	for (ctx = server->contexts; ctx; ctx = next) {
+		next = ctx->next;
+		if (ctx->served && !ctx->header && !ctx->header_read) {
+			yar_server_close_connection(ctx->fd, ctx);
+		}
+	}
+
+	server->running = 0;
+	server->draining = 1;
+	if (!server->connections) {
+		event_loopexit(NULL);
+	}
+}
+/* }}} */
+
+/* SIGUSR1, the master shrinks the pool */
+static void yar_server_on_drain(int signo, short ev, void *arg) /* {{{ */ {
+	alog(YAR_DEBUG, "Worker %d stopping on request of the master, %d connections to finish", getpid(), server->connections);
+	yar_server_worker_drain();
+}
+/* }}} */
+
+static void yar_server_on_maintenance(int fd, short ev, void *arg) /* {{{ */ {
+	struct timeval tv = {1, 0};
+	ulong rss = yar_server_worker_rss();
+
+	if (rss > server->rss_limit) {
+		alog(YAR_NOTICE, "Worker %d recycling, rss %luKB exceeds %luKB, %d connections to finish",
+				getpid(), rss, server->rss_limit, server->connections);
+		yar_server_worker_drain();
+		return;
+	}
+
+	evtimer_add(&server->ev_maintenance, &tv);
 }
 /* }}} */
 
@@ -489,8 +1344,26 @@ static void yar_server_on_write(int fd, short ev, void *arg) /* {{{ */ {
 		}
 	}
 
-	yar_server_log(ctx);
-	if (ctx->header->reserved & YAR_PROTOCOL_PERSISTENT) {
+	if (!(ctx->header->reserved & (YAR_PROTOCOL_PING | YAR_PROTOCOL_LIST))) {
+		/* health checks would flood the log */
+		yar_server_log(ctx);
+	}
+	if (server->slot) {
+		yar_server_slot_lock();
+		server->slot->requests++;
+		server->slot->bytes_out += response->payload.size;
+		yar_server_slot_unlock();
+	}
+	yar_server_request_end(ctx);
+	ctx->served++;
+
+	if (server->request_limit && ++server->requests >= server->request_limit) {
+		alog(YAR_NOTICE, "Worker %d recycling after %lu requests, %d connections to finish",
+				getpid(), server->requests, server->connections - 1);
+		yar_server_worker_drain();
+	}
+
+	if ((ctx->header->reserved & YAR_PROTOCOL_PERSISTENT) && !server->draining) {
 		yar_server_reset(ctx);
 	} else {
 		yar_server_close_connection(fd, ctx);
@@ -498,6 +1371,15 @@ static void yar_server_on_write(int fd, short ev, void *arg) /* {{{ */ {
 }
 /* }}} */
 
+/* the response payload is ready, stop reading and start writing it out */
+static void yar_server_respond(int fd, yar_request_context *ctx) /* {{{ */ {
+	event_set(&ctx->ev_write, fd, EV_WRITE|EV_PERSIST, yar_server_on_write, ctx);
+	event_add(&ctx->ev_write, &ctx->timeout);
+	ctx->write_registered = 1;
+	event_del(&ctx->ev_read);
+}
+/* }}} */
+
 static void yar_server_on_read(int fd, short ev, void *arg) /* {{{ */ {
 	yar_request_context *ctx = (yar_request_context *)arg;
 	yar_request *request = ctx->request;
@@ -528,6 +1410,10 @@ static void yar_server_on_read(int fd, short ev, void *arg) /* {{{ */ {
 				return;
 			}
 
+			if (!ctx->header_read) {
+				yar_server_request_begin(ctx);
+			}
+			yar_server_count_bytes(read_bytes, 0);
 			ctx->header_read += read_bytes;
 			if (ctx->header_read < sizeof(yar_header)) {
 				/* there are more header bytes to read */
@@ -577,33 +1463,38 @@ static void yar_server_on_read(int fd, short ev, void *arg) /* {{{ */ {
 				return;
 			}
 			request->blen += read_bytes;
+			yar_server_count_bytes(read_bytes, 0);
 		}
 
 		if (request->blen < request->size) {
 			/* there are more data to read */
 			return;
+		} else if (!yar_server_inflate(ctx)) {
+			yar_server_log_error(ctx, "Failed to decompress request body");
+			yar_server_close_connection(fd, ctx);
+			return;
+		} else if (ctx->header->reserved & (YAR_PROTOCOL_PING | YAR_PROTOCOL_LIST)) {
+			if (!yar_server_control(ctx)) {
+				yar_server_log_error(ctx, "Failed to answer a %s request", (ctx->header->reserved & YAR_PROTOCOL_PING)? "ping" : "list");
+				yar_server_close_connection(fd, ctx);
+				return;
+			}
+			yar_server_respond(fd, ctx);
+			return;
 		} else {
-			yar_server_handler *handler;
 			yar_header header = {0};
 			yar_response *response = ctx->response;
-			char *tag = request->body + sizeof(yar_header);
-			yar_packager_type packager;
-
-			/* the packager tag selects the wire codec; both packagers share
-			 * the same envelope ({i,m,p}), so handlers stay format-agnostic */
-			if (strncmp(tag, YAR_PACKAGER_JSON_TAG, sizeof(YAR_PACKAGER_JSON_TAG) - 1) == 0) {
-				if (yar_packager_available(YAR_PACKAGER_JSON)) {
-					packager = YAR_PACKAGER_JSON;
-				} else {
-					packager = YAR_PACKAGER_MSGPACK;
-					yar_response_set_error(response, YAR_ERROR, "%s", "package protocol JSON is not supported, rebuild with cJSON to enable it");
+			yar_packager_type packager = yar_server_packager(request->body + sizeof(yar_header), response);
+			uint flags;
+
+			if (ctx->header->reserved & YAR_PROTOCOL_BATCH) {
+				if (response->error || !yar_server_batch(ctx, packager)) {
+					yar_server_log_error(ctx, "Failed to answer a batch request");
+					yar_server_close_connection(fd, ctx);
+					return;
 				}
-			} else if (strncmp(tag, YAR_PACKAGER, sizeof(YAR_PACKAGER) - 1) == 0) {
-				packager = YAR_PACKAGER_MSGPACK;
-			} else {
-				packager = YAR_PACKAGER_MSGPACK;
-				yar_response_set_error(response, YAR_ERROR, "package protocol %.*s is not supported, only msgpack and JSON do",
-						sizeof(YAR_PACKAGER) - 1, tag);
+				yar_server_respond(fd, ctx);
+				return;
 			}
 
 			if (!response->error) {
@@ -611,12 +1502,7 @@ static void yar_server_on_read(int fd, short ev, void *arg) /* {{{ */ {
 					yar_response_set_error(response, YAR_ERROR, "%s", "request header verify failed");
 				} else {
 					response->id = request->id;
-					handler = yar_server_find_handler(request->method, request->mlen);
-					if (!handler) {
-						yar_response_set_error(response, YAR_ERROR, "call to undefined method '%.*s'", request->mlen, request->method);
-					} else {
-						handler->handler(request, response, server->data);
-					}
+					yar_server_dispatch(request, response);
 				}
 			}
 
@@ -627,13 +1513,11 @@ static void yar_server_on_read(int fd, short ev, void *arg) /* {{{ */ {
 				yar_server_close_connection(fd, ctx);
 				return;
 			}
-			yar_protocol_render(&header, request->id, YAR_SERVER_NAME, NULL, response->payload.size - sizeof(yar_header), 0);
-			memcpy(response->payload.data, (char *)&header, sizeof(yar_header));
 			memcpy(response->payload.data + sizeof(yar_header), packager == YAR_PACKAGER_JSON? YAR_PACKAGER_JSON_TAG : YAR_PACKAGER, sizeof(YAR_PACKAGER));
-			event_set(&ctx->ev_write, fd, EV_WRITE|EV_PERSIST, yar_server_on_write, ctx);
-			event_add(&ctx->ev_write, &ctx->timeout);
-			ctx->write_registered = 1;
-			event_del(&ctx->ev_read);
+			flags = yar_server_compress(ctx, &response->payload);
+			yar_protocol_render(&header, request->id, YAR_SERVER_NAME, NULL, response->payload.size - sizeof(yar_header), flags);
+			memcpy(response->payload.data, (char *)&header, sizeof(yar_header));
+			yar_server_respond(fd, ctx);
 			return;
 		}
 	}
@@ -665,15 +1549,32 @@ static void yar_server_on_accept(int fd, short ev, void *arg) /* {{{ */ {
 
 	client_len = sizeof(client_addr);
 	if (getpeername(client_fd, (struct sockaddr *)&client_addr, &client_len) == 0
-			&& client_addr.ss_family == AF_INET) {
-		ctx->remote_addr = inet_ntoa(((struct sockaddr_in *)&client_addr)->sin_addr);
-		ctx->remote_port = ntohs(((struct sockaddr_in *)&client_addr)->sin_port);
+			&& (client_addr.ss_family == AF_INET || client_addr.ss_family == AF_INET6)) {
+		char port[8];
+
+		getnameinfo((struct sockaddr *)&client_addr, client_len, ctx->remote_buf, sizeof(ctx->remote_buf),
+				port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV);
+		ctx->remote_addr = ctx->remote_buf;
+		ctx->remote_port = atol(port);
 	} else {
 		/* unix domain socket peers (or failed getpeername) have no ip:port */
 		ctx->remote_addr = "unix";
 		ctx->remote_port = 0;
 	}
 
+	ctx->fd = client_fd;
+	ctx->next = server->contexts;
+	if (ctx->next) {
+		ctx->next->prev = ctx;
+	}
+	server->contexts = ctx;
+	server->connections++;
+	if (server->slot) {
+		yar_server_slot_lock();
+		server->slot->connections++;
+		yar_server_slot_unlock();
+	}
+
 	ctx->request = (yar_request *)((char *)ctx + sizeof(yar_request_context));
 	ctx->response = (yar_response *)((char *)ctx->request + sizeof(yar_request));
 	ctx->timeout.tv_sec = server->timeout;
@@ -714,6 +1615,7 @@ int yar_server_init(char *hostname) /* {{{ */ {
 	instance = calloc(1, sizeof(yar_server));
 	instance->hostname = hostname;
 	instance->timeout = 3;
+	instance->compress_threshold = yar_protocol_compression()? YAR_COMPRESS_MIN_SIZE : 0;
 	server = instance;
 
 	return 1;
@@ -753,6 +1655,82 @@ int yar_server_set_opt(yar_server_opt opt, void * val) /* {{{ */ {
 		case YAR_LOG_LEVEL:
 			server->log_level = *(int *)val;
 			break;
+		case YAR_MAX_REQUESTS_PER_WORKER:
+			if (*(int *)val < 0) {
+				alog(YAR_WARNING, "Max requests per worker can not be negative");
+				return 0;
+			}
+			server->max_requests = *(int *)val;
+			break;
+		case YAR_MAX_WORKER_RSS:
+			if (*(int *)val < 0) {
+				alog(YAR_WARNING, "Max worker rss can not be negative");
+				return 0;
+			}
+			server->max_rss = *(int *)val;
+			break;
+		case YAR_PROCESS_MANAGER:
+			if (*(int *)val != YAR_PM_STATIC && *(int *)val != YAR_PM_DYNAMIC) {
+				alog(YAR_WARNING, "Unknown process manager %d", *(int *)val);
+				return 0;
+			}
+			server->pm = *(int *)val;
+			break;
+		case YAR_START_CHILDREN:
+		case YAR_MIN_SPARE_CHILDREN:
+		case YAR_MAX_SPARE_CHILDREN:
+			if (*(int *)val < 0 || *(int *)val > 128) {
+				alog(YAR_WARNING, "Number of workers must between 0 ~ 128");
+				return 0;
+			}
+			if (opt == YAR_START_CHILDREN) {
+				server->start_children = *(int *)val;
+			} else if (opt == YAR_MIN_SPARE_CHILDREN) {
+				server->min_spare_children = *(int *)val;
+			} else {
+				server->max_spare_children = *(int *)val;
+			}
+			break;
+		case YAR_SCOREBOARD_FILE:
+			server->scoreboard_file = (char *)val;
+			break;
+		case YAR_WORKER_AFFINITY:
+			if (*(int *)val < YAR_AFFINITY_NONE || *(int *)val > YAR_AFFINITY_NODE) {
+				alog(YAR_WARNING, "Unknown worker affinity %d", *(int *)val);
+				return 0;
+			}
+#ifndef __linux__
+			if (*(int *)val != YAR_AFFINITY_NONE) {
+				alog(YAR_WARNING, "Worker affinity is only supported on Linux");
+				return 0;
+			}
+#endif
+			server->affinity = *(int *)val;
+			break;
+		case YAR_WORKER_CPUS:
+			if (val) {
+#ifdef __linux__
+				if (!yar_server_parse_cpus((char *)val, &server->cpus)) {
+					alog(YAR_WARNING, "Malformed CPU list '%s'", (char *)val);
+					return 0;
+				}
+#else
+				alog(YAR_WARNING, "Worker affinity is only supported on Linux");
+				return 0;
+#endif
+			}
+			server->worker_cpus = (char *)val;
+			break;
+		case YAR_COMPRESS_THRESHOLD:
+			if (*(int *)val < 0) {
+				return 0;
+			}
+			if (*(int *)val && !yar_protocol_compression()) {
+				alog(YAR_WARNING, "Compression is not available, built without zstd");
+				return 0;
+			}
+			server->compress_threshold = *(int *)val;
+			break;
 		case YAR_CHILD_USER:
 			{
 				struct passwd *pwd;
@@ -816,6 +1794,26 @@ const void * yar_server_get_opt(yar_server_opt opt) /* {{{ */ {
 			return &server->group;
 		case YAR_LOG_LEVEL:
 			return &server->log_level;
+		case YAR_MAX_REQUESTS_PER_WORKER:
+			return &server->max_requests;
+		case YAR_MAX_WORKER_RSS:
+			return &server->max_rss;
+		case YAR_PROCESS_MANAGER:
+			return &server->pm;
+		case YAR_START_CHILDREN:
+			return &server->start_children;
+		case YAR_MIN_SPARE_CHILDREN:
+			return &server->min_spare_children;
+		case YAR_MAX_SPARE_CHILDREN:
+			return &server->max_spare_children;
+		case YAR_SCOREBOARD_FILE:
+			return &server->scoreboard_file;
+		case YAR_WORKER_AFFINITY:
+			return &server->affinity;
+		case YAR_WORKER_CPUS:
+			return &server->worker_cpus;
+		case YAR_COMPRESS_THRESHOLD:
+			return &server->compress_threshold;
 		default:
 			alog(YAR_WARNING, "Unrecognized opt %d", opt);
 			return NULL;
@@ -825,6 +1823,7 @@ const void * yar_server_get_opt(yar_server_opt opt) /* {{{ */ {
 
 int yar_server_register_handler(yar_server_handler *handlers) /* {{{ */ {
 	server->handlers = handlers;
+	yar_server_method_list_free();
 	return 1;
 } 
 /* }}} */
@@ -843,15 +1842,65 @@ void yar_server_destroy() /* {{{ */ {
 	if (server->fd) {
 		close(server->fd);
 	}
+	if (server->scoreboard) {
+		munmap(server->scoreboard, yar_scoreboard_size(server->scoreboard->num_slots));
+		if (server->scoreboard_file && server->ppid == getpid()) {
+			unlink(server->scoreboard_file);
+		}
+	}
 	if (server->pid_file && server->ppid == getpid()) {
 		unlink(server->pid_file);
 	}
+	yar_server_method_list_free();
 	yar_logger_destroy();
 	free(server);
 	server = NULL;
 }
 /* }}} */
 
+/* snapshot of the pre-forked workers, for the master (or a worker) */
+int yar_server_scoreboard(yar_worker_status *workers, int max) /* {{{ */ {
+	if (!server || !server->scoreboard) {
+		return 0;
+	}
+	return yar_scoreboard_snapshot(server->scoreboard, workers, max);
+}
+/* }}} */
+
+/* snapshot of the workers of a server started with YAR_SCOREBOARD_FILE, for
+ * any other process; returns -1 if the file is not a (compatible) scoreboard */
+int yar_scoreboard_read(const char *file, yar_worker_status *workers, int max) /* {{{ */ {
+	int fd, n;
+	struct stat sb;
+	yar_scoreboard *scoreboard;
+
+	if ((fd = open(file, O_RDONLY)) == -1) {
+		return -1;
+	}
+	if (fstat(fd, &sb) == -1 || sb.st_size < (off_t)sizeof(yar_scoreboard)) {
+		close(fd);
+		return -1;
+	}
+	scoreboard = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (scoreboard == MAP_FAILED) {
+		return -1;
+	}
+
+	if (scoreboard->magic != YAR_SCOREBOARD_MAGIC
+			|| scoreboard->slot_size != sizeof(yar_worker_status)
+			|| (off_t)yar_scoreboard_size(scoreboard->num_slots) > sb.st_size) {
+		munmap(scoreboard, sb.st_size);
+		return -1;
+	}
+
+	n = yar_scoreboard_snapshot(scoreboard, workers, max);
+	munmap(scoreboard, sb.st_size);
+
+	return n;
+}
+/* }}} */
+
 int yar_server_run() /* {{{ */ {
 
 	if (!yar_logger_init(server->log_file, server->log_level)) {
@@ -864,13 +1913,24 @@ int yar_server_run() /* {{{ */ {
 		return 0;
 	}
 
+	if (!yar_server_pool_check()) {
+		return 0;
+	}
+
 	if (!yar_server_start_listening()) {
 		alog(YAR_ERROR, "Failed to setup server at %s", server->hostname);
 		yar_server_destroy();
 		return 0;
 	}
 
-	alog(YAR_DEBUG, "Attempt to start %d workers", (server->stand_alone || !server->max_children)? 1 : server->max_children);
+	if (server->stand_alone || !server->max_children) {
+		alog(YAR_DEBUG, "Attempt to start 1 workers");
+	} else if (server->pm == YAR_PM_DYNAMIC) {
+		alog(YAR_DEBUG, "Attempt to start %d workers, %d ~ %d spare, %d at most", server->start_children,
+				server->min_spare_children, server->max_spare_children, server->max_children);
+	} else {
+		alog(YAR_DEBUG, "Attempt to start %d workers", server->max_children);
+	}
 	if (!server->stand_alone && !yar_server_start_daemon()) {
 		alog(YAR_ERROR, "Failed to setup daemon");
 		return 0;
@@ -881,19 +1941,36 @@ int yar_server_run() /* {{{ */ {
 		/* master */
 		pid_t cid;
 		int stat;
+		time_t maintained = time(NULL);
 
 		while (server->running) {
 			if ((cid = waitpid(-1, &stat, 0)) > 0) {
 				alog(YAR_DEBUG, "Child %d exit with status %d", cid, stat);
-				if (!(cid = fork())) {
+				yar_server_reap_worker(cid);
+				if (server->pm != YAR_PM_DYNAMIC && !(cid = yar_server_spawn_worker())) {
 					alog(YAR_DEBUG, "Startup new worker, now running worker is %d, max worker is %d", server->running_children, server->max_children);
 					yar_server_child_init();
 					goto worker;
 				}
-			} 
+			} else if (cid == -1 && errno == ECHILD) {
+				/* nothing to wait for until the next maintenance spawns some */
+				pause();
+			}
+
+			if (server->pm == YAR_PM_DYNAMIC && server->running && time(NULL) != maintained) {
+				maintained = time(NULL);
+				if (!yar_server_maintain_pool()) {
+					yar_server_child_init();
+					goto worker;
+				}
+			}
 		}
 
 		alog(YAR_DEBUG, "Server is going down");
+		if (server->pm == YAR_PM_DYNAMIC) {
+			struct itimerval timer = {{0, 0}, {0, 0}};
+			setitimer(ITIMER_REAL, &timer, NULL);
+		}
 		signal(SIGQUIT, SIG_IGN);
 		kill(-(server->ppid), SIGQUIT);
 
@@ -907,15 +1984,30 @@ int yar_server_run() /* {{{ */ {
 		yar_server_destroy();
 	} else {
 		/* slavers */
-		struct event ev_accept;
 worker:
 		event_init();
+		if (server->slot) {
+			sigset_t drain;
+
+			event_set(&server->ev_drain, SIGUSR1, EV_SIGNAL|EV_PERSIST, yar_server_on_drain, NULL);
+			event_add(&server->ev_drain, NULL);
+			/* a drain held since the fork is delivered right here */
+			sigemptyset(&drain);
+			sigaddset(&drain, SIGUSR1);
+			sigprocmask(SIG_UNBLOCK, &drain, NULL);
+		}
+		if (server->rss_limit) {
+			struct timeval tv = {1, 0};
+			evtimer_set(&server->ev_maintenance, yar_server_on_maintenance, NULL);
+			evtimer_add(&server->ev_maintenance, &tv);
+		}
 		while (server->running) {
 			/* we can not run more than one server anyway */
-			event_set(&ev_accept, server->fd, EV_READ|EV_PERSIST, yar_server_on_accept, NULL);
-			event_add(&ev_accept, NULL);
+			event_set(&server->ev_accept, server->fd, EV_READ|EV_PERSIST, yar_server_on_accept, NULL);
+			event_add(&server->ev_accept, NULL);
 			event_dispatch();
 		}
+		/* a recycled worker gets here once its last connection is closed */
 		/* server has been shutdown */
 		yar_server_destroy();
 	}
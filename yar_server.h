@@ -32,9 +32,61 @@ typedef enum _yar_server_opt {
 	YAR_CUSTOM_DATA,
 	YAR_PID_FILE,
 	YAR_LOG_FILE,
-	YAR_LOG_LEVEL
+	YAR_LOG_LEVEL,
+	YAR_MAX_REQUESTS_PER_WORKER,
+	YAR_MAX_WORKER_RSS,
+	YAR_PROCESS_MANAGER,
+	YAR_START_CHILDREN,
+	YAR_MIN_SPARE_CHILDREN,
+	YAR_MAX_SPARE_CHILDREN,
+	YAR_SCOREBOARD_FILE,
+	YAR_WORKER_AFFINITY,
+	YAR_WORKER_CPUS,
+	YAR_COMPRESS_THRESHOLD /* bytes, responses from so large on are compressed for clients that take it, 0 never to */
 } yar_server_opt;
 
+/* values of YAR_PROCESS_MANAGER */
+#define YAR_PM_STATIC  0 /* always YAR_MAX_CHILDREN workers */
+#define YAR_PM_DYNAMIC 1 /* between the spare limits, YAR_MAX_CHILDREN at most */
+
+/* values of YAR_WORKER_AFFINITY */
+#define YAR_AFFINITY_NONE 0 /* leave workers to the scheduler */
+#define YAR_AFFINITY_CPU  1 /* one CPU per worker, round robin */
+#define YAR_AFFINITY_NODE 2 /* spread workers over the NUMA nodes */
+
+/* states of a worker, yar_worker_status.state */
+#define YAR_WORKER_FREE     0 /* unused slot */
+#define YAR_WORKER_RUNNING  1
+#define YAR_WORKER_DRAINING 2 /* finishing its connections before it exits */
+
+#define YAR_SCOREBOARD_MAGIC      0x59415253 /* "SRAY" */
+#define YAR_SCOREBOARD_METHOD_LEN 64
+
+/* one per pre-forked worker, the worker updates its own between two
+ * increments of seq (odd while an update is in progress), readers retry
+ * until they see the same even seq before and after copying */
+typedef struct _yar_worker_status {
+	unsigned int seq;
+	pid_t pid;
+	int state;
+	int connections;      /* open connections */
+	int busy;             /* requests in progress */
+	ulong requests;       /* requests answered */
+	ulong bytes_in;
+	ulong bytes_out;
+	ulong request_start;  /* microseconds since the epoch, 0 while idle */
+	char method[YAR_SCOREBOARD_METHOD_LEN]; /* of the current or last request */
+} yar_worker_status;
+
+/* layout of YAR_SCOREBOARD_FILE */
+typedef struct _yar_scoreboard {
+	unsigned int magic;
+	unsigned int slot_size; /* sizeof(yar_worker_status) of the writer */
+	unsigned int num_slots;
+	pid_t master;
+	yar_worker_status workers[];
+} yar_scoreboard;
+
 typedef struct _yar_server yar_server; 
 
 typedef void (*yar_init) (void *data);
@@ -54,6 +106,8 @@ int yar_server_register_handler(yar_server_handler *handlers);
 void yar_server_shutdown(int signo);
 void yar_server_destroy();
 int yar_server_run();
+int yar_server_scoreboard(yar_worker_status *workers, int max);
+int yar_scoreboard_read(const char *file, yar_worker_status *workers, int max);
 
 #endif
 /*
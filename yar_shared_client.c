@@ -0,0 +1,293 @@
+/**
+ * Yar - Concurrent RPC Server for PHP, C etc
+ *
+ * Copyright (C) 2012-2012 Xinchen Hui <laruence at gmail dot com>
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "event.h" 		/* for libevent */
+
+#include "yar_common.h"
+#include "yar_pack.h"
+#include "yar_log.h"
+#include "yar_response.h"
+#include "yar_client.h"
+#include "yar_shared_client.h"
+
+/* a call, from the thread making it; it waits on it until the I/O thread
+ * has the answer */
+typedef struct _yar_shared_call {
+	struct _yar_shared_call *next;           /* in the submission queue */
+	char *method;
+	uint num_args;
+	yar_packager **parameters;
+	yar_response *response;
+	int done;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} yar_shared_call;
+
+/* the calls of every thread go through one I/O thread, which pipelines them
+ * over a few connections. Threads hand their calls over by a lock-free
+ * queue (many producers, one consumer) and wake it through a pipe */
+struct _yar_shared_client {
+	yar_client **links;
+	uint num_links;
+	uint next;                          /* the link the next call goes over */
+	struct event_base *base;
+	struct event ev_wake;
+	int wake[2];                        /* the pipe the I/O thread is woken by */
+	int signalled;                      /* a wake is pending, no need to write another */
+	int stopping;
+	int running;
+	pthread_t thread;
+	yar_shared_call *head;              /* where threads push */
+	yar_shared_call *tail;              /* where the I/O thread pops */
+	yar_shared_call stub;
+};
+
+/* any number of threads at once; a call is only visible to the I/O thread
+ * once it is linked in, which follows the exchange */
+static void yar_shared_push(yar_shared_client *sc, yar_shared_call *call) /* {{{ */ {
+	yar_shared_call *prev;
+
+	call->next = NULL;
+	prev = __atomic_exchange_n(&sc->head, call, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, call, __ATOMIC_RELEASE);
+}
+/* }}} */
+
+/* the I/O thread only; NULL when the queue is empty, or when the next call
+ * is half pushed, its wake follows then */
+static yar_shared_call * yar_shared_pop(yar_shared_client *sc) /* {{{ */ {
+	yar_shared_call *tail = sc->tail, *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+	if (tail == &sc->stub) {
+		if (!next) {
+			return NULL;
+		}
+		sc->tail = tail = next;
+		next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+	}
+	if (next) {
+		sc->tail = next;
+		return tail;
+	}
+	if (tail != __atomic_load_n(&sc->head, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+
+	yar_shared_push(sc, &sc->stub);
+	if ((next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE))) {
+		sc->tail = next;
+		return tail;
+	}
+	return NULL;
+}
+/* }}} */
+
+static void yar_shared_wake(yar_shared_client *sc) /* {{{ */ {
+	int idle = 0;
+
+	if (__atomic_compare_exchange_n(&sc->signalled, &idle, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		while (write(sc->wake[1], "", 1) == -1 && errno == EINTR);
+	}
+}
+/* }}} */
+
+static void yar_shared_complete(yar_shared_call *call, yar_response *response) /* {{{ */ {
+	pthread_mutex_lock(&call->lock);
+	call->response = response;
+	call->done = 1;
+	pthread_cond_signal(&call->cond);
+	pthread_mutex_unlock(&call->lock);
+}
+/* }}} */
+
+static void yar_shared_on_complete(yar_response *response, void *data) /* {{{ */ {
+	yar_shared_complete((yar_shared_call *)data, response);
+}
+/* }}} */
+
+static void yar_shared_on_wake(int fd, short ev, void *arg) /* {{{ */ {
+	yar_shared_client *sc = (yar_shared_client *)arg;
+	yar_shared_call *call;
+	char buf[64];
+
+	while (read(fd, buf, sizeof(buf)) > 0);
+	/* the calls pushed from now on wake it again */
+	__atomic_store_n(&sc->signalled, 0, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&sc->stopping, __ATOMIC_ACQUIRE)) {
+		event_base_loopbreak(sc->base);
+		return;
+	}
+
+	while ((call = yar_shared_pop(sc))) {
+		yar_client *client = sc->links[sc->next];
+
+		sc->next = (sc->next + 1) % sc->num_links;
+		if (!yar_client_call_async(client, sc->base, call->method, call->num_args, call->parameters, yar_shared_on_complete, call)) {
+			yar_shared_complete(call, NULL);
+		}
+	}
+}
+/* }}} */
+
+static void * yar_shared_run(void *arg) /* {{{ */ {
+	yar_shared_client *sc = (yar_shared_client *)arg;
+
+	event_base_dispatch(sc->base);
+	return NULL;
+}
+/* }}} */
+
+/* nothing is connected here, the links connect with the first calls over
+ * them and again after they lost their connection */
+yar_shared_client * yar_shared_client_init(char *hostname, uint num_links) /* {{{ */ {
+	yar_shared_client *sc;
+	int persistent = 1;
+	uint i;
+
+	if (!num_links) {
+		alog(YAR_ERROR, "A shared client needs at least one link");
+		return NULL;
+	}
+
+	sc = calloc(1, sizeof(yar_shared_client));
+	sc->wake[0] = sc->wake[1] = -1;
+	sc->links = calloc(num_links, sizeof(yar_client *));
+	for (i = 0; i < num_links; i++) {
+		if (!(sc->links[i] = yar_client_new(hostname))) {
+			yar_shared_client_destroy(sc);
+			return NULL;
+		}
+		sc->num_links++;
+		/* the calls are pipelined */
+		yar_client_set_opt(sc->links[i], YAR_PERSISTENT_LINK, &persistent);
+	}
+
+	sc->head = sc->tail = &sc->stub;
+	if (pipe(sc->wake) == -1 || !(sc->base = event_base_new())) {
+		alog(YAR_ERROR, "Failed to set up the I/O thread '%s'", strerror(errno));
+		yar_shared_client_destroy(sc);
+		return NULL;
+	}
+	yar_set_non_blocking(sc->wake[0]);
+	event_set(&sc->ev_wake, sc->wake[0], EV_READ | EV_PERSIST, yar_shared_on_wake, sc);
+	event_base_set(sc->base, &sc->ev_wake);
+	event_add(&sc->ev_wake, NULL);
+
+	if (pthread_create(&sc->thread, NULL, yar_shared_run, sc) != 0) {
+		alog(YAR_ERROR, "Failed to start the I/O thread");
+		event_del(&sc->ev_wake);
+		yar_shared_client_destroy(sc);
+		return NULL;
+	}
+	sc->running = 1;
+
+	return sc;
+}
+/* }}} */
+
+/* applies to every link; set the options before the first call, the I/O
+ * thread does not expect them to change under it. The links only make
+ * asynchronous calls, which a cache would never answer */
+int yar_shared_client_set_opt(yar_shared_client *sc, yar_client_opt opt, void *val) /* {{{ */ {
+	uint i;
+
+	if (opt == YAR_PERSISTENT_LINK || opt == YAR_OPT_CACHE) {
+		return 0;
+	}
+	for (i = 0; i < sc->num_links; i++) {
+		if (!yar_client_set_opt(sc->links[i], opt, val)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+/* }}} */
+
+/* any thread may call, the call blocks until its answer is in, as
+ * client->call() does; the parameters are packed by the I/O thread */
+yar_response * yar_shared_client_call(yar_shared_client *sc, char *method, uint num_args, yar_packager *parameters[]) /* {{{ */ {
+	yar_shared_call call;
+
+	memset(&call, 0, sizeof(yar_shared_call));
+	call.method = method;
+	call.num_args = num_args;
+	call.parameters = parameters;
+	pthread_mutex_init(&call.lock, NULL);
+	pthread_cond_init(&call.cond, NULL);
+
+	yar_shared_push(sc, &call);
+	yar_shared_wake(sc);
+
+	pthread_mutex_lock(&call.lock);
+	while (!call.done) {
+		pthread_cond_wait(&call.cond, &call.lock);
+	}
+	pthread_mutex_unlock(&call.lock);
+
+	pthread_cond_destroy(&call.cond);
+	pthread_mutex_destroy(&call.lock);
+
+	return call.response;
+}
+/* }}} */
+
+/* no call may be in progress, from any thread */
+void yar_shared_client_destroy(yar_shared_client *sc) /* {{{ */ {
+	uint i;
+
+	if (sc->running) {
+		__atomic_store_n(&sc->stopping, 1, __ATOMIC_RELEASE);
+		while (write(sc->wake[1], "", 1) == -1 && errno == EINTR);
+		pthread_join(sc->thread, NULL);
+		event_del(&sc->ev_wake);
+	}
+	/* the links take their events off the base */
+	for (i = 0; i < sc->num_links; i++) {
+		yar_client_destroy(sc->links[i]);
+	}
+	if (sc->base) {
+		event_base_free(sc->base);
+	}
+	if (sc->wake[0] != -1) {
+		close(sc->wake[0]);
+		close(sc->wake[1]);
+	}
+	free(sc->links);
+	free(sc);
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,37 @@
+/**
+ * Yar - Concurrent RPC Server for PHP, C etc
+ *
+ * Copyright (C) 2012-2012 Xinchen Hui <laruence at gmail dot com>
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef YAR_SHARED_CLIENT_H
+#define YAR_SHARED_CLIENT_H
+
+typedef struct _yar_shared_client yar_shared_client;
+
+yar_shared_client * yar_shared_client_init(char *hostname, uint num_links);
+int yar_shared_client_set_opt(yar_shared_client *sc, yar_client_opt opt, void *val);
+yar_response * yar_shared_client_call(yar_shared_client *sc, char *method, uint num_args, yar_packager *parameters[]);
+void yar_shared_client_destroy(yar_shared_client *sc);
+
+#endif
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */